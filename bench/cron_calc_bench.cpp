@@ -0,0 +1,601 @@
+/*
+ * Copyright (c) 2018-2019 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+/*
+ * Benchmark suite, prints results as JSON to stdout, for tracking regressions.
+ * Build library with optimization enabled, e.g. -DCMAKE_BUILD_TYPE=Release,
+ * otherwise results tell little; "optimized" field of the output tells whether
+ * the library was, judging by flags it is compiled with, see CMakeLists.txt.
+ *
+ * Usage: cron_calc_bench [--quick] [name-filter]
+ *
+ * Each benchmark runs the same batch of operations a number of times (samples).
+ * Every operation is timed separately, from the end of the previous one, and clock
+ * overhead measured at start is subtracted, so mean and percentiles are those of single
+ * calls and slow calls are not hidden in batch averages. "kernel_speedup" gives
+ * median generic search time / median kernel search time for single rules. Exit code is the number of
+ * failed sanity checks, e.g. kernel and generic search giving different results.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cron_calc.h"
+#include "cron_calc.hpp"
+
+/* ---------------------------------------------------------------------------- */
+
+namespace
+{
+
+/* POSIX rule of Europe/Berlin, so that local time search crosses DST transitions
+ * without depending on time zone database */
+const char* const BENCH_TZ = "CET-1CEST,M3.5.0,M10.5.0/3";
+const time_t BENCH_START = 1577836800; /* 2020-01-01 00:00:00 UTC */
+const time_t BENCH_STEP = 997;         /* seconds added to found instant before next call */
+
+struct BenchRule
+{
+    const char* name;
+    const char* expr;
+    cron_calc_option_mask options;
+};
+
+const BenchRule K_NEXT_RULES[] = {
+    { "dense_seconds", "* * * * * *", CRON_CALC_OPT_WITH_SECONDS },
+    { "every_5_minutes", "*/5 * * * *", CRON_CALC_OPT_DEFAULT },
+    { "work_hours", "0 9-17 * * MON-FRI", CRON_CALC_OPT_DEFAULT },
+    { "last_day", "30 2 L * *", CRON_CALC_OPT_DEFAULT },
+    { "friday_13", "0 0 13 * FRI", CRON_CALC_OPT_DEFAULT },
+    { "sparse_seconds", "*/7 5-10 3,15 * * *", CRON_CALC_OPT_WITH_SECONDS },
+    { "leap_day", "0 0 29 FEB *", CRON_CALC_OPT_DEFAULT },
+    /* both day fields restricted, either of them matches */
+    { "leap_day_or_monday", "0 0 29 FEB MON", CRON_CALC_OPT_DEFAULT },
+    /* leap days only in years skipping 2100, which is not leap */
+    { "leap_day_years", "0 0 12 29 2 * 2096,2104-2196/8", CRON_CALC_OPT_FULL },
+    { "every_4_years", "0 0 12 1 1 * 2020-2199/4", CRON_CALC_OPT_FULL },
+    /* all years are before start time, every call searches and fails */
+    { "expired_years", "0 0 12 1 1 * 1990-2010", CRON_CALC_OPT_FULL },
+};
+
+const BenchRule K_PARSE_EXPRS[] = {
+    { "", "* * * * *", CRON_CALC_OPT_DEFAULT },
+    { "", "*/5 * * * *", CRON_CALC_OPT_DEFAULT },
+    { "", "0 9-17 * * MON-FRI", CRON_CALC_OPT_DEFAULT },
+    { "", "15,45 8-18/2 1-7,15 jan-mar,Oct-DEC sun,Wed,sat", CRON_CALC_OPT_DEFAULT },
+    { "", "0 30 2 L * * 2020-2199/4", CRON_CALC_OPT_FULL },
+    { "", "*/7 5-10 3,15 * * *", CRON_CALC_OPT_WITH_SECONDS },
+    { "", "0 0 12 1 JUL FRI 1970,1980,1990-2020", CRON_CALC_OPT_FULL },
+    /* invalid ones fail at different stages */
+    { "", "0 0 30 FEB *", CRON_CALC_OPT_DEFAULT },
+    { "", "0 24 * * *", CRON_CALC_OPT_DEFAULT },
+    { "", "0 0 * FOO *", CRON_CALC_OPT_DEFAULT },
+};
+
+const size_t PARSE_INVALID = 3; /* the last ones in K_PARSE_EXPRS */
+
+const size_t NUM_NEXT_RULES = sizeof K_NEXT_RULES / sizeof K_NEXT_RULES[0];
+const size_t NUM_PARSE_EXPRS = sizeof K_PARSE_EXPRS / sizeof K_PARSE_EXPRS[0];
+
+typedef std::chrono::steady_clock BenchClock;
+
+int gErrors = 0;
+double gClockOverheadNs = 0; /* time of one clock reading, subtracted from every timed call */
+int gSamplesDivisor = 1;
+const char* gFilter = NULL;
+bool gFirstResult = true;
+std::map<std::string, double> gMedianNs; /* p50_ns of every benchmark run, by name */
+volatile uint64_t gSink = 0; /* keeps results of measured calls alive */
+
+/* ---------------------------------------------------------------------------- */
+
+void check(bool ok, const char* what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "check failed: %s\n", what);
+        gErrors++;
+    }
+}
+
+/* ---------------------------------------------------------------------------- */
+
+bool selected(const std::string& name)
+{
+    return !gFilter || name.find(gFilter) != std::string::npos;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+void printString(const char* str)
+{
+    putchar('"');
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\') putchar('\\');
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return Whether the last -O option in compiler flags enables optimization */
+bool optimizedFlags(const char* flags)
+{
+    const char* level = NULL;
+    for (const char* p = strstr(flags, "-O"); p; p = strstr(p + 2, "-O"))
+    {
+        if (p == flags || p[-1] == ' ') level = p + 2;
+    }
+    return level && *level != '0';
+}
+
+/* ---------------------------------------------------------------------------- */
+
+double percentile(const std::vector<double>& sorted, double q)
+{
+    const size_t i = size_t(q * double(sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/**
+ * Latencies of single operations, each one is timed from the end of the previous one,
+ * so that one clock reading is done per operation.
+ */
+class CallTimer
+{
+public:
+    void start()
+    {
+        mLast = BenchClock::now();
+    }
+
+    /* Ends timing of current operation and starts the next one */
+    void lap()
+    {
+        const BenchClock::time_point now = BenchClock::now();
+        const std::chrono::duration<double, std::nano> elapsed = now - mLast;
+        mNs.push_back(std::max(elapsed.count() - gClockOverheadNs, 0.0));
+        mLast = now;
+    }
+
+    std::vector<double> mNs;
+
+private:
+    BenchClock::time_point mLast;
+};
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return The least time between two clock readings, which is the overhead of one reading */
+double clockOverhead()
+{
+    double least = 1e9;
+    for (int i = 0; i < 10000; i++)
+    {
+        const BenchClock::time_point start = BenchClock::now();
+        const std::chrono::duration<double, std::nano> elapsed = BenchClock::now() - start;
+        least = std::min(least, elapsed.count());
+    }
+    return least;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/**
+ * Runs `run(sample, timer)` `samples` times, each run does `batch` operations
+ * and calls `timer.lap()` after each of them, then prints JSON object
+ * with nanoseconds per operation.
+ * @return Number of runs, 0 if benchmark is not selected.
+ */
+template <typename Run>
+size_t measure(const std::string& name, const char* expr, size_t samples, size_t batch, Run run)
+{
+    if (!selected(name)) return 0;
+
+    samples = std::max<size_t>(samples / gSamplesDivisor, 5);
+    CallTimer timer;
+    timer.mNs.reserve(samples * batch);
+    for (size_t s = 0; s < samples; s++)
+    {
+        timer.start();
+        run(s, timer);
+    }
+
+    std::vector<double>& ns = timer.mNs;
+    check(ns.size() == samples * batch, name.c_str());
+    if (ns.empty()) return samples;
+    double total = 0;
+    for (size_t i = 0; i < ns.size(); i++) total += ns[i];
+    std::sort(ns.begin(), ns.end());
+
+    printf("%s\n    {\"name\": ", gFirstResult ? "" : ",");
+    printString(name.c_str());
+    if (expr)
+    {
+        printf(", \"expr\": ");
+        printString(expr);
+    }
+    printf(", \"samples\": %zu, \"batch\": %zu, \"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p90_ns\": %.1f, "
+           "\"p99_ns\": %.1f, \"max_ns\": %.1f, \"ops_per_sec\": %.0f}",
+        samples, batch, total / double(ns.size()),
+        percentile(ns, 0.5), percentile(ns, 0.9), percentile(ns, 0.99), ns.back(),
+        total > 0 ? double(ns.size()) * 1e9 / total : 0.0);
+    gFirstResult = false;
+    gMedianNs[name] = percentile(ns, 0.5);
+    return samples;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+void benchParse()
+{
+    size_t failed = 0;
+    size_t runs = measure("parse/mixed", NULL, 20000, NUM_PARSE_EXPRS, [&failed](size_t, CallTimer& timer)
+    {
+        for (size_t i = 0; i < NUM_PARSE_EXPRS; i++)
+        {
+            cron_calc rule;
+            failed += cron_calc_parse(&rule, K_PARSE_EXPRS[i].expr, K_PARSE_EXPRS[i].options, NULL) != CRON_CALC_OK;
+            timer.lap();
+        }
+    });
+    check(failed == runs * PARSE_INVALID, "parse results");
+
+    size_t lengths[NUM_PARSE_EXPRS];
+    for (size_t i = 0; i < NUM_PARSE_EXPRS; i++)
+    {
+        lengths[i] = strlen(K_PARSE_EXPRS[i].expr);
+    }
+    failed = 0;
+    runs = measure("parse_n/mixed", NULL, 20000, NUM_PARSE_EXPRS, [&failed, &lengths](size_t, CallTimer& timer)
+    {
+        for (size_t i = 0; i < NUM_PARSE_EXPRS; i++)
+        {
+            cron_calc rule;
+            failed += cron_calc_parse_n(
+                &rule, K_PARSE_EXPRS[i].expr, lengths[i], K_PARSE_EXPRS[i].options, NULL) != CRON_CALC_OK;
+            timer.lap();
+        }
+    });
+    check(failed == runs * PARSE_INVALID, "parse_n results");
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/**
+ * Chains calls of `next` from fixed start time, each next call starts a bit after found instant,
+ * search starts over when rule has no more instants.
+ * @return The last found instant, to compare results of different searches.
+ */
+template <typename Next>
+time_t chainNext(Next next, size_t calls, time_t& t, CallTimer& timer)
+{
+    time_t last = CRON_CALC_INVALID_TIME;
+    for (size_t i = 0; i < calls; i++)
+    {
+        last = next(t);
+        timer.lap();
+        t = last == CRON_CALC_INVALID_TIME ? BENCH_START : last + BENCH_STEP;
+    }
+    gSink += uint64_t(last);
+    return last;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+void benchNextSingle(const cron_calc_tz* tz)
+{
+    const size_t SAMPLES = 2000, BATCH = 64;
+
+    for (size_t r = 0; r < NUM_NEXT_RULES; r++)
+    {
+        const BenchRule& br = K_NEXT_RULES[r];
+        cron_calc rule;
+        if (cron_calc_parse(&rule, br.expr, br.options, NULL) != CRON_CALC_OK)
+        {
+            check(false, br.expr);
+            continue;
+        }
+        cron_calc generic = rule;
+        generic.kernel = 0;
+        cron_calc_compiled compiled;
+        cron_calc_compile(&compiled, &rule);
+
+        const std::string suffix = std::string("/") + br.name;
+        time_t last[5] = { 0 };
+        time_t t = BENCH_START;
+
+        measure("next_local" + suffix, br.expr, SAMPLES, BATCH, [&](size_t s, CallTimer& timer)
+        {
+            if (s == 0) t = BENCH_START;
+            last[0] = chainNext([&rule](time_t after) { return cron_calc_next(&rule, after); }, BATCH, t, timer);
+        });
+        measure("next_local_generic" + suffix, br.expr, SAMPLES, BATCH, [&](size_t s, CallTimer& timer)
+        {
+            if (s == 0) t = BENCH_START;
+            last[1] = chainNext([&generic](time_t after) { return cron_calc_next(&generic, after); }, BATCH, t, timer);
+        });
+        measure("next_compiled" + suffix, br.expr, SAMPLES, BATCH, [&](size_t s, CallTimer& timer)
+        {
+            if (s == 0) t = BENCH_START;
+            last[2] = chainNext([&compiled](time_t after) { return cron_calc_compiled_next(&compiled, after); }, BATCH, t, timer);
+        });
+        measure("next_utc" + suffix, br.expr, SAMPLES, BATCH, [&](size_t s, CallTimer& timer)
+        {
+            if (s == 0) t = BENCH_START;
+            last[3] = chainNext([&rule](time_t after) { return cron_calc_next_utc(&rule, after); }, BATCH, t, timer);
+        });
+        measure("next_utc_generic" + suffix, br.expr, SAMPLES, BATCH, [&](size_t s, CallTimer& timer)
+        {
+            if (s == 0) t = BENCH_START;
+            last[4] = chainNext([&generic](time_t after) { return cron_calc_next_utc(&generic, after); }, BATCH, t, timer);
+        });
+        if (tz)
+        {
+            measure("next_tz" + suffix, br.expr, SAMPLES, BATCH, [&](size_t s, CallTimer& timer)
+            {
+                if (s == 0) t = BENCH_START;
+                chainNext([&rule, tz](time_t after) { return cron_calc_next_tz(&rule, tz, after); }, BATCH, t, timer);
+            });
+        }
+
+        /* the same number of chained calls from the same start gives the same instant */
+        if (!gFilter)
+        {
+            check(last[0] == last[1], "kernel and generic search differ");
+            check(last[0] == last[2], "compiled and plain search differ");
+            check(last[3] == last[4], "kernel and generic UTC search differ");
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Prints ratios of generic search time to kernel search time of single rules, by medians,
+ * which are less affected by noise than means.
+ * UTC search shows gain of the kernels, local one is dominated by libc conversions. */
+void printKernelSpeedup()
+{
+    printf(",\n  \"kernel_speedup\": {");
+    const char* separator = "";
+    for (size_t r = 0; r < NUM_NEXT_RULES; r++)
+    {
+        static const char* const searches[] = { "next_utc", "next_local" };
+        for (size_t i = 0; i < sizeof searches / sizeof searches[0]; i++)
+        {
+            const std::string kernel = std::string(searches[i]) + "/" + K_NEXT_RULES[r].name;
+            const std::string generic = std::string(searches[i]) + "_generic/" + K_NEXT_RULES[r].name;
+            if (!gMedianNs.count(kernel) || !gMedianNs.count(generic) || gMedianNs[kernel] <= 0) continue;
+
+            printf("%s\n    ", separator);
+            printString(kernel.c_str());
+            printf(": %.2f", gMedianNs[generic] / gMedianNs[kernel]);
+            separator = ",";
+        }
+    }
+    printf("\n  }");
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* 01:00 UTC on the last Sunday of given month, when EU time zones change DST */
+time_t euTransition(int year, int month)
+{
+    /* days since epoch of the last day of month, see days_from_civil() by H. Hinnant */
+    static const int lastDays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    const int y = month <= 2 ? year - 1 : year;
+    const int era = y / 400;
+    const int yoe = y - era * 400;
+    const int mp = (month + 9) % 12;
+    const int doy = (153 * mp + 2) / 5 + lastDays[month - 1] - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    const long days = long(era) * 146097 + doe - 719468;
+
+    const long sunday = days - (days + 4) % 7; /* 1970-01-01 is Thursday */
+    return time_t(sunday * 86400 + 3600);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+void benchDst(const cron_calc_tz* tz)
+{
+    struct DstRule
+    {
+        const char* name;
+        const char* expr;
+        bool spring;    // starts before spring transitions, otherwise before autumn ones
+    };
+    static const DstRule rules[] = {
+        { "skipped_hour", "30 2 * * *", true },
+        { "repeated_hour", "30 2 * * *", false },
+        { "quarter_hours_spring", "*/15 * * * *", true },
+        { "quarter_hours_autumn", "*/15 * * * *", false },
+        { "night_hours_autumn", "0 0-3 * * *", false },
+    };
+
+    /* a quarter before transitions of 2020-2039 */
+    std::vector<time_t> springs, autumns;
+    for (int year = 2020; year < 2040; year++)
+    {
+        springs.push_back(euTransition(year, 3) - 15 * 60);
+        autumns.push_back(euTransition(year, 10) - 15 * 60);
+    }
+
+    const size_t SAMPLES = 1000;
+    for (size_t r = 0; r < sizeof rules / sizeof rules[0]; r++)
+    {
+        cron_calc rule;
+        cron_calc_parse(&rule, rules[r].expr, CRON_CALC_OPT_DEFAULT, NULL);
+        const std::vector<time_t>& starts = rules[r].spring ? springs : autumns;
+        const std::string suffix = std::string("/") + rules[r].name;
+
+        measure("dst_next_local" + suffix, rules[r].expr, SAMPLES, starts.size(), [&](size_t, CallTimer& timer)
+        {
+            for (size_t i = 0; i < starts.size(); i++)
+            {
+                gSink += uint64_t(cron_calc_next(&rule, starts[i]));
+                timer.lap();
+            }
+        });
+        if (tz)
+        {
+            measure("dst_next_tz" + suffix, rules[r].expr, SAMPLES, starts.size(), [&](size_t, CallTimer& timer)
+            {
+                for (size_t i = 0; i < starts.size(); i++)
+                {
+                    gSink += uint64_t(cron_calc_next_tz(&rule, tz, starts[i]));
+                    timer.lap();
+                }
+            });
+            if (!gFilter)
+            {
+                for (size_t i = 0; i < starts.size(); i++)
+                {
+                    check(cron_calc_next(&rule, starts[i]) == cron_calc_next_tz(&rule, tz, starts[i]),
+                          "local and tz search differ at DST transition");
+                }
+            }
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Random rules resembling those of real job schedulers */
+std::vector<std::string> makeRules(size_t n)
+{
+    static const char* const days[] = { "*", "*", "*", "1", "15", "1,15", "L", "*/2" };
+    static const char* const wdays[] = { "*", "*", "*", "MON-FRI", "SAT,SUN", "1", "5" };
+    static const char* const months[] = { "*", "*", "*", "*", "1", "*/3", "JUN-AUG" };
+
+    uint32_t seed = 12345;
+    std::vector<std::string> rules;
+    char expr[64];
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t v[6];
+        for (int k = 0; k < 6; k++)
+        {
+            seed = seed * 1103515245 + 12345;
+            v[k] = seed >> 8;
+        }
+        const char* hours = v[1] % 4 == 0 ? "*" : NULL;
+        char hourBuf[8];
+        snprintf(hourBuf, sizeof hourBuf, "%u", v[1] % 24);
+        snprintf(expr, sizeof expr, "%u %s %s %s %s",
+            v[0] % 60, hours ? hours : hourBuf,
+            days[v[2] % (sizeof days / sizeof days[0])],
+            months[v[3] % (sizeof months / sizeof months[0])],
+            wdays[v[4] % (sizeof wdays / sizeof wdays[0])]);
+        rules.push_back(expr);
+    }
+    return rules;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+void benchNextMulti(size_t n, const char* label)
+{
+    const std::string name = std::string("/") + label;
+    if (!selected("cron_next" + name) && !selected("cron_next_compiled" + name) &&
+        !selected("cron_next_cold" + name))
+    {
+        return;
+    }
+
+    const std::vector<std::string> rules = makeRules(n);
+    std::vector<const char*> exprs(n);
+    for (size_t i = 0; i < n; i++) exprs[i] = rules[i].c_str();
+
+    CronCalc plain, compiled;
+    check(plain.addRules(exprs.data(), n, CRON_CALC_OPT_DEFAULT, NULL, NULL) == CRON_CALC_OK, "random rules");
+    compiled.addRules(exprs.data(), n, CRON_CALC_OPT_DEFAULT, NULL, NULL);
+    compiled.compile();
+
+    /* every call recalculates rules fired since previous one, which is a lot of them in large sets */
+    const size_t SAMPLES = n > 10000 ? 100 : 2000, BATCH = n > 10000 ? 16 : 64;
+    time_t last[2] = { 0 };
+    time_t t = BENCH_START;
+    measure("cron_next" + name, NULL, SAMPLES, BATCH, [&](size_t s, CallTimer& timer)
+    {
+        if (s == 0) t = BENCH_START;
+        last[0] = chainNext([&plain](time_t after) { return plain.nextCached(after); }, BATCH, t, timer);
+    });
+    measure("cron_next_compiled" + name, NULL, SAMPLES, BATCH, [&](size_t s, CallTimer& timer)
+    {
+        if (s == 0) t = BENCH_START;
+        last[1] = chainNext([&compiled](time_t after) { return compiled.nextCached(after); }, BATCH, t, timer);
+    });
+    if (!gFilter) check(last[0] == last[1], "compiled and plain rule sets differ");
+
+    /* going back in time recalculates all rules */
+    measure("cron_next_cold" + name, NULL, n > 10000 ? 20 : 500, 1, [&](size_t s, CallTimer& timer)
+    {
+        gSink += uint64_t(plain.nextCached(BENCH_START - time_t(s % 2) * 3600));
+        timer.lap();
+    });
+}
+
+} // namespace
+
+/* ---------------------------------------------------------------------------- */
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+        {
+            gSamplesDivisor = 10;
+        }
+        else
+        {
+            gFilter = argv[i];
+        }
+    }
+
+    setenv("TZ", BENCH_TZ, 1);
+    tzset();
+
+    cron_calc_tz* tz = NULL;
+    if (cron_calc_tz_load(&tz, "Europe/Berlin") != CRON_CALC_OK)
+    {
+        fprintf(stderr, "Europe/Berlin time zone is not available, next_tz is skipped\n");
+    }
+
+    gClockOverheadNs = clockOverhead();
+
+    printf("{\n  \"benchmark\": \"cron_calc_bench\",\n  \"optimized\": %s,\n  \"library_flags\": ",
+        optimizedFlags(CRON_CALC_BENCH_LIBRARY_FLAGS) ? "true" : "false");
+    printString(CRON_CALC_BENCH_LIBRARY_FLAGS);
+    printf(",\n  \"clock_overhead_ns\": %.1f,\n  \"tz\": ", gClockOverheadNs);
+    printString(BENCH_TZ);
+    printf(",\n  \"results\": [");
+
+    benchParse();
+    benchNextSingle(tz);
+    benchDst(tz);
+    benchNextMulti(1000, "1k");
+    benchNextMulti(100000, "100k");
+
+    printf("\n  ]");
+    printKernelSpeedup();
+    printf(",\n  \"errors\": %d\n}\n", gErrors);
+
+    cron_calc_tz_free(tz);
+    return gErrors;
+}
@@ -5,11 +5,21 @@
  * https://opensource.org/licenses/MIT
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <stddef.h>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "cron_calc.h"
+#include "cron_calc_fields.h"
 
 typedef enum cron_calc_field
 {
@@ -27,26 +37,43 @@ typedef enum cron_calc_field
 enum
 {
     CRON_CALC_NAME_LEN = 3, /* All names in Cron have 3 chars */
-    CRON_CALC_NAME_UPCASE = 'a' - 'A',
-    CRON_CALC_YEAR_START = 2000,
-    CRON_CALC_YEAR_COUNT = 64,
+    CRON_CALC_YEAR_START = CRON_CALC_FIELD_YEAR_FIRST,
+    CRON_CALC_YEAR_COUNT = CRON_CALC_FIELD_YEAR_LAST - CRON_CALC_FIELD_YEAR_FIRST + 1,
     CRON_CALC_YEAR_END = CRON_CALC_YEAR_START + CRON_CALC_YEAR_COUNT - 1,
+    CRON_CALC_YEAR_WINDOW = CRON_CALC_FIELD_YEAR_WINDOW,
+    CRON_CALC_YEAR_WORDS = (CRON_CALC_YEAR_COUNT + 63) / 64,
+    CRON_CALC_YEAR_NONE = INT32_MAX, /* no matching year */
     CRON_CALC_YEAR_MAX = (sizeof(time_t) > 4) ? 3000 : 2038,
     /* years limited at 3000 to avoid too long operation if
      * cron_calc_next() is called with improperly initialized object */
+    CRON_CALC_YEAR_MIN = 1900, /* same for cron_calc_prev() */
+    /* failed years, after which year search skips years by type,
+     * searching a year is cheaper than calculating types of matching years */
+    CRON_CALC_YEAR_TYPES_AFTER = 2,
 
-    CRON_CALC_OPT_MDAY_STARRED = CRON_CALC_OPT_RESERVED_40,
-    CRON_CALC_OPT_WDAY_STARRED = CRON_CALC_OPT_RESERVED_80,
+    CRON_CALC_DAY_SECONDS = 24 * 60 * 60,
+    CRON_CALC_DAY_TIME_WORDS = CRON_CALC_DAY_SECONDS / 64, /* 86400 is multiple of 64 */
+    CRON_CALC_DAY_TIME_SUMMARY = (CRON_CALC_DAY_TIME_WORDS + 63) / 64,
+
+    CRON_CALC_TZ_HEADER_SIZE = 44,
+    CRON_CALC_TZ_FILE_MAX = 1 << 20,    /* real TZif files are few kilobytes long */
+    CRON_CALC_TZ_PATH_MAX = 1024,
+    CRON_CALC_TZ_FOOTER_MAX = 128,
+    CRON_CALC_TZ_DEFAULT_DST = 60 * 60, /* POSIX default, if DST offset is omitted */
+    CRON_CALC_TZ_DEFAULT_TIME = 2 * 60 * 60,
+
+    CRON_CALC_OPT_MDAY_STARRED = CRON_CALC_FIELD_MDAY_STARRED,
+    CRON_CALC_OPT_WDAY_STARRED = CRON_CALC_FIELD_WDAY_STARRED,
 
     CRON_CALC_LAST_CODE = INT32_MAX,
 };
 
 static const char* const CRON_CALC_DAYS[] = {
-    "SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT"
+    CRON_CALC_DAY_NAMES
 };
 
 static const char* const CRON_CALC_MONTHS[] = {
-    "", "JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"
+    CRON_CALC_MONTH_NAMES
 };
 
 static const int CRON_CALC_MONTH_LENGTHS[] = {
@@ -59,22 +86,143 @@ enum
     CRON_CALC_MONTHS_NUM = sizeof(CRON_CALC_MONTHS) / sizeof CRON_CALC_MONTHS[0]
 };
 
+/* Character classes of expression lexer, independent of locale */
+enum
+{
+    CRON_CALC_CHAR_DIGIT = 0x1,
+    CRON_CALC_CHAR_NAME = 0x2,      /* ASCII letter */
+    CRON_CALC_CHAR_SPACE = 0x4,     /* as isspace() in "C" locale */
+    CRON_CALC_CHAR_FIELD_END = 0x8  /* space, comma or NUL */
+};
+
+#define D_ CRON_CALC_CHAR_DIGIT
+#define N_ CRON_CALC_CHAR_NAME
+#define S_ (CRON_CALC_CHAR_SPACE | CRON_CALC_CHAR_FIELD_END)
+#define E_ CRON_CALC_CHAR_FIELD_END
+
+static const uint8_t K_CRON_CALC_CHAR_CLASSES[256] = {
+    E_, 0,  0,  0,  0,  0,  0,  0,  0,  S_, S_, S_, S_, S_, 0,  0,
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    S_, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  E_, 0,  0,  0,
+    D_, D_, D_, D_, D_, D_, D_, D_, D_, D_, 0,  0,  0,  0,  0,  0,
+    0,  N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_,
+    N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, 0,  0,  0,  0,  0,
+    0,  N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_,
+    N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, N_, 0,  0,  0,  0,  0
+    /* the rest are zeroes */
+};
+
+#undef D_
+#undef N_
+#undef S_
+#undef E_
+
+/* Names are found by perfect hash of their 3 upper-cased letters packed into 24 bits,
+ * slot is the top 5 bits of `key * CRON_CALC_NAME_HASH`, and keeps index of the name + 1.
+ * Found name is verified, since other letters may hash to the same slot. */
+#define CRON_CALC_NAME_HASH 0x4a179u
+#define CRON_CALC_NAME_SLOT(key_) ((uint32_t) ((key_) * CRON_CALC_NAME_HASH) >> 27)
+#define CRON_CALC_NAME_KEY(s_) \
+    (((uint32_t) (uint8_t) (s_)[0] << 16) | ((uint32_t) (uint8_t) (s_)[1] << 8) | (uint8_t) (s_)[2])
+
+static const uint8_t K_CRON_CALC_DAY_SLOTS[32] = {
+    /* MON */ 2, 0, 0, 0, /* WED */ 4, 0, 0, 0, 0, /* THU */ 5, 0, 0, 0, 0, 0, 0,
+    /* TUE */ 3, /* SAT */ 7, 0, 0, /* FRI */ 6, 0, 0, 0, 0, 0, 0, 0, /* SUN */ 1, 0, 0, 0
+};
+
+static const uint8_t K_CRON_CALC_MONTH_SLOTS[32] = {
+    0, /* OCT */ 11, 0, 0, /* DEC */ 13, 0, /* JUL */ 8, /* JUN */ 7, 0, 0, 0, 0, /* FEB */ 3, 0, /* APR */ 5, 0,
+    0, /* AUG */ 9, 0, /* SEP */ 10, /* NOV */ 12, 0, 0, /* MAR */ 4, /* MAY */ 6, 0, 0, /* JAN */ 2, 0, 0, 0, 0
+};
+
 typedef struct cron_calc_field_def
 {
     uint32_t min;
     uint32_t max;
     const char* const* names;
     uint32_t names_count;
+    const uint8_t* name_slots;
 } cron_calc_field_def;
 
+#define CRON_CALC_FIELD_NAMES_NONE NULL, 0, NULL
+#define CRON_CALC_FIELD_NAMES_MONTHS CRON_CALC_MONTHS, CRON_CALC_MONTHS_NUM, K_CRON_CALC_MONTH_SLOTS
+#define CRON_CALC_FIELD_NAMES_DAYS CRON_CALC_DAYS, CRON_CALC_DAYS_NUM, K_CRON_CALC_DAY_SLOTS
+#define CRON_CALC_FIELD_DEF(min_, max_, names_) { min_, max_, CRON_CALC_FIELD_NAMES_##names_ },
+
 static const cron_calc_field_def K_CRON_CALC_FIELD_DEFS[CRON_CALC_FIELD_LAST + 1] = {
-    { 0, 59 },                                                  /* CRON_CALC_FIELD_SECONDS */
-    { 0, 59 },                                                  /* CRON_CALC_FIELD_MINUTES */
-    { 0, 23 },                                                  /* CRON_CALC_FIELD_HOURS */
-    { 1, 31 },                                                  /* CRON_CALC_FIELD_DAYS */
-    { 1, 12,    CRON_CALC_MONTHS,   CRON_CALC_MONTHS_NUM },     /* CRON_CALC_FIELD_MONTHS */
-    { 0,  7,    CRON_CALC_DAYS,     CRON_CALC_DAYS_NUM },       /* CRON_CALC_FIELD_WDAYS */
-    { CRON_CALC_YEAR_START, CRON_CALC_YEAR_END },               /* CRON_CALC_FIELD_YEARS */
+    CRON_CALC_FIELDS(CRON_CALC_FIELD_DEF)
+};
+
+#ifndef CRON_CALC_TZ_DIR
+#define CRON_CALC_TZ_DIR "/usr/share/zoneinfo"
+#endif
+
+/* Date of DST start or end in POSIX TZ rule */
+typedef struct cron_calc_tz_date
+{
+    char kind;      /* 'J' - Julian day (1-365, Feb-29 never counted), 'N' - zero-based day of year, 'M' - month rule */
+    int day;        /* Day of year for J and N kinds, week day for M kind */
+    int week;       /* 1-5, where 5 means last week day in month */
+    int month;
+    int32_t time;   /* Local time of transition, seconds since midnight */
+} cron_calc_tz_date;
+
+/* POSIX TZ rule, used for time instants after the last transition in TZif file */
+typedef struct cron_calc_tz_rule
+{
+    int32_t std_offset; /* seconds east of UTC */
+    int32_t dst_offset;
+    bool has_dst;
+    cron_calc_tz_date start;
+    cron_calc_tz_date end;
+} cron_calc_tz_rule;
+
+struct cron_calc_tz
+{
+    size_t count;               /* Number of transitions */
+    const int64_t* times;       /* Sorted UTC instants of transitions */
+    const int32_t* offsets;     /* UTC offsets in effect since respective transitions */
+    int32_t initial_offset;     /* UTC offset in effect before the first transition */
+    bool has_rule;
+    cron_calc_tz_rule rule;
+};
+
+/* Time of day bitmap, each bit is a second or a minute of day,
+ * with summary bitmap, where each bit is set if respective word is not empty */
+struct cron_calc_day_time
+{
+    uint64_t seconds;   /* masks of the rule, for which bitmap is built */
+    uint64_t minutes;
+    uint32_t hours;
+    int unit;           /* 60 if bit is a minute, which happens if only 0th second matches, or 1 */
+    int count;          /* number of words */
+    uint64_t summary[CRON_CALC_DAY_TIME_SUMMARY];
+    uint64_t words[1];  /* actually `count` words */
+};
+
+/* Rows of rule index, each row is a bitset of rules, which match some field value */
+enum
+{
+    CRON_CALC_ROW_SECONDS = 0,
+    CRON_CALC_ROW_MINUTES = CRON_CALC_ROW_SECONDS + 60,
+    CRON_CALC_ROW_HOURS = CRON_CALC_ROW_MINUTES + 60,
+    CRON_CALC_ROW_DAYS = CRON_CALC_ROW_HOURS + 24,          /* day 0 stands for the last day of month */
+    CRON_CALC_ROW_MONTHS = CRON_CALC_ROW_DAYS + 32,         /* months 1-12 */
+    CRON_CALC_ROW_WDAYS = CRON_CALC_ROW_MONTHS + 12,
+    CRON_CALC_ROW_YEARS = CRON_CALC_ROW_WDAYS + 7,          /* years of cron_calc_year range */
+    CRON_CALC_ROW_ANY_YEAR = CRON_CALC_ROW_YEARS + CRON_CALC_YEAR_COUNT, /* rules without years */
+    CRON_CALC_ROW_EITHER = CRON_CALC_ROW_ANY_YEAR + 1,      /* rules matching either day field */
+    CRON_CALC_ROW_ZERO = CRON_CALC_ROW_EITHER + 1,          /* empty row */
+    CRON_CALC_ROW_COUNT,
+
+    CRON_CALC_INDEX_BLOCK = 4   /* words processed at once, rows are padded to it */
+};
+
+struct cron_calc_index
+{
+    size_t count;       /* number of rules */
+    size_t words;       /* words in a row */
+    uint64_t rows[1];   /* actually CRON_CALC_ROW_COUNT rows of `words` words */
 };
 
 typedef enum cron_calc_tm_level {
@@ -97,6 +245,15 @@ typedef enum cron_calc_tm_level {
  */
 typedef uint64_t cron_calc_mask_array[CRON_CALC_TM_WDAY];
 
+/* Masks used by search: masks of levels, and optional table of matching days
+ * of month precomputed by cron_calc_compile(), computed on demand if NULL */
+typedef struct cron_calc_masks
+{
+    const uint64_t* levels;
+    const uint32_t (*days)[7];
+    const cron_calc_day_time* day_time; /* if not NULL, used for search within a day */
+} cron_calc_masks;
+
 typedef struct cron_calc_tm_field_def
 {
     size_t tm_offset;
@@ -116,8 +273,11 @@ static const cron_calc_tm_field_def K_CRON_CALC_TM_FIELDS[CRON_CALC_FIELD_LAST +
 
 /* ---------------------------------------------------------------------------- */
 
-#define CRON_CALC_IS_DIGIT(a_) ((a_) >= '0' && (a_) <= '9')
-#define CRON_CALC_IS_NAME_CHAR(a_) (((a_) >= 'A' && (a_) <= 'Z') || ((a_) >= 'a' && (a_) <= 'z'))
+#define CRON_CALC_CHAR_IS(a_, class_) (K_CRON_CALC_CHAR_CLASSES[(uint8_t) (a_)] & CRON_CALC_CHAR_##class_)
+#define CRON_CALC_IS_DIGIT(a_) CRON_CALC_CHAR_IS(a_, DIGIT)
+#define CRON_CALC_IS_NAME_CHAR(a_) CRON_CALC_CHAR_IS(a_, NAME)
+/* Character of expression bounded by `end_`, NUL past the end */
+#define CRON_CALC_CHAR_AT(p_, end_) ((p_) < (end_) ? *(p_) : '\0')
 
 #define CRON_CALC_MASK(a_) ((uint64_t)1 << (a_))
 #define CRON_CALC_FIELD_MIN(field_) (K_CRON_CALC_FIELD_DEFS[field_].min)
@@ -129,7 +289,162 @@ static const cron_calc_tm_field_def K_CRON_CALC_TM_FIELDS[CRON_CALC_FIELD_LAST +
 
 #define CRON_CALC_MATCHES_MASK(val_, mask_) ((mask_) & ((uint64_t)1 << (val_)))
 
+/* Weekday pattern is replicated with this multiplier to cover days 1-35 of a month */
+#define CRON_CALC_WEEK_REPEAT \
+    (CRON_CALC_MASK(0) | CRON_CALC_MASK(7) | CRON_CALC_MASK(14) | CRON_CALC_MASK(21) | CRON_CALC_MASK(28))
+
+/* ---------------------------------------------------------------------------- */
+
+#ifdef CRON_CALC_WITH_STATS
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CRON_CALC_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define CRON_CALC_THREAD_LOCAL __declspec(thread)
+#else
+#define CRON_CALC_THREAD_LOCAL
+#endif
+
+/* Counters of the last search call and totals of calling thread */
+static CRON_CALC_THREAD_LOCAL cron_calc_stats g_cron_calc_stats_last;
+static CRON_CALC_THREAD_LOCAL cron_calc_stats g_cron_calc_stats_total;
+
+#define CRON_CALC_STATS_ADD(field_, n_) \
+    (g_cron_calc_stats_last.field_ += (n_), g_cron_calc_stats_total.field_ += (n_))
+#define CRON_CALC_STATS_BEGIN() \
+    (memset(&g_cron_calc_stats_last, 0, sizeof g_cron_calc_stats_last), CRON_CALC_STATS_ADD(calls, 1))
+#define CRON_CALC_STATS_ITERATION(level_) CRON_CALC_STATS_ADD(level_iterations[level_], 1)
+#define CRON_CALC_STATS_DEPTH(level_) cron_calc_stats_depth(level_)
+#define CRON_CALC_STATS_TIMER(name_) const uint64_t name_ = cron_calc_stats_now()
+#define CRON_CALC_STATS_CONVERSION(timer_) cron_calc_stats_conversion(timer_)
+
+static void cron_calc_stats_depth(int level)
+{
+    const uint64_t depth = (uint64_t) level + 1;
+    if (g_cron_calc_stats_last.max_depth < depth)
+    {
+        g_cron_calc_stats_last.max_depth = depth;
+    }
+    if (g_cron_calc_stats_total.max_depth < depth)
+    {
+        g_cron_calc_stats_total.max_depth = depth;
+    }
+}
+
+/* @return Monotonic time in nanoseconds */
+static uint64_t cron_calc_stats_now(void)
+{
+#if defined(_POSIX_C_SOURCE)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#else
+    return (uint64_t) clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+/* Counts libc time conversion started at given time */
+static void cron_calc_stats_conversion(uint64_t started)
+{
+    const uint64_t elapsed = cron_calc_stats_now() - started;
+    CRON_CALC_STATS_ADD(time_conversions, 1);
+    CRON_CALC_STATS_ADD(time_conversion_ns, elapsed);
+}
+
+#else
+
+#define CRON_CALC_STATS_ADD(field_, n_) ((void) 0)
+#define CRON_CALC_STATS_BEGIN() ((void) 0)
+#define CRON_CALC_STATS_ITERATION(level_) ((void) 0)
+#define CRON_CALC_STATS_DEPTH(level_) ((void) 0)
+#define CRON_CALC_STATS_TIMER(name_) ((void) 0)
+#define CRON_CALC_STATS_CONVERSION(timer_) ((void) 0)
+
+#endif /* CRON_CALC_WITH_STATS */
+
+/* ---------------------------------------------------------------------------- */
+/* ---------------------------------------------------------------------------- */
+
+/* Index of the lowest set bit, mask must not be 0 */
+static int cron_calc_lowest_bit(uint64_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(mask);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (int) index;
+#else
+    int index = 0;
+    for (; !(mask & 1); mask >>= 1) index++;
+    return index;
+#endif
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Index of the highest set bit, mask must not be 0 */
+static int cron_calc_highest_bit(uint64_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(mask);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanReverse64(&index, mask);
+    return (int) index;
+#else
+    int index = 63;
+    for (; !(mask & CRON_CALC_MASK(63)); mask <<= 1) index--;
+    return index;
+#endif
+}
+
 /* ---------------------------------------------------------------------------- */
+
+/* Number of set bits */
+static int cron_calc_bit_count(uint64_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(mask);
+#else
+    mask -= (mask >> 1) & UINT64_C(0x5555555555555555);
+    mask = (mask & UINT64_C(0x3333333333333333)) + ((mask >> 2) & UINT64_C(0x3333333333333333));
+    mask = (mask + (mask >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+    return (int) ((mask * UINT64_C(0x0101010101010101)) >> 56);
+#endif
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Finds lowest bit set in mask, which is not below `from`.
+ * @return Bit index or -1 if there is no such bit */
+static int cron_calc_next_bit(uint64_t mask, int from)
+{
+    if (from >= 64)
+    {
+        return -1;
+    }
+    mask &= ~(uint64_t)0 << from;
+    return mask ? cron_calc_lowest_bit(mask) : -1;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Finds highest bit set in mask, which is not above `from`.
+ * @return Bit index or -1 if there is no such bit */
+static int cron_calc_prev_bit(uint64_t mask, int from)
+{
+    if (from < 0)
+    {
+        return -1;
+    }
+    if (from < 63)
+    {
+        mask &= CRON_CALC_MASK(from + 1) - 1;
+    }
+    return mask ? cron_calc_highest_bit(mask) : -1;
+}
+
 /* ---------------------------------------------------------------------------- */
 
 static bool cron_calc_is_leap_year(int year)
@@ -162,6 +477,7 @@ static int cron_calc_get_week_day(int year, int month, int day)
     int corr = (14 - month) / 12;
     int y = year - corr;
     int m = month + 12 * corr - 2;
+    CRON_CALC_STATS_ADD(week_day_calls, 1);
     return (day + y + y / 4 - y / 100 + y / 400 + 31 * m / 12) % 7;
 }
 
@@ -178,7 +494,6 @@ static cron_calc_error cron_calc_set_field(
 {
     int i;
     uint64_t value = 0;
-    uint32_t shift = (field == CRON_CALC_FIELD_YEARS) ? CRON_CALC_YEAR_START : 0;
 
 #ifndef CRON_CALC_WITH_COVERAGE /* never happens */
     if (step < 1)
@@ -191,11 +506,15 @@ static cron_calc_error cron_calc_set_field(
         return CRON_CALC_ERROR_NUMBER_RANGE;
     }
 
-    if (max != CRON_CALC_LAST_CODE)
+    if (max != CRON_CALC_LAST_CODE && step == 1) /* fields are below 64 */
+    {
+        value = (CRON_CALC_MASK(max) - CRON_CALC_MASK(min)) | CRON_CALC_MASK(max);
+    }
+    else if (max != CRON_CALC_LAST_CODE)
     {
         for (i = min; i <= max; i += step)
         {
-            value |= CRON_CALC_MASK(i - shift);
+            value |= CRON_CALC_MASK(i);
         }
     }
 
@@ -231,8 +550,7 @@ static cron_calc_error cron_calc_set_field(
             self->weekDays |= value;
             self->options |= is_star ? CRON_CALC_OPT_WDAY_STARRED : 0;
             break;
-        case CRON_CALC_FIELD_YEARS:
-            self->years |= value;
+        default: /* years are collected by cron_calc_set_years() */
             break;
     }
     return CRON_CALC_OK;
@@ -240,7 +558,76 @@ static cron_calc_error cron_calc_set_field(
 
 /* ---------------------------------------------------------------------------- */
 
-static cron_calc_error cron_calc_parse_limited_number(const char** pp, uint32_t* value, uint32_t minimum, uint32_t maximum)
+/* Years field is collected into full bitmap first, as its range is wider than 64 */
+static cron_calc_error cron_calc_set_years(
+    uint64_t years[CRON_CALC_YEAR_WORDS],
+    uint32_t min,
+    uint32_t max,
+    uint32_t step)
+{
+    uint32_t i;
+
+    if (max < min)
+    {
+        return CRON_CALC_ERROR_NUMBER_RANGE;
+    }
+
+    for (i = min - CRON_CALC_YEAR_START; i <= max - CRON_CALC_YEAR_START; i += step)
+    {
+        years[i / 64] |= CRON_CALC_MASK(i % 64);
+    }
+    return CRON_CALC_OK;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Packs full bitmap of years into 64-year window starting at the first year,
+ * and progression of years after the window.
+ * @return False if years can't be represented this way */
+static bool cron_calc_pack_years(cron_calc* self, const uint64_t years[CRON_CALC_YEAR_WORDS])
+{
+    int base = -1, last = -1, step = 0, w;
+
+    for (w = 0; w < CRON_CALC_YEAR_WORDS; w++)
+    {
+        uint64_t word = years[w];
+        for (; word; word &= word - 1) /* only set bits are visited */
+        {
+            const int y = w * 64 + cron_calc_lowest_bit(word);
+            if (base < 0)
+            {
+                base = y;
+            }
+            if (y < base + CRON_CALC_YEAR_WINDOW)
+            {
+                self->years |= CRON_CALC_MASK(y - base);
+            }
+            else if (!step)
+            {
+                step = y - last;
+            }
+            else if (y - last != step)
+            {
+                return false;
+            }
+            last = y;
+        }
+    }
+
+    self->yearBase = (uint8_t) base;
+    self->yearStep = (uint8_t) step;
+    self->yearEnd = (uint8_t) (step ? last : 0);
+    return true;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static cron_calc_error cron_calc_parse_limited_number(
+    const char** pp,
+    const char* end,
+    uint32_t* value,
+    uint32_t minimum,
+    uint32_t maximum)
 {
     uint32_t val = 0;
     const char* p = *pp;
@@ -248,7 +635,7 @@ static cron_calc_error cron_calc_parse_limited_number(const char** pp, uint32_t*
     /* this function returns pointer to the number start
      * as error location in all kinds of errors */
 
-    for (; *p && CRON_CALC_IS_DIGIT(*p); p++)
+    for (; p < end && CRON_CALC_IS_DIGIT(*p); p++)
     {
         val = val * 10 + *p - '0';
         if (val > maximum)
@@ -271,59 +658,66 @@ static cron_calc_error cron_calc_parse_limited_number(const char** pp, uint32_t*
 
 /* ---------------------------------------------------------------------------- */
 
-static cron_calc_error cron_calc_parse_number(const char** pp, uint32_t* value, const cron_calc_field_def* field_def)
+static cron_calc_error cron_calc_parse_number(
+    const char** pp,
+    const char* end,
+    uint32_t* value,
+    const cron_calc_field_def* field_def)
 {
-    return cron_calc_parse_limited_number(pp, value, field_def->min, field_def->max);
+    return cron_calc_parse_limited_number(pp, end, value, field_def->min, field_def->max);
 }
 
 /* ---------------------------------------------------------------------------- */
 
-static cron_calc_error cron_calc_parse_name(const char** pp, uint32_t* value, const cron_calc_field_def* field_def)
+static cron_calc_error cron_calc_parse_name(
+    const char** pp,
+    const char* end,
+    uint32_t* value,
+    const cron_calc_field_def* field_def)
 {
-    int i, name_len = 0;
-    char name[CRON_CALC_NAME_LEN + 1] = { 0 };
     const char* p = *pp;
+    uint32_t key, index;
 
     /* this function returns pointer to the name start
      * as error location in all kinds of errors */
 
-    for (; *p && CRON_CALC_IS_NAME_CHAR(*p) && name_len < CRON_CALC_NAME_LEN; p++)
-    {
-        name[name_len++] = *p;
-    }
-    if (name_len != CRON_CALC_NAME_LEN)
+    if (end - p < CRON_CALC_NAME_LEN ||
+        !CRON_CALC_IS_NAME_CHAR(p[0]) || !CRON_CALC_IS_NAME_CHAR(p[1]) || !CRON_CALC_IS_NAME_CHAR(p[2]))
     {
         return CRON_CALC_ERROR_INVALID_NAME;
     }
-    for (i = 0; i < field_def->names_count; i++)
+
+    /* letters are upper-cased by clearing bit 0x20, names are upper-case */
+    key = CRON_CALC_NAME_KEY(p) & ~(uint32_t) 0x202020;
+    index = field_def->name_slots[CRON_CALC_NAME_SLOT(key)];
+    if (index == 0 || CRON_CALC_NAME_KEY(field_def->names[index - 1]) != key)
     {
-        const char* fname = field_def->names[i];
-        if ((fname[0] == name[0] || fname[0] == name[0] - CRON_CALC_NAME_UPCASE) &&
-            (fname[1] == name[1] || fname[1] == name[1] - CRON_CALC_NAME_UPCASE) &&
-            (fname[2] == name[2] || fname[2] == name[2] - CRON_CALC_NAME_UPCASE))
-        {
-            *value = i;
-            *pp = p;
-            return CRON_CALC_OK;
-        }
+        return CRON_CALC_ERROR_INVALID_NAME;
     }
-    return CRON_CALC_ERROR_INVALID_NAME;
+    *value = index - 1;
+    *pp = p + CRON_CALC_NAME_LEN;
+    return CRON_CALC_OK;
 }
 
 /* ---------------------------------------------------------------------------- */
 
-static cron_calc_error cron_calc_parse_value(const char** pp, uint32_t* value, cron_calc_field field)
+static cron_calc_error cron_calc_parse_value(const char** pp, const char* end, uint32_t* value, cron_calc_field field)
 {
     const cron_calc_field_def* field_def = &K_CRON_CALC_FIELD_DEFS[field];
-    if (field_def->names_count && CRON_CALC_IS_NAME_CHAR(**pp))
+    if (field_def->names_count && CRON_CALC_IS_NAME_CHAR(CRON_CALC_CHAR_AT(*pp, end)))
     {
-        return cron_calc_parse_name(pp, value, field_def);
+        return cron_calc_parse_name(pp, end, value, field_def);
     }
-    return cron_calc_parse_number(pp, value, field_def);
+    return cron_calc_parse_number(pp, end, value, field_def);
 }
 
 /* ---------------------------------------------------------------------------- */
 
+static int cron_calc_next_year_value(const cron_calc* self, int year);
+static uint8_t cron_calc_kernel_index(const cron_calc* self);
+
+/* ---------------------------------------------------------------------------- */
+
 static bool cron_calc_is_impossible(cron_calc* self)
 {
     /* Impossible dates:
@@ -339,16 +733,15 @@ static bool cron_calc_is_impossible(cron_calc* self)
             self->days == CRON_CALC_MASK(29))
         {
             /* check that no leap year is allowed */
-            uint32_t y = 0;
-            for (; y < CRON_CALC_YEAR_COUNT; y++)
+            int y = cron_calc_next_year_value(self, CRON_CALC_YEAR_START);
+            for (; y <= CRON_CALC_YEAR_END; y = cron_calc_next_year_value(self, y + 1))
             {
-                if ((CRON_CALC_MASK(y) & self->years) &&
-                    cron_calc_is_leap_year(y + CRON_CALC_YEAR_START))
+                if (cron_calc_is_leap_year(y))
                 {
                     break;
                 }
             }
-            if (y == CRON_CALC_YEAR_COUNT)
+            if (y > CRON_CALC_YEAR_END)
             {
                 return true;
             }
@@ -384,9 +777,12 @@ static bool cron_calc_is_impossible(cron_calc* self)
 
 /* ---------------------------------------------------------------------------- */
 
-cron_calc_error cron_calc_parse(
+/* Parses expression in [expr, end), NUL character ends it as well.
+ * Arguments are checked by caller, err_location is set on error only. */
+static cron_calc_error cron_calc_parse_range(
     cron_calc* self,
     const char* expr,
+    const char* end,
     cron_calc_option_mask options,
     const char** err_location)
 {
@@ -394,16 +790,8 @@ cron_calc_error cron_calc_parse(
     const char* p = expr;
     cron_calc_field field = CRON_CALC_FIELD_SECONDS;
     cron_calc_field last_field = CRON_CALC_FIELD_YEARS;
-
-    if (err_location)
-    {
-        *err_location = NULL;
-    }
-
-    if (!self || !expr)
-    {
-        return CRON_CALC_ERROR_ARGUMENT;
-    }
+    uint64_t years[CRON_CALC_YEAR_WORDS] = { 0 };
+    const char* years_start = NULL;
 
     memset(self, 0, sizeof *self);
     self->options = options;
@@ -429,14 +817,19 @@ cron_calc_error cron_calc_parse(
         uint32_t min = 0, max = 0, step = 1;
         bool is_range = false, is_star = false;
 
-        if (*p == '*')
+        if (field == CRON_CALC_FIELD_YEARS && !years_start)
+        {
+            years_start = p;
+        }
+
+        if (CRON_CALC_CHAR_AT(p, end) == '*')
         {
             min = CRON_CALC_FIELD_MIN(field);
             max = CRON_CALC_FIELD_MAX(field);
             is_range = is_star = true;
             p++;
         }
-        else if (*p == 'L')
+        else if (CRON_CALC_CHAR_AT(p, end) == 'L')
         {
             if (field == CRON_CALC_FIELD_DAYS)
             {
@@ -451,13 +844,13 @@ cron_calc_error cron_calc_parse(
         }
         else
         {
-            err = cron_calc_parse_value(&p, &min, field);
+            err = cron_calc_parse_value(&p, end, &min, field);
             if (err) break;
 
-            if (*p == '-') /* max will follow */
+            if (CRON_CALC_CHAR_AT(p, end) == '-') /* max will follow */
             {
                 p++;
-                err = cron_calc_parse_value(&p, &max, field);
+                err = cron_calc_parse_value(&p, end, &max, field);
                 if (err) break;
                 is_range = true;
             }
@@ -467,24 +860,26 @@ cron_calc_error cron_calc_parse(
             }
         }
 
-        if (is_range && (*p == '/')) /* step will follow */
+        if (is_range && CRON_CALC_CHAR_AT(p, end) == '/') /* step will follow */
         {
             p++;
-            err = cron_calc_parse_limited_number(&p, &step, 1, CRON_CALC_FIELD_MAX(field));
+            err = cron_calc_parse_limited_number(&p, end, &step, 1, CRON_CALC_FIELD_MAX(field));
             if (err) break;
         }
 
-        if (*p == 0 || isspace(*p) || *p == ',') /* end of field */
+        if (CRON_CALC_CHAR_IS(CRON_CALC_CHAR_AT(p, end), FIELD_END))
         {
-            err = cron_calc_set_field(self, min, max, step, is_star, field);
+            err = (field == CRON_CALC_FIELD_YEARS) ?
+                cron_calc_set_years(years, min, max, step) :
+                cron_calc_set_field(self, min, max, step, is_star, field);
             if (err) break;
 
-            if (isspace(*p)) /* field is complete */
+            if (CRON_CALC_CHAR_IS(CRON_CALC_CHAR_AT(p, end), SPACE)) /* field is complete */
             {
-                while (isspace(*p)) p++;
+                while (CRON_CALC_CHAR_IS(CRON_CALC_CHAR_AT(p, end), SPACE)) p++;
                 field++;
             }
-            else if (*p == ',') /* more data for this field */
+            else if (CRON_CALC_CHAR_AT(p, end) == ',') /* more data for this field */
             {
                 p++;
             }
@@ -507,17 +902,28 @@ cron_calc_error cron_calc_parse(
         {
             err = CRON_CALC_ERROR_EXPR_SHORT;
         }
-        else if (*p != 0) /* unexpected data in the expression */
+        else if (CRON_CALC_CHAR_AT(p, end) != 0) /* unexpected data in the expression */
         {
             err = CRON_CALC_ERROR_EXPR_LONG;
         }
     }
 
+    if (!err && (options & CRON_CALC_OPT_WITH_YEARS) && !cron_calc_pack_years(self, years))
+    {
+        err = CRON_CALC_ERROR_NUMBER_RANGE;
+        p = years_start;
+    }
+
     if (!err && cron_calc_is_impossible(self))
     {
         err = CRON_CALC_ERROR_IMPOSSIBLE_DATE;
     }
 
+    if (!err)
+    {
+        self->kernel = cron_calc_kernel_index(self);
+    }
+
     if (err && err_location)
     {
         *err_location = p;
@@ -526,29 +932,81 @@ cron_calc_error cron_calc_parse(
     return err;
 }
 
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_parse(
+    cron_calc* self,
+    const char* expr,
+    cron_calc_option_mask options,
+    const char** err_location)
+{
+    if (err_location)
+    {
+        *err_location = NULL;
+    }
+
+    if (!self || !expr)
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    return cron_calc_parse_range(self, expr, expr + strlen(expr), options, err_location);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_parse_n(
+    cron_calc* self,
+    const char* expr,
+    size_t len,
+    cron_calc_option_mask options,
+    size_t* err_offset)
+{
+    const char* err_location = NULL;
+    cron_calc_error err;
+
+    if (err_offset)
+    {
+        *err_offset = CRON_CALC_INVALID_OFFSET;
+    }
+
+    if (!self || !expr)
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    err = cron_calc_parse_range(self, expr, expr + len, options, &err_location);
+    if (err && err_offset)
+    {
+        *err_offset = (size_t) (err_location - expr);
+    }
+    return err;
+}
+
 /* ---------------------------------------------------------------------------- */
 /* ---------------------------------------------------------------------------- */
 
 static bool cron_calc_find_next(
     const cron_calc* self,
     struct tm* tm_val,
-    const cron_calc_mask_array mask_array,
+    const cron_calc_masks* masks,
     cron_calc_tm_level level,
     bool rollover);
 
 /* ---------------------------------------------------------------------------- */
 
-static bool cron_calc_find_next_day(
-    const cron_calc* self,
-    struct tm* tm_val,
-    const cron_calc_mask_array masks,
-    bool rollover)
+/* @return Mask of days of month matching the rule, bit N is set for N-th day,
+ *         given week day of the first day in month */
+static uint64_t cron_calc_month_day_mask(const cron_calc* self, int first_wday, int month_len)
 {
-    const int month_len = cron_calc_month_days(tm_val->tm_year, tm_val->tm_mon);
     /* crontab(5): If both fields are restricted (i.e., do not contain the "*" character),
      * the command will be run when _either_ field matches the current time. */
     const bool either = !(self->options & (CRON_CALC_OPT_MDAY_STARRED | CRON_CALC_OPT_WDAY_STARRED));
-    const uint64_t week_days = self->weekDays;
+    const uint64_t month_mask = CRON_CALC_MASK(month_len + 1) - CRON_CALC_MASK(1);
+    const uint64_t week_days = self->weekDays & 0x7F;
+    /* bit N of rotated mask is set if week day of (N+1)-th day of month matches */
+    const uint64_t rotated = ((week_days >> first_wday) | (week_days << (7 - first_wday))) & 0x7F;
+    const uint64_t wdays = (rotated * CRON_CALC_WEEK_REPEAT) << 1;
     uint64_t days = self->days;
     /* Bit 0 is set if last day of month should match also */
     if (CRON_CALC_MATCHES_MASK(0, days))
@@ -556,159 +1014,2044 @@ static bool cron_calc_find_next_day(
         days |= CRON_CALC_MASK(month_len);
     }
 
-    if (rollover)
-    {
-        tm_val->tm_mday = CRON_CALC_TM_FIELD_MIN(CRON_CALC_TM_DAY);
-        tm_val->tm_wday = cron_calc_get_week_day(tm_val->tm_year, tm_val->tm_mon, tm_val->tm_mday);
-    }
-
-    for (; tm_val->tm_mday <= month_len; tm_val->tm_mday++, rollover = true)
-    {
-        const bool mday_matches = CRON_CALC_MATCHES_MASK(tm_val->tm_mday, days);
-        const bool wday_matches = CRON_CALC_MATCHES_MASK(tm_val->tm_wday, week_days);
-
-        const bool matches = either ? mday_matches || wday_matches : mday_matches && wday_matches;
-
-        if (matches && cron_calc_find_next(self, tm_val, masks, CRON_CALC_TM_HOUR, rollover))
-        {
-            return true;
-        }
-        tm_val->tm_wday = (tm_val->tm_wday + 1) % 7;
-    }
-    return false;
+    return (either ? days | wdays : days & wdays) & month_mask;
 }
 
 /* ---------------------------------------------------------------------------- */
 
-static bool cron_calc_find_next_year(
+static uint64_t cron_calc_day_mask(
     const cron_calc* self,
-    struct tm* tm_val,
-    const cron_calc_mask_array masks)
+    const cron_calc_masks* masks,
+    int year,
+    int month,
+    int month_len)
 {
-    bool rollover = false;
-    const bool any_year = !(self->options & CRON_CALC_OPT_WITH_YEARS);
-    const int val_max = any_year ? CRON_CALC_YEAR_MAX : CRON_CALC_YEAR_END;
+    const int first_wday = cron_calc_get_week_day(year, month, 1);
+    return masks->days ?
+        masks->days[month_len - 28][first_wday] :
+        cron_calc_month_day_mask(self, first_wday, month_len);
+}
+
+/* ---------------------------------------------------------------------------- */
 
-    for (; tm_val->tm_year <= val_max; tm_val->tm_year++, rollover = true)
+/* Fills table of matching days for all month lengths and week days of the first day */
+static void cron_calc_fill_days(const cron_calc* self, uint32_t days[4][7])
+{
+    int month_len, wday;
+    for (month_len = 28; month_len <= 31; month_len++)
     {
-        if ((any_year || CRON_CALC_MATCHES_MASK(tm_val->tm_year - CRON_CALC_YEAR_START, self->years)) &&
-            cron_calc_find_next(self, tm_val, masks, CRON_CALC_TM_MONTH, rollover))
+        for (wday = 0; wday < 7; wday++)
         {
-            return true;
+            days[month_len - 28][wday] = (uint32_t) cron_calc_month_day_mask(self, wday, month_len);
         }
     }
-    return false;
 }
 
 /* ---------------------------------------------------------------------------- */
 
-static bool cron_calc_find_next(
-    const cron_calc* self,
-    struct tm* tm_val,
-    const cron_calc_mask_array masks,
-    cron_calc_tm_level level,
-    bool rollover)
+/* Layout of days and week days in a year is defined by week day of January 1st
+ * and whether the year is leap, so there are only 14 types of years.
+ * @return Type of the year, week day of January 1st, plus 7 for leap years */
+static int cron_calc_year_type(int year)
 {
-    const uint64_t mask = masks[level];
-    const int val_min = CRON_CALC_TM_FIELD_MIN(level);
-    const int val_max = CRON_CALC_TM_FIELD_MAX(level);
+    return cron_calc_get_week_day(year, 1, 1) + (cron_calc_is_leap_year(year) ? 7 : 0);
+}
 
-    int* fld = CRON_CALC_TM_FIELD(tm_val, level);
-    int val = rollover ? val_min : *fld;
-    bool found = false;
+/* ---------------------------------------------------------------------------- */
 
-    /* if no match on this level, it has to be incremented
-     * and therefore all levels downwards have to roll over and start from minimum.
-     * if seconds not specified in the expression, its mask is set to 1,
-     * which yeilds match on the first iteration of this loop (only after rollover though)
-     */
-    for (; !found && (val <= val_max); val++, rollover = true)
+/* @return Bit mask of year types, in which the rule matches at least one day.
+ *         Time of day always matches, so the rule matches any year of such type,
+ *         when search starts from the beginning of the year. */
+static uint32_t cron_calc_year_types(const cron_calc* self, const cron_calc_masks* masks)
+{
+    /* bit W is set if month of given length starting on week day W has matching days,
+     * calculated on demand for lengths 28..31 */
+    uint32_t wdays_by_len[4] = { 0 };
+    uint32_t len_done = 0;
+    uint32_t types = 0;
+    int leap;
+
+    for (leap = 0; leap < 2; leap++)
     {
-        if (CRON_CALC_MATCHES_MASK(val, mask))
-        {
-            *fld = val;
+        const int year = leap ? 2000 : 2001;
+        uint32_t jan1_wdays = 0;
+        int offset = 0; /* days from January 1st to the first day of month */
+        int month;
 
-            if (level == CRON_CALC_TM_MONTH)
-            {
-                found = cron_calc_find_next_day(self, tm_val, masks, rollover);
-            }
-            else if (level == CRON_CALC_TM_SECOND)
+        for (month = 1; month <= 12; month++)
+        {
+            const int month_len = cron_calc_month_days(year, month);
+            if (CRON_CALC_MATCHES_MASK(month, masks->levels[CRON_CALC_TM_MONTH]))
             {
-                found = true;
+                const int len_idx = month_len - 28;
+                const int shift = offset % 7;
+                uint32_t wdays;
+
+                if (!(len_done & (1u << len_idx)))
+                {
+                    int wday;
+                    for (wday = 0; wday < 7; wday++)
+                    {
+                        if (masks->days ?
+                            masks->days[len_idx][wday] != 0 :
+                            cron_calc_month_day_mask(self, wday, month_len) != 0)
+                        {
+                            wdays_by_len[len_idx] |= 1u << wday;
+                        }
+                    }
+                    len_done |= 1u << len_idx;
+                }
+
+                /* month starts on week day W, if January 1st is W - offset */
+                wdays = wdays_by_len[len_idx];
+                jan1_wdays |= ((wdays >> shift) | (wdays << (7 - shift))) & 0x7F;
+            }
+            offset += month_len;
+        }
+        types |= jan1_wdays << (leap * 7);
+    }
+    return types;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return Index of the first non-empty word of time of day bitmap not below `from`,
+ *         found by summary bitmap, or -1 if there is no such word */
+static int cron_calc_next_time_word(const cron_calc_day_time* day_time, int from)
+{
+    for (; from < day_time->count; from = (from | 63) + 1)
+    {
+        const int bit = cron_calc_next_bit(day_time->summary[from / 64], from % 64);
+        if (bit >= 0)
+        {
+            return (from & ~63) + bit;
+        }
+    }
+    return -1;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Finds next matching time of day by bitmap scan, replaces search
+ * on hour, minute and second levels, see cron_calc_find_next() for arguments */
+static bool cron_calc_find_next_time(const cron_calc_day_time* day_time, struct tm* tm_val, bool rollover)
+{
+    const int unit = day_time->unit;
+    int pos = 0, word;
+    uint64_t mask;
+
+    if (!rollover)
+    {
+        /* the first bit not earlier than current time */
+        pos = ((tm_val->tm_hour * 60 + tm_val->tm_min) * 60 + tm_val->tm_sec + unit - 1) / unit;
+    }
+
+    word = pos / 64;
+    if (word >= day_time->count)
+    {
+        return false;
+    }
+
+    mask = day_time->words[word] & (~(uint64_t)0 << (pos % 64));
+    if (!mask)
+    {
+        word = cron_calc_next_time_word(day_time, word + 1);
+        if (word < 0)
+        {
+            return false;
+        }
+        mask = day_time->words[word];
+    }
+
+    pos = (word * 64 + cron_calc_lowest_bit(mask)) * unit;
+    tm_val->tm_hour = pos / 3600;
+    tm_val->tm_min = pos / 60 % 60;
+    tm_val->tm_sec = pos % 60;
+    return true;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static bool cron_calc_find_next_day(
+    const cron_calc* self,
+    struct tm* tm_val,
+    const cron_calc_masks* masks,
+    bool rollover)
+{
+    const int month_len = cron_calc_month_days(tm_val->tm_year, tm_val->tm_mon);
+    const uint64_t days = cron_calc_day_mask(self, masks, tm_val->tm_year, tm_val->tm_mon, month_len);
+    const int start = rollover ? CRON_CALC_TM_FIELD_MIN(CRON_CALC_TM_DAY) : tm_val->tm_mday;
+    int day = cron_calc_next_bit(days, start);
+
+    CRON_CALC_STATS_DEPTH(CRON_CALC_TM_DAY);
+    for (; day >= 0; day = cron_calc_next_bit(days, day + 1))
+    {
+        rollover = rollover || (day != start);
+        tm_val->tm_mday = day;
+        CRON_CALC_STATS_ITERATION(CRON_CALC_TM_DAY);
+
+        if (masks->day_time
+            ? cron_calc_find_next_time(masks->day_time, tm_val, rollover)
+            : cron_calc_find_next(self, tm_val, masks, CRON_CALC_TM_HOUR, rollover))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return Earliest year allowed by the rule, which is not below given one,
+ *         or CRON_CALC_YEAR_NONE if there is no such year */
+static int cron_calc_next_year_value(const cron_calc* self, int year)
+{
+    int base, bit, last, steps;
+    if (!(self->options & CRON_CALC_OPT_WITH_YEARS))
+    {
+        return year;
+    }
+
+    base = CRON_CALC_YEAR_START + self->yearBase;
+    if (year < base)
+    {
+        year = base;
+    }
+    if (year < base + CRON_CALC_YEAR_WINDOW)
+    {
+        bit = cron_calc_next_bit(self->years, year - base);
+        if (bit >= 0)
+        {
+            return base + bit;
+        }
+    }
+    if (!self->yearStep)
+    {
+        return CRON_CALC_YEAR_NONE;
+    }
+
+    /* years after the window continue progression from its last year */
+    last = base + cron_calc_highest_bit(self->years);
+    steps = (year - last + self->yearStep - 1) / self->yearStep;
+    year = last + steps * self->yearStep;
+    return year <= CRON_CALC_YEAR_START + self->yearEnd ? year : CRON_CALC_YEAR_NONE;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static bool cron_calc_find_next_year(
+    const cron_calc* self,
+    struct tm* tm_val,
+    const cron_calc_masks* masks)
+{
+    const int start = tm_val->tm_year;
+    int year = cron_calc_next_year_value(self, start);
+    uint32_t types = 0;
+    int failures = 0;
+
+    CRON_CALC_STATS_DEPTH(CRON_CALC_TM_YEAR);
+    for (; year <= CRON_CALC_YEAR_MAX; year = cron_calc_next_year_value(self, year + 1))
+    {
+        CRON_CALC_STATS_ADD(years_scanned, 1);
+        if (types && !(types & (1u << cron_calc_year_type(year))))
+        {
+            continue;
+        }
+
+        tm_val->tm_year = year;
+        CRON_CALC_STATS_ITERATION(CRON_CALC_TM_YEAR);
+        if (cron_calc_find_next(self, tm_val, masks, CRON_CALC_TM_MONTH, year != start))
+        {
+            return true;
+        }
+
+        /* search from the beginning of a year always succeeds or always fails,
+         * depending only on type of the year, so for sparse rules skip years
+         * of wrong types, and reject rules which never match at once */
+        if (++failures == CRON_CALC_YEAR_TYPES_AFTER)
+        {
+            types = cron_calc_year_types(self, masks);
+            if (!types)
+            {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+#include "cron_calc_kernels.h"
+
+/* ---------------------------------------------------------------------------- */
+
+/* Searches from given time by kernel of the rule, or by generic search
+ * if the rule has no kernel or masks have precomputed data.
+ * Kernel is chosen by current fields of the rule, not by stored index,
+ * so it still matches them if they were changed after parsing */
+static bool cron_calc_search_next(
+    const cron_calc* self,
+    struct tm* tm_val,
+    const cron_calc_masks* masks)
+{
+    const uint8_t kernel = self->kernel && !masks->days && !masks->day_time ? cron_calc_kernel_index(self) : 0;
+
+    return kernel
+        ? K_CRON_CALC_KERNELS[kernel](self, tm_val)
+        : cron_calc_find_next_year(self, tm_val, masks);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static bool cron_calc_find_next(
+    const cron_calc* self,
+    struct tm* tm_val,
+    const cron_calc_masks* masks,
+    cron_calc_tm_level level,
+    bool rollover)
+{
+    const uint64_t mask = masks->levels[level];
+    const int val_max = CRON_CALC_TM_FIELD_MAX(level);
+
+    int* fld = CRON_CALC_TM_FIELD(tm_val, level);
+    const int start = rollover ? (int) CRON_CALC_TM_FIELD_MIN(level) : *fld;
+    int val = cron_calc_next_bit(mask, start);
+    bool found = false;
+
+    /* if no match on this level, it has to be incremented
+     * and therefore all levels downwards have to roll over and start from minimum.
+     * Values not allowed by the mask are skipped at once by bit scan.
+     * if seconds not specified in the expression, its mask is set to 1,
+     * which yeilds match on the first iteration of this loop (only after rollover though)
+     */
+    CRON_CALC_STATS_DEPTH(level);
+    for (; !found && val >= 0 && val <= val_max; val = cron_calc_next_bit(mask, val + 1))
+    {
+        rollover = rollover || (val != start);
+        *fld = val;
+        CRON_CALC_STATS_ITERATION(level);
+
+        if (level == CRON_CALC_TM_MONTH)
+        {
+            found = cron_calc_find_next_day(self, tm_val, masks, rollover);
+        }
+        else if (level == CRON_CALC_TM_SECOND)
+        {
+            found = true;
+        }
+        else
+        {
+            found = cron_calc_find_next(self, tm_val, masks, level + 1, rollover);
+        }
+    }
+    return found;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static bool cron_calc_find_prev(
+    const cron_calc* self,
+    struct tm* tm_val,
+    const cron_calc_masks* masks,
+    cron_calc_tm_level level,
+    bool rollover);
+
+/* ---------------------------------------------------------------------------- */
+
+static bool cron_calc_find_prev_day(
+    const cron_calc* self,
+    struct tm* tm_val,
+    const cron_calc_masks* masks,
+    bool rollover)
+{
+    const int month_len = cron_calc_month_days(tm_val->tm_year, tm_val->tm_mon);
+    const uint64_t days = cron_calc_day_mask(self, masks, tm_val->tm_year, tm_val->tm_mon, month_len);
+    const int start = rollover ? month_len : tm_val->tm_mday;
+    int day = cron_calc_prev_bit(days, start);
+
+    CRON_CALC_STATS_DEPTH(CRON_CALC_TM_DAY);
+    for (; day > 0; day = cron_calc_prev_bit(days, day - 1))
+    {
+        rollover = rollover || (day != start);
+        tm_val->tm_mday = day;
+        CRON_CALC_STATS_ITERATION(CRON_CALC_TM_DAY);
+
+        if (cron_calc_find_prev(self, tm_val, masks, CRON_CALC_TM_HOUR, rollover))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return Latest year allowed by the rule, which is not above given one,
+ *         or value below CRON_CALC_YEAR_MIN if there is no such year */
+static int cron_calc_prev_year_value(const cron_calc* self, int year)
+{
+    int base, bit, last;
+    if (!(self->options & CRON_CALC_OPT_WITH_YEARS))
+    {
+        return year;
+    }
+
+    base = CRON_CALC_YEAR_START + self->yearBase;
+    last = base + cron_calc_highest_bit(self->years);
+    if (year >= last)
+    {
+        /* years after the window continue progression from its last year */
+        if (self->yearStep && year > CRON_CALC_YEAR_START + self->yearEnd)
+        {
+            year = CRON_CALC_YEAR_START + self->yearEnd;
+        }
+        return last + (self->yearStep ? (year - last) / self->yearStep * self->yearStep : 0);
+    }
+    if (year < base)
+    {
+        return CRON_CALC_YEAR_MIN - 1;
+    }
+    bit = cron_calc_prev_bit(self->years, year - base);
+    return bit < 0 ? CRON_CALC_YEAR_MIN - 1 : bit + base;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static bool cron_calc_find_prev_year(
+    const cron_calc* self,
+    struct tm* tm_val,
+    const cron_calc_masks* masks)
+{
+    const int start = tm_val->tm_year;
+    int year = cron_calc_prev_year_value(self, start);
+    uint32_t types = 0;
+    int failures = 0;
+
+    CRON_CALC_STATS_DEPTH(CRON_CALC_TM_YEAR);
+    for (; year >= CRON_CALC_YEAR_MIN; year = cron_calc_prev_year_value(self, year - 1))
+    {
+        CRON_CALC_STATS_ADD(years_scanned, 1);
+        if (types && !(types & (1u << cron_calc_year_type(year))))
+        {
+            continue;
+        }
+
+        tm_val->tm_year = year;
+        CRON_CALC_STATS_ITERATION(CRON_CALC_TM_YEAR);
+        if (cron_calc_find_prev(self, tm_val, masks, CRON_CALC_TM_MONTH, year != start))
+        {
+            return true;
+        }
+
+        /* see cron_calc_find_next_year() */
+        if (++failures == CRON_CALC_YEAR_TYPES_AFTER)
+        {
+            types = cron_calc_year_types(self, masks);
+            if (!types)
+            {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Mirror of cron_calc_find_next(), which searches downwards,
+ * rollover here means that search starts from the maximum value of the level */
+static bool cron_calc_find_prev(
+    const cron_calc* self,
+    struct tm* tm_val,
+    const cron_calc_masks* masks,
+    cron_calc_tm_level level,
+    bool rollover)
+{
+    const uint64_t mask = masks->levels[level];
+    const int val_min = CRON_CALC_TM_FIELD_MIN(level);
+
+    int* fld = CRON_CALC_TM_FIELD(tm_val, level);
+    const int start = rollover ? (int) CRON_CALC_TM_FIELD_MAX(level) : *fld;
+    int val = cron_calc_prev_bit(mask, start);
+    bool found = false;
+
+    CRON_CALC_STATS_DEPTH(level);
+    for (; !found && val >= val_min; val = cron_calc_prev_bit(mask, val - 1))
+    {
+        rollover = rollover || (val != start);
+        *fld = val;
+        CRON_CALC_STATS_ITERATION(level);
+
+        if (level == CRON_CALC_TM_MONTH)
+        {
+            found = cron_calc_find_prev_day(self, tm_val, masks, rollover);
+        }
+        else if (level == CRON_CALC_TM_SECOND)
+        {
+            found = true;
+        }
+        else
+        {
+            found = cron_calc_find_prev(self, tm_val, masks, level + 1, rollover);
+        }
+    }
+    return found;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static bool cron_calc_init_masks(const cron_calc* self, cron_calc_mask_array levels)
+{
+    if (!self)
+    {
+        return false;
+    }
+
+    /* try to check that this object was initialized correctly before this call.
+     * All fields (except years) must be non-0, although this is not a 100%-proof method. */
+    if (!self->options ||
+        !self->months || !self->days || !self->weekDays ||
+        !self->hours || !self->minutes || !self->seconds)
+    {
+        return false;
+    }
+    if ((self->options & CRON_CALC_OPT_WITH_YEARS) && !self->years)
+    {
+        return false;
+    }
+
+    levels[CRON_CALC_TM_MONTH] = self->months;
+    levels[CRON_CALC_TM_HOUR] = self->hours;
+    levels[CRON_CALC_TM_MINUTE] = self->minutes;
+    levels[CRON_CALC_TM_SECOND] = self->seconds;
+    /* other masks are taken from self */
+    return true;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Days since 1970-01-01 of the given proleptic Gregorian date */
+static int64_t cron_calc_days_from_civil(int64_t year, int month, int day)
+{
+    const int64_t y = year - (month <= 2);
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const int64_t yoe = y - era * 400;                                  /* [0, 399] */
+    const int64_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;          /* [0, 146096] */
+    return era * 146097 + doe - 719468;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Splits time instant into calendar fields without any time zone applied.
+ * Fills in fields in the same way as cron_calc_next() adjusts them for search,
+ * i.e. with full year number and months starting from 1.
+ * @return False if the year is outside of supported range */
+static bool cron_calc_split_time(int64_t t, struct tm* tm_val)
+{
+    int64_t days = (t >= 0 ? t : t - 86399) / 86400;
+    int64_t secs = t - days * 86400;
+    int64_t era, doe, yoe, doy, mp, year;
+
+    days += 719468; /* shift epoch to 0000-03-01 */
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    doe = days - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    year = yoe + era * 400 + (mp >= 10);
+
+    if (year < 0 || year > CRON_CALC_YEAR_MAX)
+    {
+        return false;
+    }
+
+    memset(tm_val, 0, sizeof *tm_val);
+    tm_val->tm_year = (int) year;
+    tm_val->tm_mon = (int) (mp < 10 ? mp + 3 : mp - 9);
+    tm_val->tm_mday = (int) (doy - (153 * mp + 2) / 5 + 1);
+    tm_val->tm_hour = (int) (secs / 3600);
+    tm_val->tm_min = (int) (secs / 60 % 60);
+    tm_val->tm_sec = (int) (secs % 60);
+    tm_val->tm_wday = cron_calc_get_week_day(tm_val->tm_year, tm_val->tm_mon, tm_val->tm_mday);
+    return true;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Reverse of cron_calc_split_time() */
+static int64_t cron_calc_join_time(const struct tm* tm_val)
+{
+    return cron_calc_days_from_civil(tm_val->tm_year, tm_val->tm_mon, tm_val->tm_mday) * 86400 +
+        tm_val->tm_hour * 3600 + tm_val->tm_min * 60 + tm_val->tm_sec;
+}
+
+/* ---------------------------------------------------------------------------- */
+/* ---------------------------------------------------------------------------- */
+
+static uint32_t cron_calc_tz_be32(const uint8_t* p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static int64_t cron_calc_tz_be64(const uint8_t* p)
+{
+    return (int64_t) (((uint64_t) cron_calc_tz_be32(p) << 32) | cron_calc_tz_be32(p + 4));
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static const char* cron_calc_tz_parse_name(const char* p)
+{
+    const char* start = p;
+    if (*p == '<') /* quoted form, e.g. <+0330> */
+    {
+        for (p++; *p && *p != '>'; p++);
+        return (*p == '>' && p - start > 3) ? p + 1 : NULL;
+    }
+    for (; CRON_CALC_IS_NAME_CHAR(*p); p++);
+    return (p - start >= 3) ? p : NULL;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Parses [+|-]hh[:mm[:ss]] */
+static const char* cron_calc_tz_parse_hms(const char* p, int32_t* secs)
+{
+    int32_t sign = 1, value = 0, part = 0;
+    int i;
+
+    if (*p == '+' || *p == '-')
+    {
+        sign = (*p++ == '-') ? -1 : 1;
+    }
+    for (i = 0; i < 3; i++)
+    {
+        const char* start = p;
+        for (part = 0; CRON_CALC_IS_DIGIT(*p) && p - start < 3; p++)
+        {
+            part = part * 10 + *p - '0';
+        }
+        if (p == start || (i > 0 && part > 59))
+        {
+            return NULL;
+        }
+        value = value * 60 + part;
+        if (*p != ':')
+        {
+            break;
+        }
+        p++;
+    }
+    for (; i < 2; i++)
+    {
+        value *= 60;
+    }
+    *secs = sign * value;
+    return p;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static const char* cron_calc_tz_parse_number(const char* p, int* value, int minimum, int maximum)
+{
+    const char* start = p;
+    for (*value = 0; CRON_CALC_IS_DIGIT(*p) && *value <= maximum; p++)
+    {
+        *value = *value * 10 + *p - '0';
+    }
+    return (p == start || *value < minimum || *value > maximum) ? NULL : p;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Parses ,date[/time] */
+static const char* cron_calc_tz_parse_date(const char* p, cron_calc_tz_date* date)
+{
+    if (!p || *p++ != ',')
+    {
+        return NULL;
+    }
+    date->kind = 'N';
+    if (*p == 'J')
+    {
+        date->kind = *p++;
+        p = cron_calc_tz_parse_number(p, &date->day, 1, 365);
+    }
+    else if (*p == 'M')
+    {
+        date->kind = *p++;
+        p = cron_calc_tz_parse_number(p, &date->month, 1, 12);
+        p = (p && *p == '.') ? cron_calc_tz_parse_number(p + 1, &date->week, 1, 5) : NULL;
+        p = (p && *p == '.') ? cron_calc_tz_parse_number(p + 1, &date->day, 0, 6) : NULL;
+    }
+    else
+    {
+        p = cron_calc_tz_parse_number(p, &date->day, 0, 365);
+    }
+
+    date->time = CRON_CALC_TZ_DEFAULT_TIME;
+    if (p && *p == '/')
+    {
+        p = cron_calc_tz_parse_hms(p + 1, &date->time);
+    }
+    return p;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Parses POSIX TZ string from TZif footer, e.g. "CET-1CEST,M3.5.0,M10.5.0/3" */
+static bool cron_calc_tz_parse_rule(const char* p, cron_calc_tz_rule* rule)
+{
+    memset(rule, 0, sizeof *rule);
+
+    p = cron_calc_tz_parse_name(p);
+    p = p ? cron_calc_tz_parse_hms(p, &rule->std_offset) : NULL;
+    if (!p)
+    {
+        return false;
+    }
+    rule->std_offset = -rule->std_offset; /* POSIX offsets are positive west of Greenwich */
+    if (*p == 0)
+    {
+        return true;
+    }
+
+    p = cron_calc_tz_parse_name(p);
+    if (!p)
+    {
+        return false;
+    }
+    rule->has_dst = true;
+    rule->dst_offset = rule->std_offset + CRON_CALC_TZ_DEFAULT_DST;
+    if (*p && *p != ',')
+    {
+        p = cron_calc_tz_parse_hms(p, &rule->dst_offset);
+        if (!p)
+        {
+            return false;
+        }
+        rule->dst_offset = -rule->dst_offset;
+    }
+
+    /* TZif footers always specify the rule when DST is used */
+    p = cron_calc_tz_parse_date(p, &rule->start);
+    p = cron_calc_tz_parse_date(p, &rule->end);
+    return p && *p == 0;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return Local time of the transition in given year, in seconds since epoch */
+static int64_t cron_calc_tz_date_time(const cron_calc_tz_date* date, int year)
+{
+    int64_t days;
+    if (date->kind == 'M')
+    {
+        const int first_wday = cron_calc_get_week_day(year, date->month, 1);
+        int day = 1 + (date->day - first_wday + 7) % 7 + (date->week - 1) * 7;
+        for (; day > cron_calc_month_days(year, date->month); day -= 7);
+        days = cron_calc_days_from_civil(year, date->month, day);
+    }
+    else
+    {
+        days = cron_calc_days_from_civil(year, 1, 1) + date->day;
+        if (date->kind == 'J')
+        {
+            /* Feb-29 is never counted, so day 60 is always March 1st */
+            days += (cron_calc_is_leap_year(year) && date->day >= 60) ? 0 : -1;
+        }
+    }
+    return days * CRON_CALC_DAY_SECONDS + date->time;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static int32_t cron_calc_tz_rule_offset(const cron_calc_tz_rule* rule, int64_t t)
+{
+    struct tm tm_val;
+    int64_t start, end;
+
+    if (!rule->has_dst || !cron_calc_split_time(t + rule->std_offset, &tm_val))
+    {
+        return rule->std_offset;
+    }
+
+    start = cron_calc_tz_date_time(&rule->start, tm_val.tm_year) - rule->std_offset;
+    end = cron_calc_tz_date_time(&rule->end, tm_val.tm_year) - rule->dst_offset;
+
+    if (start < end) /* DST within a year, northern hemisphere */
+    {
+        return (start <= t && t < end) ? rule->dst_offset : rule->std_offset;
+    }
+    /* DST across new year */
+    return (end <= t && t < start) ? rule->std_offset : rule->dst_offset;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return UTC offset in seconds in effect at given time instant */
+static int32_t cron_calc_tz_offset(const cron_calc_tz* tz, int64_t t)
+{
+    size_t lo = 0, hi = tz->count;
+
+    if (hi == 0 || t < tz->times[0])
+    {
+        return (hi == 0 && tz->has_rule) ? cron_calc_tz_rule_offset(&tz->rule, t) : tz->initial_offset;
+    }
+    if (t >= tz->times[hi - 1] && tz->has_rule)
+    {
+        return cron_calc_tz_rule_offset(&tz->rule, t);
+    }
+
+    /* find last transition at or before t */
+    while (hi - lo > 1)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (tz->times[mid] <= t)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return tz->offsets[lo];
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Converts local time (in seconds since epoch) to the earliest UTC instant after `after`,
+ * which has this local time. Local time skipped by forward transition is interpreted
+ * with UTC offset in effect before transition, same as mktime() does.
+ * @return False if all UTC instants with this local time are not after `after` */
+static bool cron_calc_tz_to_utc(const cron_calc_tz* tz, int64_t local, int64_t after, int64_t* utc)
+{
+    /* transitions never happen more often than once in 2 days */
+    const int32_t before = cron_calc_tz_offset(tz, local - CRON_CALC_DAY_SECONDS);
+    const int32_t later = cron_calc_tz_offset(tz, local + CRON_CALC_DAY_SECONDS);
+    const int64_t first = local - before;
+    const int64_t second = local - later;
+    const bool first_valid = cron_calc_tz_offset(tz, first) == before;
+    const bool second_valid = cron_calc_tz_offset(tz, second) == later;
+
+    /* if neither is valid, local time is skipped */
+    if (first > after && (first_valid || !second_valid))
+    {
+        *utc = first;
+        return true;
+    }
+    if (second > after && second_valid)
+    {
+        *utc = second;
+        return true;
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_tz_parse(cron_calc_tz** tz, const void* data, size_t size)
+{
+    const uint8_t* p = (const uint8_t*) data;
+    const uint8_t* end = p + size;
+    uint32_t counts[6] = { 0 };
+    size_t time_size = 4, i;
+    uint8_t* block;
+    cron_calc_tz* self;
+    int64_t* times;
+    int32_t* offsets;
+    const uint8_t* types;
+
+    if (!tz || !data)
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+    *tz = NULL;
+
+    for (;;)
+    {
+        /* header: magic, version, reserved, counts:
+         * isutcnt, isstdcnt, leapcnt, timecnt, typecnt, charcnt */
+        if (end - p < CRON_CALC_TZ_HEADER_SIZE || memcmp(p, "TZif", 4) != 0)
+        {
+            return CRON_CALC_ERROR_TZ_DATA;
+        }
+        for (i = 0; i < 6; i++)
+        {
+            counts[i] = cron_calc_tz_be32(p + 20 + 4 * i);
+            if (counts[i] > CRON_CALC_TZ_FILE_MAX)
+            {
+                return CRON_CALC_ERROR_TZ_DATA;
+            }
+        }
+        if (counts[4] == 0 || (uint64_t) (end - p) < CRON_CALC_TZ_HEADER_SIZE +
+            (uint64_t) counts[3] * (time_size + 1) + counts[4] * 6 + counts[5] +
+            counts[2] * (time_size + 4) + counts[1] + counts[0])
+        {
+            return CRON_CALC_ERROR_TZ_DATA;
+        }
+        if (time_size == 8 || p[4] < '2')
+        {
+            break;
+        }
+        /* version 2+ contains 64-bit data block after 32-bit one */
+        p += CRON_CALC_TZ_HEADER_SIZE + counts[3] * 5 + counts[4] * 6 + counts[5] +
+            counts[2] * 8 + counts[1] + counts[0];
+        time_size = 8;
+    }
+    p += CRON_CALC_TZ_HEADER_SIZE;
+    types = p + counts[3] * time_size;
+
+    block = (uint8_t*) malloc(sizeof(cron_calc_tz) + counts[3] * (sizeof(int64_t) + sizeof(int32_t)));
+    if (!block)
+    {
+        return CRON_CALC_ERROR_OOM;
+    }
+    self = (cron_calc_tz*) block;
+    times = (int64_t*) (block + sizeof(cron_calc_tz));
+    offsets = (int32_t*) (times + counts[3]);
+    memset(self, 0, sizeof *self);
+    self->count = counts[3];
+    self->times = times;
+    self->offsets = offsets;
+    /* local time type 0 is used for instants before the first transition */
+    self->initial_offset = (int32_t) cron_calc_tz_be32(types + counts[3]);
+
+    for (i = 0; i < counts[3]; i++)
+    {
+        times[i] = (time_size == 8) ? cron_calc_tz_be64(p + 8 * i) : (int32_t) cron_calc_tz_be32(p + 4 * i);
+        if (types[i] >= counts[4] || (i > 0 && times[i] <= times[i - 1]))
+        {
+            free(block);
+            return CRON_CALC_ERROR_TZ_DATA;
+        }
+        /* type index is checked, so its ttinfo record is within the buffer */
+        offsets[i] = (int32_t) cron_calc_tz_be32(types + counts[3] + 6 * types[i]);
+    }
+
+    /* version 2+ footer: newline-enclosed POSIX TZ string */
+    p = types + counts[3] + counts[4] * 6 + counts[5] + counts[2] * (time_size + 4) + counts[1] + counts[0];
+    if (time_size == 8 && end - p > 2 && *p == '\n')
+    {
+        char footer[CRON_CALC_TZ_FOOTER_MAX] = { 0 };
+        const uint8_t* footer_end = (const uint8_t*) memchr(p + 1, '\n', end - p - 1);
+        if (footer_end && footer_end - p - 1 > 0 && footer_end - p - 1 < CRON_CALC_TZ_FOOTER_MAX)
+        {
+            memcpy(footer, p + 1, footer_end - p - 1);
+            self->has_rule = cron_calc_tz_parse_rule(footer, &self->rule);
+        }
+    }
+
+    *tz = self;
+    return CRON_CALC_OK;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_tz_load(cron_calc_tz** tz, const char* name)
+{
+    char path[CRON_CALC_TZ_PATH_MAX];
+    uint8_t* data;
+    size_t size;
+    FILE* file;
+    cron_calc_error err;
+
+    if (!tz || !name || !*name || strstr(name, ".."))
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+    *tz = NULL;
+
+    if (snprintf(path, sizeof path, "%s%s", (*name == '/') ? "" : CRON_CALC_TZ_DIR "/", name) >= (int) sizeof path)
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    file = fopen(path, "rb");
+    if (!file)
+    {
+        return CRON_CALC_ERROR_TZ_DATA;
+    }
+    data = (uint8_t*) malloc(CRON_CALC_TZ_FILE_MAX);
+    if (!data)
+    {
+        fclose(file);
+        return CRON_CALC_ERROR_OOM;
+    }
+    size = fread(data, 1, CRON_CALC_TZ_FILE_MAX, file);
+    fclose(file);
+
+    err = cron_calc_tz_parse(tz, data, size);
+    free(data);
+    return err;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+void cron_calc_tz_free(cron_calc_tz* tz)
+{
+    free(tz);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Splits time instant into local calendar fields adjusted for search,
+ * i.e. with full year number and months starting from 1 */
+static bool cron_calc_localtime(time_t t, struct tm* tm_val)
+{
+    struct tm* tm_res = NULL;
+    CRON_CALC_STATS_TIMER(started);
+
+#if defined(_POSIX_C_SOURCE)
+    tm_res = localtime_r(&t, tm_val);
+#elif defined (_MSC_VER)
+    tm_res = localtime_s(&t, tm_val);
+#else
+    tm_res = localtime(&t);
+    if (tm_res)
+    {
+        *tm_val = *tm_res;
+    }
+#endif
+    CRON_CALC_STATS_CONVERSION(started);
+    if (!tm_res)
+    {
+        return false;
+    }
+
+    /* adjust tm values */
+    tm_val->tm_year += 1900;
+    tm_val->tm_mon += 1;
+    return true;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Reverse of cron_calc_localtime() */
+static time_t cron_calc_mktime(struct tm* tm_val)
+{
+    time_t res;
+    CRON_CALC_STATS_TIMER(started);
+
+    /* restore to tm definitions */
+    tm_val->tm_year -= 1900;
+    tm_val->tm_mon -= 1;
+    tm_val->tm_isdst = -1;
+
+    res = mktime(tm_val); /* CRON_CALC_INVALID_TIME in case of error */
+    CRON_CALC_STATS_CONVERSION(started);
+    return res;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+static time_t cron_calc_next_local(const cron_calc* self, const cron_calc_masks* masks, time_t after)
+{
+    struct tm tm_buf = { 0 };
+
+    if (!cron_calc_localtime(after + 1, &tm_buf) ||
+        !cron_calc_search_next(self, &tm_buf, masks))
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+
+    return cron_calc_mktime(&tm_buf);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+time_t cron_calc_next(const cron_calc* self, time_t after)
+{
+    cron_calc_mask_array levels = { 0 };
+    const cron_calc_masks masks = { levels, NULL, NULL };
+
+    CRON_CALC_STATS_BEGIN();
+    if (!cron_calc_init_masks(self, levels))
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+    return cron_calc_next_local(self, &masks, after);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_compile(cron_calc_compiled* self, const cron_calc* rule)
+{
+    if (!self)
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    memset(self, 0, sizeof *self);
+    if (!cron_calc_init_masks(rule, self->masks))
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    self->rule = *rule;
+    cron_calc_fill_days(rule, self->days);
+    return CRON_CALC_OK;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+time_t cron_calc_compiled_next(const cron_calc_compiled* self, time_t after)
+{
+    cron_calc_masks masks;
+
+    CRON_CALC_STATS_BEGIN();
+    if (!self || !self->masks[CRON_CALC_TM_MONTH]) /* not compiled */
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+
+    masks.levels = self->masks;
+    masks.days = self->days;
+    masks.day_time = self->day_time;
+    return cron_calc_next_local(&self->rule, &masks, after);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_day_time_create(cron_calc_day_time** day_time, const cron_calc* rule)
+{
+    cron_calc_mask_array levels = { 0 };
+    cron_calc_day_time* res;
+    int unit, count, hour, minute, second;
+
+    if (!day_time)
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+    *day_time = NULL;
+
+    if (!cron_calc_init_masks(rule, levels))
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    /* most rules match only at 0th second, then bit per minute is enough */
+    unit = (rule->seconds == CRON_CALC_MASK(0)) ? 60 : 1;
+    count = (CRON_CALC_DAY_SECONDS / unit + 63) / 64;
+    res = (cron_calc_day_time*) calloc(1, sizeof *res + (count - 1) * sizeof res->words[0]);
+    if (!res)
+    {
+        return CRON_CALC_ERROR_OOM;
+    }
+
+    res->seconds = rule->seconds;
+    res->minutes = rule->minutes;
+    res->hours = rule->hours;
+    res->unit = unit;
+    res->count = count;
+
+    for (hour = cron_calc_next_bit(rule->hours, 0); hour >= 0; hour = cron_calc_next_bit(rule->hours, hour + 1))
+    {
+        for (minute = cron_calc_next_bit(rule->minutes, 0); minute >= 0;
+             minute = cron_calc_next_bit(rule->minutes, minute + 1))
+        {
+            for (second = cron_calc_next_bit(rule->seconds, 0); second >= 0;
+                 second = cron_calc_next_bit(rule->seconds, second + 1))
+            {
+                const int pos = ((hour * 60 + minute) * 60 + second) / unit;
+                res->words[pos / 64] |= CRON_CALC_MASK(pos % 64);
+                res->summary[pos / 64 / 64] |= CRON_CALC_MASK(pos / 64 % 64);
+            }
+        }
+    }
+
+    *day_time = res;
+    return CRON_CALC_OK;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+void cron_calc_day_time_free(cron_calc_day_time* day_time)
+{
+    free(day_time);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_compiled_set_day_time(cron_calc_compiled* self, const cron_calc_day_time* day_time)
+{
+    if (!self || !self->masks[CRON_CALC_TM_MONTH])
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    if (day_time &&
+        (day_time->seconds != self->rule.seconds ||
+         day_time->minutes != self->rule.minutes ||
+         day_time->hours != self->rule.hours))
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    self->day_time = day_time;
+    return CRON_CALC_OK;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+time_t cron_calc_next_utc(const cron_calc* self, time_t after)
+{
+    return cron_calc_next_offset(self, after, 0);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+time_t cron_calc_next_offset(const cron_calc* self, time_t after, int32_t utc_offset)
+{
+    struct tm tm_buf;
+    cron_calc_mask_array levels = { 0 };
+    const cron_calc_masks masks = { levels, NULL, NULL };
+    int64_t next;
+
+    CRON_CALC_STATS_BEGIN();
+    if (!cron_calc_init_masks(self, levels) ||
+        utc_offset <= -CRON_CALC_DAY_SECONDS || utc_offset >= CRON_CALC_DAY_SECONDS)
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+
+    if (!cron_calc_split_time((int64_t) after + 1 + utc_offset, &tm_buf) ||
+        !cron_calc_search_next(self, &tm_buf, &masks))
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+
+    next = cron_calc_join_time(&tm_buf) - utc_offset;
+    return (time_t) next == next ? (time_t) next : CRON_CALC_INVALID_TIME;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+time_t cron_calc_next_tz(const cron_calc* self, const cron_calc_tz* tz, time_t after)
+{
+    struct tm tm_buf;
+    cron_calc_mask_array levels = { 0 };
+    const cron_calc_masks masks = { levels, NULL, NULL };
+    int64_t start = (int64_t) after + 1;
+    int64_t next = 0;
+
+    CRON_CALC_STATS_BEGIN();
+    if (!tz || !cron_calc_init_masks(self, levels) ||
+        !cron_calc_split_time(start + cron_calc_tz_offset(tz, start), &tm_buf))
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+
+    /* local times repeated by backward transition may map to instants before `after`,
+     * in that case search continues from the next local second */
+    while (cron_calc_search_next(self, &tm_buf, &masks))
+    {
+        const int64_t local = cron_calc_join_time(&tm_buf);
+        if (cron_calc_tz_to_utc(tz, local, after, &next))
+        {
+            return (time_t) next == next ? (time_t) next : CRON_CALC_INVALID_TIME;
+        }
+        if (!cron_calc_split_time(local + 1, &tm_buf))
+        {
+            break;
+        }
+    }
+    return CRON_CALC_INVALID_TIME;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return Whether UTC offset of local time zone at given instant is known */
+static bool cron_calc_local_offset(int64_t t, int64_t* offset)
+{
+    struct tm tm_val;
+    if ((time_t) t != t || !cron_calc_localtime((time_t) t, &tm_val))
+    {
+        return false;
+    }
+    *offset = cron_calc_join_time(&tm_val) - t;
+    return true;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Converts local time found by backward search to the latest instant before `before`.
+ * Local time repeated by backward DST transition has two instants, mktime() may return
+ * either of them, so the other one is found by UTC offsets a day before and after.
+ * Local time skipped by forward transition is moved forward by mktime(), as in cron_calc_next().
+ * @return False if no instant before `before` has this local time, otherwise `prev` is set,
+ *         CRON_CALC_INVALID_TIME if local time can't be converted */
+static bool cron_calc_prev_instant(const struct tm* tm_local, time_t before, time_t* prev)
+{
+    struct tm tm_buf = *tm_local;
+    const int64_t local = cron_calc_join_time(tm_local);
+    const time_t found = cron_calc_mktime(&tm_buf);
+    int64_t offsets[2], offset;
+    bool res = found < before;
+    int i;
+
+    *prev = found;
+    if (found == CRON_CALC_INVALID_TIME ||
+        !cron_calc_local_offset((int64_t) found - CRON_CALC_DAY_SECONDS, &offsets[0]) ||
+        !cron_calc_local_offset((int64_t) found + CRON_CALC_DAY_SECONDS, &offsets[1]) ||
+        offsets[0] == offsets[1])
+    {
+        return res || found == CRON_CALC_INVALID_TIME;
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        const int64_t other = local - offsets[i];
+        if (other < before && (!res || other > *prev) &&
+            cron_calc_local_offset(other, &offset) && offset == offsets[i])
+        {
+            *prev = (time_t) other;
+            res = true;
+        }
+    }
+    return res;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Searches backwards from given local time for the latest instant before `before`.
+ * Found local time may have no instant before `before`: it is moved forward by mktime()
+ * if skipped by forward DST transition, or it is the later part of the day after backward one,
+ * so search continues from the previous local second */
+static time_t cron_calc_prev_local(const cron_calc* self, const cron_calc_masks* masks, struct tm* tm_val, time_t before)
+{
+    time_t prev;
+
+    while (cron_calc_find_prev_year(self, tm_val, masks))
+    {
+        if (cron_calc_prev_instant(tm_val, before, &prev))
+        {
+            return prev;
+        }
+        if (!cron_calc_split_time(cron_calc_join_time(tm_val) - 1, tm_val))
+        {
+            break;
+        }
+    }
+    return CRON_CALC_INVALID_TIME;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+time_t cron_calc_prev(const cron_calc* self, time_t before)
+{
+    struct tm tm_buf = { 0 };
+    cron_calc_mask_array levels = { 0 };
+    const cron_calc_masks masks = { levels, NULL, NULL };
+    int64_t offset, day_ago_offset;
+    time_t prev, earlier;
+
+    CRON_CALC_STATS_BEGIN();
+    if (!cron_calc_init_masks(self, levels) ||
+        !cron_calc_localtime(before - 1, &tm_buf))
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+    offset = cron_calc_join_time(&tm_buf) - ((int64_t) before - 1);
+    prev = cron_calc_prev_local(self, &masks, &tm_buf, before);
+
+    /* if clocks were turned back during the last day, local times later than the current one
+     * have passed before `before` too, they are searched separately from the latest of them,
+     * because order of local times differs from order of instants around the transition */
+    if (cron_calc_local_offset((int64_t) before - 1 - CRON_CALC_DAY_SECONDS, &day_ago_offset) &&
+        day_ago_offset > offset &&
+        cron_calc_split_time((int64_t) before - 1 + day_ago_offset, &tm_buf))
+    {
+        earlier = cron_calc_prev_local(self, &masks, &tm_buf, before);
+        if (earlier != CRON_CALC_INVALID_TIME && (prev == CRON_CALC_INVALID_TIME || earlier > prev))
+        {
+            prev = earlier;
+        }
+    }
+    return prev;
+}
+
+/* ---------------------------------------------------------------------------- */
+/* ---------------------------------------------------------------------------- */
+
+/* Finds next match within the same day as current one.
+ * Only lower levels are changed, so only few bit scans are done. */
+static bool cron_calc_advance_in_day(const cron_calc* self, struct tm* tm_val, const cron_calc_masks* masks)
+{
+    cron_calc_tm_level level = CRON_CALC_TM_SECOND;
+
+    for (; level >= CRON_CALC_TM_HOUR; level--)
+    {
+        int* fld = CRON_CALC_TM_FIELD(tm_val, level);
+        const int val = cron_calc_next_bit(masks->levels[level], *fld + 1);
+
+        if (val >= 0 && val <= (int) CRON_CALC_TM_FIELD_MAX(level))
+        {
+            *fld = val;
+            return level == CRON_CALC_TM_SECOND ||
+                cron_calc_find_next(self, tm_val, masks, level + 1, true);
+        }
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Caches local midnight of the day of last match, so following matches in this day
+ * are converted to time_t without calling mktime() */
+static void cron_calc_cursor_cache_day(cron_calc_cursor* self)
+{
+    struct tm day_tm = self->tm_val;
+    time_t day_end;
+
+    self->day_year = day_tm.tm_year;
+    self->day_month = day_tm.tm_mon;
+    self->day_mday = day_tm.tm_mday;
+
+    day_tm.tm_hour = day_tm.tm_min = day_tm.tm_sec = 0;
+    self->day_start = cron_calc_mktime(&day_tm);
+
+    day_tm = self->tm_val;
+    day_tm.tm_mday++; /* normalized by mktime() */
+    day_tm.tm_hour = day_tm.tm_min = day_tm.tm_sec = 0;
+    day_end = cron_calc_mktime(&day_tm);
+
+    if (self->day_start == CRON_CALC_INVALID_TIME ||
+        day_end - self->day_start != CRON_CALC_DAY_SECONDS)
+    {
+        self->day_start = CRON_CALC_INVALID_TIME;
+    }
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Converts found match to time_t */
+static time_t cron_calc_cursor_found(cron_calc_cursor* self)
+{
+    struct tm tm_found = self->tm_val;
+
+    if (self->tm_val.tm_mday != self->day_mday ||
+        self->tm_val.tm_mon != self->day_month ||
+        self->tm_val.tm_year != self->day_year)
+    {
+        cron_calc_cursor_cache_day(self);
+    }
+    if (self->day_start != CRON_CALC_INVALID_TIME)
+    {
+        return self->current = self->day_start +
+            self->tm_val.tm_hour * 3600 + self->tm_val.tm_min * 60 + self->tm_val.tm_sec;
+    }
+    return self->current = cron_calc_mktime(&tm_found);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+time_t cron_calc_cursor_init(cron_calc_cursor* self, const cron_calc* rule, time_t after)
+{
+    cron_calc_masks masks = { NULL, NULL, NULL };
+
+    if (!self)
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+
+    memset(self, 0, sizeof *self);
+    self->current = CRON_CALC_INVALID_TIME;
+    self->day_start = CRON_CALC_INVALID_TIME;
+
+    if (!cron_calc_init_masks(rule, self->masks) ||
+        !cron_calc_localtime(after + 1, &self->tm_val))
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+    self->rule = *rule;
+
+    masks.levels = self->masks;
+    if (!cron_calc_search_next(&self->rule, &self->tm_val, &masks))
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+    return cron_calc_cursor_found(self);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+time_t cron_calc_cursor_advance(cron_calc_cursor* self)
+{
+    cron_calc_masks masks = { NULL, NULL, NULL };
+
+    if (!self || self->current == CRON_CALC_INVALID_TIME)
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+
+    if (self->day_start == CRON_CALC_INVALID_TIME)
+    {
+        /* local time is not linear within this day (DST transition),
+         * so it is not known what local time follows the last match */
+        const cron_calc rule = self->rule;
+        return cron_calc_cursor_init(self, &rule, self->current);
+    }
+
+    /* within a regular day it's enough to advance lowest levels */
+    masks.levels = self->masks;
+    if (cron_calc_advance_in_day(&self->rule, &self->tm_val, &masks))
+    {
+        return self->current = self->day_start +
+            self->tm_val.tm_hour * 3600 + self->tm_val.tm_min * 60 + self->tm_val.tm_sec;
+    }
+
+    /* continue from the start of the next day */
+    self->tm_val.tm_hour = self->tm_val.tm_min = self->tm_val.tm_sec = 0;
+    if (++self->tm_val.tm_mday > cron_calc_month_days(self->tm_val.tm_year, self->tm_val.tm_mon))
+    {
+        self->tm_val.tm_mday = 1;
+        if (++self->tm_val.tm_mon > (int) CRON_CALC_TM_FIELD_MAX(CRON_CALC_TM_MONTH))
+        {
+            self->tm_val.tm_mon = 1;
+            self->tm_val.tm_year++;
+        }
+    }
+    if (!cron_calc_search_next(&self->rule, &self->tm_val, &masks))
+    {
+        return self->current = CRON_CALC_INVALID_TIME;
+    }
+    return cron_calc_cursor_found(self);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_enumerate(
+    const cron_calc* self,
+    time_t from,
+    time_t to,
+    time_t* out,
+    size_t capacity,
+    size_t* count)
+{
+    cron_calc_cursor cursor;
+    time_t next;
+    size_t found = 0;
+
+    if (count)
+    {
+        *count = 0;
+    }
+    if (!count || (!out && capacity) || !cron_calc_init_masks(self, cursor.masks))
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    for (next = cron_calc_cursor_init(&cursor, self, from - 1);
+         next != CRON_CALC_INVALID_TIME && next < to && found < capacity;
+         next = cron_calc_cursor_advance(&cursor))
+    {
+        out[found++] = next;
+    }
+    *count = found;
+    return CRON_CALC_OK;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return Whether date in local calendar fields matches the rule */
+static bool cron_calc_date_matches(const cron_calc* self, const struct tm* tm_val)
+{
+    const int month_len = cron_calc_month_days(tm_val->tm_year, tm_val->tm_mon);
+    const int first_wday = (tm_val->tm_wday - (tm_val->tm_mday - 1) % 7 + 7) % 7;
+
+    return
+        cron_calc_next_year_value(self, tm_val->tm_year) == tm_val->tm_year &&
+        CRON_CALC_MATCHES_MASK(tm_val->tm_mon, self->months) &&
+        CRON_CALC_MATCHES_MASK(tm_val->tm_mday, cron_calc_month_day_mask(self, first_wday, month_len));
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return 1 if time of day matches the rule, 0 otherwise, without branches */
+static uint8_t cron_calc_time_matches(const cron_calc* self, int second_of_day)
+{
+    return (uint8_t) (
+        (self->hours >> (second_of_day / 3600)) &
+        (self->minutes >> (second_of_day / 60 % 60)) &
+        (self->seconds >> (second_of_day % 60)) & 1);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+bool cron_calc_matches(const cron_calc* self, time_t t)
+{
+    cron_calc_mask_array levels = { 0 };
+    struct tm tm_buf;
+
+    if (!cron_calc_init_masks(self, levels) || !cron_calc_localtime(t, &tm_buf))
+    {
+        return false;
+    }
+    return cron_calc_date_matches(self, &tm_buf) &&
+        cron_calc_time_matches(self, (tm_buf.tm_hour * 60 + tm_buf.tm_min) * 60 + tm_buf.tm_sec);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+bool cron_calc_matches_tm(const cron_calc* self, const struct tm* local)
+{
+    cron_calc_mask_array levels = { 0 };
+    struct tm tm_buf;
+
+    if (!local || !cron_calc_init_masks(self, levels))
+    {
+        return false;
+    }
+
+    tm_buf = *local;
+    tm_buf.tm_year += 1900;
+    tm_buf.tm_mon += 1;
+    return cron_calc_date_matches(self, &tm_buf) &&
+        cron_calc_time_matches(self, (tm_buf.tm_hour * 60 + tm_buf.tm_min) * 60 + tm_buf.tm_sec);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Local day containing some instant, for which all instants are split
+ * by subtraction of its start, if `uniform` is set */
+typedef struct cron_calc_day_range
+{
+    int64_t begin;      /* first instant of the day */
+    int64_t end;        /* first instant after the day */
+    uint8_t matches;    /* 1 if date matches the rule, 0 otherwise */
+    bool uniform;       /* false if UTC offset changes within the day, e.g. at DST transition */
+} cron_calc_day_range;
+
+/* @return False if local time of the instant can't be found */
+static bool cron_calc_load_day(const cron_calc* self, time_t t, cron_calc_day_range* day)
+{
+    struct tm tm_val, tm_edge;
+
+    if (!cron_calc_localtime(t, &tm_val))
+    {
+        return false;
+    }
+
+    day->begin = (int64_t) t - ((tm_val.tm_hour * 60 + tm_val.tm_min) * 60 + tm_val.tm_sec);
+    day->end = day->begin + CRON_CALC_DAY_SECONDS;
+    day->matches = cron_calc_date_matches(self, &tm_val) ? 1 : 0;
+
+    /* UTC offset is assumed the same all day long, if it is the same at both ends */
+    day->uniform =
+        cron_calc_localtime((time_t) day->begin, &tm_edge) &&
+        tm_edge.tm_mday == tm_val.tm_mday && tm_edge.tm_hour == 0 && tm_edge.tm_min == 0 && tm_edge.tm_sec == 0 &&
+        cron_calc_localtime((time_t) (day->end - 1), &tm_edge) &&
+        tm_edge.tm_mday == tm_val.tm_mday && tm_edge.tm_hour == 23 && tm_edge.tm_min == 59 && tm_edge.tm_sec == 59;
+    return true;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_filter(const cron_calc* self, const time_t* ts, size_t n, uint8_t* out)
+{
+    cron_calc_mask_array levels = { 0 };
+    cron_calc_day_range day = { 0, 0, 0, false };
+    size_t i = 0;
+
+    if ((n && (!ts || !out)) || !cron_calc_init_masks(self, levels))
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    while (i < n)
+    {
+        if ((int64_t) ts[i] < day.begin || (int64_t) ts[i] >= day.end)
+        {
+            if (!cron_calc_load_day(self, ts[i], &day))
+            {
+                out[i++] = 0;
+                day.begin = day.end = 0;
+                continue;
             }
-            else
+        }
+
+        if (!day.uniform)
+        {
+            out[i] = cron_calc_matches(self, ts[i]) ? 1 : 0;
+            i++;
+        }
+        else if (!day.matches)
+        {
+            for (; i < n && (int64_t) ts[i] >= day.begin && (int64_t) ts[i] < day.end; i++)
+            {
+                out[i] = 0;
+            }
+        }
+        else
+        {
+            /* instants of the same day are split without libc calls */
+            for (; i < n && (int64_t) ts[i] >= day.begin && (int64_t) ts[i] < day.end; i++)
             {
-                found = cron_calc_find_next(self, tm_val, masks, level + 1, rollover);
+                out[i] = cron_calc_time_matches(self, (int) ((int64_t) ts[i] - day.begin));
             }
         }
     }
+    return CRON_CALC_OK;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return Number of matching seconds of day before given second of day, 0 to 86400 */
+static uint64_t cron_calc_time_count_before(const cron_calc* self, int second_of_day)
+{
+    const int hour = second_of_day / 3600;
+    const int minute = second_of_day / 60 % 60;
+    const int second = second_of_day % 60;
+    const uint64_t hours = self->hours & (CRON_CALC_MASK(24) - 1);
+    const uint64_t minutes = self->minutes & (CRON_CALC_MASK(60) - 1);
+    const uint64_t seconds = self->seconds & (CRON_CALC_MASK(60) - 1);
+    const uint64_t per_minute = (uint64_t) cron_calc_bit_count(seconds);
+    const uint64_t per_hour = (uint64_t) cron_calc_bit_count(minutes) * per_minute;
+
+    /* whole hours, then whole minutes of this hour, then seconds of this minute */
+    uint64_t res = (uint64_t) cron_calc_bit_count(hours & (CRON_CALC_MASK(hour) - 1)) * per_hour;
+    if (CRON_CALC_MATCHES_MASK(hour, hours))
+    {
+        res += (uint64_t) cron_calc_bit_count(minutes & (CRON_CALC_MASK(minute) - 1)) * per_minute;
+        if (CRON_CALC_MATCHES_MASK(minute, minutes))
+        {
+            res += (uint64_t) cron_calc_bit_count(seconds & (CRON_CALC_MASK(second) - 1));
+        }
+    }
+    return res;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Counts instants from `from` to `to` by searching them one by one */
+static uint64_t cron_calc_count_search(const cron_calc* self, cron_calc_cursor* cursor, int64_t from, int64_t to)
+{
+    uint64_t found = 0;
+    time_t next = cron_calc_cursor_init(cursor, self, (time_t) (from - 1));
+    for (; next != CRON_CALC_INVALID_TIME && (int64_t) next < to; next = cron_calc_cursor_advance(cursor))
+    {
+        found++;
+    }
     return found;
 }
 
 /* ---------------------------------------------------------------------------- */
 
-time_t cron_calc_next(const cron_calc* self, time_t after)
+/* Counts instants from `pos` to `end` within a day, whose UTC offset changes.
+ * Local hours with the same UTC offset at both ends and just outside of them are
+ * counted from masks. Other hours are searched instant by instant in one go,
+ * because next() moves instants skipped by the transition to the following hours. */
+static uint64_t cron_calc_count_irregular(const cron_calc* self, cron_calc_cursor* cursor, int64_t pos, int64_t end)
 {
-    struct tm tm_buf = { 0 };
-    struct tm* tm_after = NULL;
-    time_t start = after + 1;
-    cron_calc_mask_array masks = { 0 };
+    uint64_t found = 0;
+    int64_t irregular_start = 0;
+    bool irregular = false;
 
-    if (!self)
+    while (pos < end)
     {
-        return CRON_CALC_INVALID_TIME;
+        struct tm tm_val, tm_edge;
+        int64_t offset, hour_end;
+        int second_of_day;
+
+        if (!cron_calc_localtime((time_t) pos, &tm_val))
+        {
+            break;
+        }
+        offset = cron_calc_join_time(&tm_val) - pos;
+        second_of_day = (tm_val.tm_hour * 60 + tm_val.tm_min) * 60 + tm_val.tm_sec;
+        hour_end = pos + 3600 - second_of_day % 3600;
+        if (hour_end > end)
+        {
+            hour_end = end;
+        }
+
+        if (!cron_calc_localtime((time_t) (pos - 1), &tm_edge) || cron_calc_join_time(&tm_edge) - (pos - 1) != offset ||
+            !cron_calc_localtime((time_t) hour_end, &tm_edge) || cron_calc_join_time(&tm_edge) - hour_end != offset)
+        {
+            if (!irregular)
+            {
+                irregular_start = pos;
+                irregular = true;
+            }
+        }
+        else
+        {
+            if (irregular)
+            {
+                found += cron_calc_count_search(self, cursor, irregular_start, pos);
+                irregular = false;
+            }
+            if (cron_calc_date_matches(self, &tm_val))
+            {
+                found += cron_calc_time_count_before(self, second_of_day + (int) (hour_end - pos)) -
+                         cron_calc_time_count_before(self, second_of_day);
+            }
+        }
+        pos = hour_end;
     }
 
-    /* try to check that this object was initialized correctly before this call.
-     * All fields (except years) must be non-0, although this is not a 100%-proof method. */
-    if (!self->options ||
-        !self->months || !self->days || !self->weekDays ||
-        !self->hours || !self->minutes || !self->seconds)
+    if (irregular)
     {
-        return CRON_CALC_INVALID_TIME;
+        found += cron_calc_count_search(self, cursor, irregular_start, pos);
     }
-    if ((self->options & CRON_CALC_OPT_WITH_YEARS) && !self->years)
+    return found;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_count(const cron_calc* self, time_t from, time_t to, uint64_t* count)
+{
+    cron_calc_cursor cursor;
+    cron_calc_day_range day;
+    int64_t pos = (int64_t) from;
+    uint64_t found = 0;
+
+    if (count)
     {
-        return CRON_CALC_INVALID_TIME;
+        *count = 0;
+    }
+    if (!count || !cron_calc_init_masks(self, cursor.masks))
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
     }
 
-    masks[CRON_CALC_TM_MONTH] = self->months;
-    masks[CRON_CALC_TM_HOUR] = self->hours;
-    masks[CRON_CALC_TM_MINUTE] = self->minutes;
-    masks[CRON_CALC_TM_SECOND] = self->seconds;
-    /* other masks are taken from self */
+    while (pos < (int64_t) to && cron_calc_load_day(self, (time_t) pos, &day))
+    {
+        const int64_t end = day.end < (int64_t) to ? day.end : (int64_t) to;
 
-#if defined(_POSIX_C_SOURCE)
-    tm_after = localtime_r(&start, &tm_buf);
-#elif defined (_MSC_VER)
-    tm_after = localtime_s(&start, &tm_buf);
-#else
-    tm_after = localtime(&start);
-    if (tm_after)
+        if (!day.uniform)
+        {
+            found += cron_calc_count_irregular(self, &cursor, pos, end);
+        }
+        else if (day.matches)
+        {
+            found += cron_calc_time_count_before(self, (int) (end - day.begin)) -
+                     cron_calc_time_count_before(self, (int) (pos - day.begin));
+        }
+        pos = end;
+    }
+
+    *count = found;
+    return CRON_CALC_OK;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Sets rule bit in rows of field values from `first` to `last`, which are allowed by mask */
+static void cron_calc_index_set(uint64_t* column, size_t words, int row, uint64_t mask, int first, int last, uint64_t bit)
+{
+    int val = cron_calc_next_bit(mask, first);
+    for (; val >= 0 && val <= last; val = cron_calc_next_bit(mask, val + 1))
     {
-        tm_buf = *tm_after;
+        column[(row + val - first) * words] |= bit;
     }
-#endif
-    if (!tm_after)
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_index_create(cron_calc_index** index, const cron_calc* rules, size_t n)
+{
+    cron_calc_mask_array levels = { 0 };
+    cron_calc_index* res;
+    size_t words, i;
+
+    if (!index)
     {
-        return CRON_CALC_INVALID_TIME;
+        return CRON_CALC_ERROR_ARGUMENT;
     }
+    *index = NULL;
 
-    /* adjust tm values */
-    tm_buf.tm_year += 1900;
-    tm_buf.tm_mon += 1;
+    if (n && !rules)
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (!cron_calc_init_masks(&rules[i], levels))
+        {
+            return CRON_CALC_ERROR_ARGUMENT;
+        }
+    }
 
-    if (!cron_calc_find_next_year(self, tm_after, masks))
+    words = (n + 64 * CRON_CALC_INDEX_BLOCK - 1) / (64 * CRON_CALC_INDEX_BLOCK) * CRON_CALC_INDEX_BLOCK;
+    if (words > ((size_t) -1 - sizeof *res) / sizeof res->rows[0] / CRON_CALC_ROW_COUNT)
     {
-        return CRON_CALC_INVALID_TIME;
+        return CRON_CALC_ERROR_OOM;
     }
+    res = (cron_calc_index*) calloc(1, sizeof *res + CRON_CALC_ROW_COUNT * words * sizeof res->rows[0]);
+    if (!res)
+    {
+        return CRON_CALC_ERROR_OOM;
+    }
+    res->count = n;
+    res->words = words;
 
-    /* restore to tm definitions */
-    tm_buf.tm_year -= 1900;
-    tm_buf.tm_mon -= 1;
-    tm_buf.tm_isdst = -1;
+    for (i = 0; i < n; i++)
+    {
+        const cron_calc* rule = &rules[i];
+        const uint64_t bit = CRON_CALC_MASK(i % 64);
+        uint64_t* column = res->rows + i / 64;
+        int year;
+
+        cron_calc_index_set(column, words, CRON_CALC_ROW_SECONDS, rule->seconds, 0, 59, bit);
+        cron_calc_index_set(column, words, CRON_CALC_ROW_MINUTES, rule->minutes, 0, 59, bit);
+        cron_calc_index_set(column, words, CRON_CALC_ROW_HOURS, rule->hours, 0, 23, bit);
+        cron_calc_index_set(column, words, CRON_CALC_ROW_DAYS, rule->days, 0, 31, bit);
+        cron_calc_index_set(column, words, CRON_CALC_ROW_MONTHS, rule->months, 1, 12, bit);
+        cron_calc_index_set(column, words, CRON_CALC_ROW_WDAYS, rule->weekDays, 0, 6, bit);
+
+        year = cron_calc_next_year_value(rule, CRON_CALC_YEAR_START);
+        for (; year <= CRON_CALC_YEAR_END; year = cron_calc_next_year_value(rule, year + 1))
+        {
+            column[(CRON_CALC_ROW_YEARS + year - CRON_CALC_YEAR_START) * words] |= bit;
+        }
+        if (!(rule->options & CRON_CALC_OPT_WITH_YEARS))
+        {
+            column[CRON_CALC_ROW_ANY_YEAR * words] |= bit;
+        }
+        if (!(rule->options & (CRON_CALC_OPT_MDAY_STARRED | CRON_CALC_OPT_WDAY_STARRED)))
+        {
+            column[CRON_CALC_ROW_EITHER * words] |= bit;
+        }
+    }
+
+    *index = res;
+    return CRON_CALC_OK;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+void cron_calc_index_free(cron_calc_index* index)
+{
+    free(index);
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Rows matching field values of queried instant */
+typedef struct cron_calc_index_rows
+{
+    const uint64_t* second;
+    const uint64_t* minute;
+    const uint64_t* hour;
+    const uint64_t* mday;
+    const uint64_t* last;   /* rules matching the last day of month, if it is */
+    const uint64_t* month;
+    const uint64_t* wday;
+    const uint64_t* year;
+    const uint64_t* either;
+} cron_calc_index_rows;
+
+/* Calculates block of rule bitset, where rules are set if they match.
+ * Days match if both day of month and week day do, or either of them for rules
+ * with both day fields restricted, see cron_calc_month_day_mask() */
+static void cron_calc_index_block(const cron_calc_index_rows* rows, size_t word, uint64_t out[CRON_CALC_INDEX_BLOCK])
+{
+#if defined(__AVX2__)
+#define CRON_CALC_LOAD(row_) _mm256_loadu_si256((const __m256i*) (rows->row_ + word))
+    const __m256i mday = _mm256_or_si256(CRON_CALC_LOAD(mday), CRON_CALC_LOAD(last));
+    const __m256i wday = CRON_CALC_LOAD(wday);
+    const __m256i days = _mm256_or_si256(
+        _mm256_and_si256(mday, wday),
+        _mm256_and_si256(CRON_CALC_LOAD(either), _mm256_or_si256(mday, wday)));
+    const __m256i time = _mm256_and_si256(
+        _mm256_and_si256(CRON_CALC_LOAD(second), CRON_CALC_LOAD(minute)), CRON_CALC_LOAD(hour));
+    const __m256i date = _mm256_and_si256(_mm256_and_si256(CRON_CALC_LOAD(month), CRON_CALC_LOAD(year)), days);
+    _mm256_storeu_si256((__m256i*) out, _mm256_and_si256(time, date));
+#undef CRON_CALC_LOAD
+#elif defined(__SSE2__)
+#define CRON_CALC_LOAD(row_) _mm_loadu_si128((const __m128i*) (rows->row_ + word + i))
+    size_t i;
+    for (i = 0; i < CRON_CALC_INDEX_BLOCK; i += 2)
+    {
+        const __m128i mday = _mm_or_si128(CRON_CALC_LOAD(mday), CRON_CALC_LOAD(last));
+        const __m128i wday = CRON_CALC_LOAD(wday);
+        const __m128i days = _mm_or_si128(
+            _mm_and_si128(mday, wday),
+            _mm_and_si128(CRON_CALC_LOAD(either), _mm_or_si128(mday, wday)));
+        const __m128i time = _mm_and_si128(
+            _mm_and_si128(CRON_CALC_LOAD(second), CRON_CALC_LOAD(minute)), CRON_CALC_LOAD(hour));
+        const __m128i date = _mm_and_si128(_mm_and_si128(CRON_CALC_LOAD(month), CRON_CALC_LOAD(year)), days);
+        _mm_storeu_si128((__m128i*) (out + i), _mm_and_si128(time, date));
+    }
+#undef CRON_CALC_LOAD
+#else
+    size_t i;
+    for (i = 0; i < CRON_CALC_INDEX_BLOCK; i++)
+    {
+        const size_t w = word + i;
+        const uint64_t mday = rows->mday[w] | rows->last[w];
+        const uint64_t wday = rows->wday[w];
+        const uint64_t days = (mday & wday) | (rows->either[w] & (mday | wday));
+        out[i] = rows->second[w] & rows->minute[w] & rows->hour[w] & rows->month[w] & rows->year[w] & days;
+    }
+#endif
+}
+
+/* ---------------------------------------------------------------------------- */
+
+cron_calc_error cron_calc_index_query(
+    const cron_calc_index* index,
+    time_t t,
+    size_t* ids,
+    size_t capacity,
+    size_t* count)
+{
+    cron_calc_index_rows rows;
+    struct tm tm_val;
+    const uint64_t* base;
+    size_t words, word, found = 0;
+
+    if (count)
+    {
+        *count = 0;
+    }
+    if (!index || !count || (!ids && capacity) || !cron_calc_localtime(t, &tm_val))
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    base = index->rows;
+    words = index->words;
+    rows.second = base + (CRON_CALC_ROW_SECONDS + tm_val.tm_sec % 60) * words;
+    rows.minute = base + (CRON_CALC_ROW_MINUTES + tm_val.tm_min) * words;
+    rows.hour = base + (CRON_CALC_ROW_HOURS + tm_val.tm_hour) * words;
+    rows.mday = base + (CRON_CALC_ROW_DAYS + tm_val.tm_mday) * words;
+    rows.last = base + (tm_val.tm_mday == cron_calc_month_days(tm_val.tm_year, tm_val.tm_mon) ?
+        CRON_CALC_ROW_DAYS : CRON_CALC_ROW_ZERO) * words;
+    rows.month = base + (CRON_CALC_ROW_MONTHS + tm_val.tm_mon - 1) * words;
+    rows.wday = base + (CRON_CALC_ROW_WDAYS + tm_val.tm_wday) * words;
+    rows.year = base + (tm_val.tm_year >= CRON_CALC_YEAR_START && tm_val.tm_year <= CRON_CALC_YEAR_END ?
+        CRON_CALC_ROW_YEARS + tm_val.tm_year - CRON_CALC_YEAR_START : CRON_CALC_ROW_ANY_YEAR) * words;
+    rows.either = base + CRON_CALC_ROW_EITHER * words;
+
+    for (word = 0; word < words; word += CRON_CALC_INDEX_BLOCK)
+    {
+        uint64_t block[CRON_CALC_INDEX_BLOCK];
+        size_t i;
+
+        cron_calc_index_block(&rows, word, block);
+        for (i = 0; i < CRON_CALC_INDEX_BLOCK; i++)
+        {
+            for (; block[i]; block[i] &= block[i] - 1)
+            {
+                if (found < capacity)
+                {
+                    ids[found] = (word + i) * 64 + cron_calc_lowest_bit(block[i]);
+                }
+                found++;
+            }
+        }
+    }
 
-    return mktime(tm_after); /* CRON_CALC_INVALID_TIME in case of error */
+    *count = found;
+    return CRON_CALC_OK;
 }
 
 /* ---------------------------------------------------------------------------- */
@@ -723,5 +3066,34 @@ bool cron_calc_is_same(const cron_calc* left, const cron_calc* right)
         left->weekDays == right->weekDays &&
         left->months == right->months &&
         left->years == right->years &&
+        left->yearBase == right->yearBase &&
+        left->yearStep == right->yearStep &&
+        left->yearEnd == right->yearEnd &&
         left->options == right->options;
 }
+
+/* ---------------------------------------------------------------------------- */
+
+#ifdef CRON_CALC_WITH_STATS
+
+void cron_calc_stats_get(cron_calc_stats* last, cron_calc_stats* total)
+{
+    if (last)
+    {
+        *last = g_cron_calc_stats_last;
+    }
+    if (total)
+    {
+        *total = g_cron_calc_stats_total;
+    }
+}
+
+/* ---------------------------------------------------------------------------- */
+
+void cron_calc_stats_reset(void)
+{
+    memset(&g_cron_calc_stats_last, 0, sizeof g_cron_calc_stats_last);
+    memset(&g_cron_calc_stats_total, 0, sizeof g_cron_calc_stats_total);
+}
+
+#endif /* CRON_CALC_WITH_STATS */
@@ -3,107 +3,316 @@
 // This software is released under the MIT License.
 // https://opensource.org/licenses/MIT
 
-#ifndef CRON_CALC_NO_EXCEPT
-#include <list>
-#else
-#include <memory>
-#endif
+#include <algorithm>
+#include <ctime>
 
 #include "cron_calc.hpp"
+#include "cron_calc_array.hpp"
 
 // ----------------------------------------------------------------------------
 
-#ifndef CRON_CALC_NO_EXCEPT
-
-typedef std::list<cron_calc> CronCalcList;
+/**
+ * Cached next instant of one unit, an element of min-heap ordered by `next`.
+ * Heap contains only units, which have next instant.
+ */
+struct CronCalcEntry
+{
+    time_t next;
+    size_t unit;
+};
 
+/**
+ * Rules are stored as added, rule ID is the index in `mRules`.
+ * Search is done over units, each of them matches exactly the instants
+ * matched by any of its member rules. Until optimize() is called,
+ * every unit is a copy of one rule.
+ * Members of unit `i` are stored in `mMembers` starting at `mUnitFirst[i]`,
+ * in ascending order.
+ * Heap entries are kept in array of the same size as units, the heap itself
+ * takes first `mHeapSize` entries, units after it never match.
+ * Cached instants are valid for any time between `mAfter` and their `next`.
+ * After compile(), first units have compiled copies in `mCompiled`,
+ * which share time of day bitmaps owned by `mDayTimes`, and first
+ * `mIndexedRules` rules are in `mIndex`.
+ * Expressions are parsed by `mParser` if it is set, by cron_calc_parse() otherwise.
+ */
 class CronCalcImpl
 {
 public:
-    cron_calc_error push_back(const cron_calc& cc)
+    CronCalcImpl() : mAfter(0), mHeapSize(0), mValid(false), mIndex(NULL), mIndexedRules(0),
+        mParser(NULL), mParserContext(NULL)
     {
-        mList.push_back(cc);
-        return CRON_CALC_OK;
     }
 
-    typedef CronCalcList::iterator Iter;
-    typedef CronCalcList::const_iterator ConstIter;
+    ~CronCalcImpl()
+    {
+        clearCompiled();
+        cron_calc_index_free(mIndex);
+    }
 
-    ConstIter begin() const { return mList.begin(); }
-    ConstIter end() const { return mList.end(); }
+    void clearCompiled()
+    {
+        for (size_t i = 0; i < mDayTimes.size(); i++)
+        {
+            cron_calc_day_time_free(mDayTimes.data()[i]);
+        }
+        mDayTimes.resize(0);
+        mCompiled.resize(0);
+    }
 
-    CronCalcList mList;
+    time_t unitNext(size_t unit, time_t after) const
+    {
+        return unit < mCompiled.size()
+            ? cron_calc_compiled_next(&mCompiled.data()[unit], after)
+            : cron_calc_next(&mUnits.data()[unit], after);
+    }
+
+    size_t membersOf(size_t unit, const size_t** members) const
+    {
+        const size_t first = mUnitFirst.data()[unit];
+        const size_t last = unit + 1 < mUnitFirst.size() ? mUnitFirst.data()[unit + 1] : mMembers.size();
+        *members = mMembers.data() + first;
+        return last - first;
+    }
+
+    CronCalcArray<cron_calc> mRules;
+    CronCalcArray<cron_calc> mUnits;
+    CronCalcArray<size_t> mUnitFirst;
+    CronCalcArray<size_t> mMembers;
+    CronCalcArray<CronCalcEntry> mEntries;
+    CronCalcArray<cron_calc_compiled> mCompiled;
+    CronCalcArray<cron_calc_day_time*> mDayTimes;
+
+    time_t mAfter;      // the latest time cache was updated for
+    size_t mHeapSize;
+    bool mValid;
+
+    cron_calc_index* mIndex;
+    size_t mIndexedRules;
+
+    CronCalcParser mParser;
+    void* mParserContext;
 };
 
-#else // CRON_CALC_NO_EXCEPT
+// ----------------------------------------------------------------------------
 
-class CronCalcImpl
+static void siftUp(CronCalcEntry* heap, size_t pos)
 {
-    struct ListItem
+    const CronCalcEntry entry = heap[pos];
+    while (pos > 0)
     {
-        ListItem() : mNext(NULL)
-        {
-            memset(&mCc, 0, sizeof(cron_calc));
-        }
+        const size_t parent = (pos - 1) / 2;
+        if (heap[parent].next <= entry.next) break;
+        heap[pos] = heap[parent];
+        pos = parent;
+    }
+    heap[pos] = entry;
+}
 
-        cron_calc mCc;
-        ListItem* mNext;
-    };
+// ----------------------------------------------------------------------------
 
-public:
-    CronCalcImpl() : mHead(NULL)
+static void siftDown(CronCalcEntry* heap, size_t size, size_t pos)
+{
+    const CronCalcEntry entry = heap[pos];
+    for (;;)
     {
+        size_t child = 2 * pos + 1;
+        if (child >= size) break;
+        if (child + 1 < size && heap[child + 1].next < heap[child].next) child++;
+        if (entry.next <= heap[child].next) break;
+        heap[pos] = heap[child];
+        pos = child;
     }
+    heap[pos] = entry;
+}
 
-    ~CronCalcImpl()
+// ----------------------------------------------------------------------------
+
+// Removes entry from the heap, it stays in array after the heap end
+static void removeAt(CronCalcEntry* heap, size_t& size, size_t pos)
+{
+    std::swap(heap[pos], heap[--size]);
+    if (pos < size)
     {
-        for (ListItem* item = mHead; item != NULL; )
-        {
-            ListItem* next = item->mNext;
-            delete item;
-            item = next;
-        }
+        siftDown(heap, size, pos);
+        siftUp(heap, pos);
     }
+}
+
+// ----------------------------------------------------------------------------
 
-    cron_calc_error push_back(const cron_calc& cc)
+// Inserts ID into sorted buffer, which keeps the smallest IDs if capacity is not enough
+static void insertId(size_t id, size_t* ids, size_t capacity, size_t& count)
+{
+    const size_t filled = std::min(count, capacity);
+    if (filled < capacity || (filled > 0 && id < ids[filled - 1]))
     {
-        ListItem* item = new (std::nothrow) ListItem;
-        if (!item) return CRON_CALC_ERROR_OOM;
+        // insert, dropping the largest ID if buffer is full
+        size_t i = filled < capacity ? filled : filled - 1;
+        for (; i > 0 && ids[i - 1] > id; i--) ids[i] = ids[i - 1];
+        ids[i] = id;
+    }
+    count++;
+}
 
-        item->mCc = cc;
+// ----------------------------------------------------------------------------
 
-        if (!mHead)
+// Splits time instant into local calendar fields as localtime() does
+static bool splitLocal(time_t t, struct tm* local)
+{
+#if defined(_POSIX_C_SOURCE)
+    return localtime_r(&t, local) != NULL;
+#elif defined(_MSC_VER)
+    return localtime_s(local, &t) == 0;
+#else
+    const struct tm* res = localtime(&t);
+    if (res) *local = *res;
+    return res != NULL;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+
+// Collects IDs of rules of the unit firing at its next instant after `after`.
+// Members of merged units are checked by their masks against local time of the instant,
+// unless DST moved the instant off the unit's masks, then members are searched one by one.
+static void collectUnitIds(const CronCalcImpl& impl, size_t unit, time_t after, time_t next,
+                           size_t* ids, size_t capacity, size_t& count)
+{
+    const size_t* members = NULL;
+    const size_t numMembers = impl.membersOf(unit, &members);
+    if (numMembers == 1)
+    {
+        insertId(members[0], ids, capacity, count);
+        return;
+    }
+
+    struct tm local;
+    const bool split = splitLocal(next, &local) &&
+        cron_calc_matches_tm(&impl.mUnits.data()[unit], &local);
+    for (size_t i = 0; i < numMembers; i++)
+    {
+        const cron_calc* rule = &impl.mRules.data()[members[i]];
+        if (split ? cron_calc_matches_tm(rule, &local) : cron_calc_next(rule, after) == next)
         {
-            mHead = item;
+            insertId(members[i], ids, capacity, count);
         }
-        else
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+// Collects IDs of all rules firing at given next time, heap is traversed
+// only through entries with this time, which is minimum.
+static void collectIds(const CronCalcImpl& impl, size_t pos, time_t after, time_t next,
+                       size_t* ids, size_t capacity, size_t& count)
+{
+    const CronCalcEntry* heap = impl.mEntries.data();
+    if (pos >= impl.mHeapSize || heap[pos].next != next) return;
+
+    collectUnitIds(impl, heap[pos].unit, after, next, ids, capacity, count);
+    collectIds(impl, 2 * pos + 1, after, next, ids, capacity, count);
+    collectIds(impl, 2 * pos + 2, after, next, ids, capacity, count);
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Rule fields, which can be merged by optimize().
+ */
+
+enum CronCalcField
+{
+    FIELD_SECONDS,
+    FIELD_MINUTES,
+    FIELD_HOURS,
+    FIELD_DAYS,
+    FIELD_MONTHS,
+    FIELD_WEEKDAYS,
+    FIELD_YEARS,
+    FIELD_COUNT
+};
+
+static uint64_t getField(const cron_calc& cc, int field)
+{
+    switch (field)
+    {
+    case FIELD_SECONDS: return cc.seconds;
+    case FIELD_MINUTES: return cc.minutes;
+    case FIELD_HOURS: return cc.hours;
+    case FIELD_DAYS: return cc.days;
+    case FIELD_MONTHS: return cc.months;
+    case FIELD_WEEKDAYS: return cc.weekDays;
+    default: return cc.years;
+    }
+}
+
+static void mergeField(cron_calc& to, const cron_calc& from, int field)
+{
+    switch (field)
+    {
+    case FIELD_SECONDS: to.seconds |= from.seconds; break;
+    case FIELD_MINUTES: to.minutes |= from.minutes; break;
+    case FIELD_HOURS: to.hours |= from.hours; break;
+    case FIELD_DAYS: to.days |= from.days; break;
+    case FIELD_MONTHS: to.months |= from.months; break;
+    case FIELD_WEEKDAYS: to.weekDays |= from.weekDays; break;
+    default: to.years |= from.years; break;
+    }
+}
+
+// Orders units by options and all fields except one, so that mergeable units become adjacent
+struct CronCalcUnitLess
+{
+    CronCalcUnitLess(const cron_calc* units, int skip) : mUnits(units), mSkip(skip)
+    {
+    }
+
+    bool operator()(size_t left, size_t right) const
+    {
+        return compare(mUnits[left], mUnits[right]) < 0;
+    }
+
+    int compare(const cron_calc& left, const cron_calc& right) const
+    {
+        if (left.options != right.options) return left.options < right.options ? -1 : 1;
+        // years bitmaps are merged only if they start at the same year and have no progression after them
+        if (left.yearBase != right.yearBase) return left.yearBase < right.yearBase ? -1 : 1;
+        if (left.yearStep != right.yearStep) return left.yearStep < right.yearStep ? -1 : 1;
+        if (left.yearEnd != right.yearEnd) return left.yearEnd < right.yearEnd ? -1 : 1;
+        for (int field = 0; field < FIELD_COUNT; field++)
         {
-            ListItem* parent = mHead;
-            for (; parent->mNext != NULL; parent = parent->mNext);
-            parent->mNext = item;
+            if (field == mSkip && (field != FIELD_YEARS || !left.yearStep)) continue;
+            const uint64_t l = getField(left, field);
+            const uint64_t r = getField(right, field);
+            if (l != r) return l < r ? -1 : 1;
         }
-        return CRON_CALC_OK;
+        return 0;
     }
 
-    struct ConstIter
+    const cron_calc* mUnits;
+    int mSkip;
+};
+
+// Orders units by time fields, so that units sharing time of day bitmap become adjacent
+struct CronCalcTimeLess
+{
+    explicit CronCalcTimeLess(const cron_calc* units) : mUnits(units)
     {
-        ConstIter(ListItem* it) : item(it) {}
-        const cron_calc& operator*() const { return item->mCc; }
-        ConstIter& operator++() { item = item->mNext; return *this; }
-        bool operator!=(const ConstIter& rhs) const { return item != rhs.item; }
-    private:
-        ListItem* item;
-    };
+    }
 
-    ConstIter begin() const { return ConstIter(mHead); }
-    ConstIter end() const { return ConstIter(NULL); }
+    bool operator()(size_t left, size_t right) const
+    {
+        const cron_calc& l = mUnits[left];
+        const cron_calc& r = mUnits[right];
+        if (l.hours != r.hours) return l.hours < r.hours;
+        if (l.minutes != r.minutes) return l.minutes < r.minutes;
+        return l.seconds < r.seconds;
+    }
 
-private:
-    ListItem* mHead;
+    const cron_calc* mUnits;
 };
 
-#endif
-
 // ----------------------------------------------------------------------------
 
 CronCalc::CronCalc() :
@@ -133,13 +342,96 @@ CronCalc::~CronCalc()
 // ----------------------------------------------------------------------------
 
 cron_calc_error CronCalc::addRule(const char* expr, cron_calc_option_mask options, const char** err_location)
+{
+    cron_calc_error err = CRON_CALC_OK;
+    const cron_calc_error ret = addRules(&expr, 1, options, &err, err_location);
+    return ret == CRON_CALC_ERROR_OOM ? ret : err;
+}
+
+// ----------------------------------------------------------------------------
+
+cron_calc_error CronCalc::addRules(
+    const char* const* exprs,
+    size_t n,
+    cron_calc_option_mask options,
+    cron_calc_error* errors,
+    const char** err_locations)
 {
     RET_UNLESS_INIT(CRON_CALC_ERROR_OOM);
 
-    cron_calc cc;
-    cron_calc_error err = cron_calc_parse(&cc, expr, options, err_location);
+    CronCalcImpl& impl = *mPimpl;
+    const size_t oldSize = impl.mRules.size();
+    const size_t oldUnits = impl.mUnits.size();
+    const size_t oldMembers = impl.mMembers.size();
+
+    // new rules become units of their own, allocate everything before parsing
+    if (!impl.mRules.resize(oldSize + n) ||
+        !impl.mUnits.resize(oldUnits + n) ||
+        !impl.mUnitFirst.resize(oldUnits + n) ||
+        !impl.mMembers.resize(oldMembers + n) ||
+        !impl.mEntries.resize(oldUnits + n))
+    {
+        impl.mRules.resize(oldSize);
+        impl.mUnits.resize(oldUnits);
+        impl.mUnitFirst.resize(oldUnits);
+        impl.mMembers.resize(oldMembers);
+        impl.mEntries.resize(oldUnits);
+        return CRON_CALC_ERROR_OOM;
+    }
 
-    return err ? err : mPimpl->push_back(cc);
+    // parse directly into the storage, failed rules are overwritten by next ones
+    cron_calc_error ret = CRON_CALC_OK;
+    cron_calc* rules = impl.mRules.data();
+    size_t added = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        const char* err_location = NULL;
+        cron_calc* rule = &rules[oldSize + added];
+        const cron_calc_error err = impl.mParser
+            ? impl.mParser(rule, exprs[i], options, &err_location, impl.mParserContext)
+            : cron_calc_parse(rule, exprs[i], options, &err_location);
+        if (errors) errors[i] = err;
+        if (err_locations) err_locations[i] = err_location;
+
+        if (err)
+        {
+            if (!ret) ret = err;
+        }
+        else
+        {
+            added++;
+        }
+    }
+
+    impl.mRules.resize(oldSize + added);
+    impl.mUnits.resize(oldUnits + added);
+    impl.mUnitFirst.resize(oldUnits + added);
+    impl.mMembers.resize(oldMembers + added);
+    impl.mEntries.resize(oldUnits + added);
+
+    CronCalcEntry* entries = impl.mEntries.data();
+    size_t& heapSize = impl.mHeapSize;
+    for (size_t i = 0; i < added; i++)
+    {
+        const size_t unit = oldUnits + i;
+        impl.mUnits.data()[unit] = rules[oldSize + i];
+        impl.mUnitFirst.data()[unit] = oldMembers + i;
+        impl.mMembers.data()[oldMembers + i] = oldSize + i;
+
+        entries[unit].unit = unit;
+        entries[unit].next = CRON_CALC_INVALID_TIME;
+        if (impl.mValid)
+        {
+            // new entries are at the end of array, move them into the heap if they have next instant
+            entries[unit].next = impl.unitNext(unit, impl.mAfter);
+            if (entries[unit].next != CRON_CALC_INVALID_TIME)
+            {
+                std::swap(entries[unit], entries[heapSize]);
+                siftUp(entries, heapSize++);
+            }
+        }
+    }
+    return ret;
 }
 
 // ----------------------------------------------------------------------------
@@ -152,19 +444,339 @@ cron_calc_error CronCalc::addRule(const char* expr)
 
 // ----------------------------------------------------------------------------
 
+void CronCalc::setParser(CronCalcParser parser, void* context)
+{
+    if (!mPimpl) return;
+
+    mPimpl->mParser = parser;
+    mPimpl->mParserContext = context;
+}
+
+// ----------------------------------------------------------------------------
+
+cron_calc_error CronCalc::optimize()
+{
+    RET_UNLESS_INIT(CRON_CALC_ERROR_OOM);
+
+    CronCalcImpl& impl = *mPimpl;
+    const size_t numRules = impl.mRules.size();
+
+    CronCalcArray<cron_calc> units;
+    CronCalcArray<size_t> order;
+    CronCalcArray<size_t> owner;
+    CronCalcArray<size_t> unitFirst;
+    CronCalcArray<size_t> members;
+    CronCalcArray<CronCalcEntry> entries;
+    if (!units.resize(numRules) || !order.resize(numRules) || !owner.resize(numRules) ||
+        !unitFirst.resize(numRules) || !members.resize(numRules) || !entries.resize(numRules))
+    {
+        return CRON_CALC_ERROR_OOM;
+    }
+
+    // start over from single rules, so that repeated calls see rules added since the last one
+    for (size_t i = 0; i < numRules; i++)
+    {
+        units.data()[i] = impl.mRules.data()[i];
+        order.data()[i] = i;
+        owner.data()[i] = i;
+    }
+
+    // units, which equal in all fields but one, are merged by union of this field;
+    // duplicates are merged as well, repeat while anything is merged
+    size_t numUnits = numRules;
+    for (bool merged = true; merged && numUnits > 1; )
+    {
+        merged = false;
+        for (int field = 0; field < FIELD_COUNT; field++)
+        {
+            const CronCalcUnitLess less(units.data(), field);
+            size_t* alive = order.data();
+            std::sort(alive, alive + numUnits, less);
+
+            size_t kept = 0;
+            for (size_t i = 0; i < numUnits; i++)
+            {
+                if (kept > 0 && less.compare(units.data()[alive[kept - 1]], units.data()[alive[i]]) == 0)
+                {
+                    mergeField(units.data()[alive[kept - 1]], units.data()[alive[i]], field);
+                    owner.data()[alive[i]] = alive[kept - 1];
+                    merged = true;
+                }
+                else
+                {
+                    alive[kept++] = alive[i];
+                }
+            }
+            numUnits = kept;
+        }
+    }
+
+    // resolve owners to final units, numbered by their smallest member
+    size_t* own = owner.data();
+    size_t* index = order.data();   // reused, index of unit by its first rule
+    size_t count = 0;
+    for (size_t i = 0; i < numRules; i++)
+    {
+        size_t root = own[i];
+        while (own[root] != root) root = own[root];
+
+        if (root == i)
+        {
+            index[i] = count;
+            units.data()[count++] = units.data()[i];
+        }
+        own[i] = root;
+    }
+    for (size_t i = 0; i < numRules; i++)
+    {
+        own[i] = index[own[i]];
+    }
+
+    // counting sort of rules by unit keeps members in ascending order
+    size_t* first = unitFirst.data();
+    size_t* fill = order.data();    // reused, next free member slot of unit
+    for (size_t unit = 0; unit < count; unit++)
+    {
+        first[unit] = 0;
+        entries.data()[unit].next = CRON_CALC_INVALID_TIME;
+        entries.data()[unit].unit = unit;
+    }
+    for (size_t i = 0; i < numRules; i++)
+    {
+        first[own[i]]++;
+    }
+    for (size_t unit = 0, offset = 0; unit < count; unit++)
+    {
+        const size_t size = first[unit];
+        first[unit] = fill[unit] = offset;
+        offset += size;
+    }
+    for (size_t i = 0; i < numRules; i++)
+    {
+        members.data()[fill[own[i]]++] = i;
+    }
+
+    units.resize(count);
+    unitFirst.resize(count);
+    entries.resize(count);
+
+    impl.mUnits.swap(units);
+    impl.mUnitFirst.swap(unitFirst);
+    impl.mMembers.swap(members);
+    impl.mEntries.swap(entries);
+    impl.mHeapSize = 0;
+    impl.mValid = false;
+    impl.clearCompiled();
+    return CRON_CALC_OK;
+}
+
+// ----------------------------------------------------------------------------
+
+cron_calc_error CronCalc::compile()
+{
+    RET_UNLESS_INIT(CRON_CALC_ERROR_OOM);
+
+    CronCalcImpl& impl = *mPimpl;
+    const size_t numUnits = impl.mUnits.size();
+    const cron_calc* units = impl.mUnits.data();
+
+    CronCalcArray<cron_calc_compiled> compiled;
+    CronCalcArray<cron_calc_day_time*> dayTimes;
+    CronCalcArray<size_t> order;
+    cron_calc_index* index = NULL;
+    if (!compiled.resize(numUnits) || !dayTimes.resize(numUnits) || !order.resize(numUnits) ||
+        cron_calc_index_create(&index, impl.mRules.data(), impl.mRules.size()) != CRON_CALC_OK)
+    {
+        return CRON_CALC_ERROR_OOM;
+    }
+
+    for (size_t i = 0; i < numUnits; i++)
+    {
+        cron_calc_compile(&compiled.data()[i], &units[i]);
+        order.data()[i] = i;
+    }
+
+    // units with the same time fields become adjacent and share one bitmap
+    const CronCalcTimeLess less(units);
+    std::sort(order.data(), order.data() + numUnits, less);
+
+    size_t numDayTimes = 0;
+    bool failed = false;
+    for (size_t i = 0; i < numUnits; i++)
+    {
+        const size_t unit = order.data()[i];
+        if (i == 0 || less(order.data()[i - 1], unit))
+        {
+            failed = cron_calc_day_time_create(&dayTimes.data()[numDayTimes], &units[unit]) != CRON_CALC_OK;
+            if (failed) break;
+            numDayTimes++;
+        }
+        cron_calc_compiled_set_day_time(&compiled.data()[unit], dayTimes.data()[numDayTimes - 1]);
+    }
+
+    if (failed)
+    {
+        // compiled state stays as it was
+        for (size_t i = 0; i < numDayTimes; i++)
+        {
+            cron_calc_day_time_free(dayTimes.data()[i]);
+        }
+        cron_calc_index_free(index);
+        return CRON_CALC_ERROR_OOM;
+    }
+    dayTimes.resize(numDayTimes);
+
+    impl.clearCompiled();
+    impl.mCompiled.swap(compiled);
+    impl.mDayTimes.swap(dayTimes);
+    cron_calc_index_free(impl.mIndex);
+    impl.mIndex = index;
+    impl.mIndexedRules = impl.mRules.size();
+    return CRON_CALC_OK;
+}
+
+// ----------------------------------------------------------------------------
+
+cron_calc_error CronCalc::match(time_t at, size_t* ids, size_t capacity, size_t* count) const
+{
+    if (count) *count = 0;
+
+    RET_UNLESS_INIT(CRON_CALC_ERROR_OOM);
+
+    if (!count || (!ids && capacity))
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    const CronCalcImpl& impl = *mPimpl;
+    size_t first = 0;
+    if (impl.mIndex)
+    {
+        const cron_calc_error err = cron_calc_index_query(impl.mIndex, at, ids, capacity, count);
+        if (err) return err;
+        first = impl.mIndexedRules;
+    }
+
+    // rules added after compile() are checked one by one, their IDs are greater
+    for (size_t id = first; id < impl.mRules.size(); id++)
+    {
+        if (cron_calc_matches(&impl.mRules.data()[id], at))
+        {
+            if (*count < capacity) ids[*count] = id;
+            ++*count;
+        }
+    }
+    return CRON_CALC_OK;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t CronCalc::size() const
+{
+    RET_UNLESS_INIT(0);
+
+    return mPimpl->mRules.size();
+}
+
+// ----------------------------------------------------------------------------
+
 time_t CronCalc::next(time_t after) const
 {
+    return next(after, NULL, 0, NULL);
+}
+
+// ----------------------------------------------------------------------------
+
+time_t CronCalc::next(time_t after, size_t* ids, size_t capacity, size_t* count) const
+{
+    if (count) *count = 0;
+
     RET_UNLESS_INIT(CRON_CALC_INVALID_TIME);
 
+    const CronCalcImpl& impl = *mPimpl;
     time_t earliest = CRON_CALC_INVALID_TIME;
-    for (CronCalcImpl::ConstIter iter = mPimpl->begin(); iter != mPimpl->end(); ++iter)
+    for (size_t unit = 0; unit < impl.mUnits.size(); unit++)
     {
-        time_t next = cron_calc_next(&(*iter), after);
-        if (next != CRON_CALC_INVALID_TIME &&
-           (earliest == CRON_CALC_INVALID_TIME || next < earliest))
+        const time_t next = impl.unitNext(unit, after);
+        if (next == CRON_CALC_INVALID_TIME ||
+           (earliest != CRON_CALC_INVALID_TIME && next > earliest))
+        {
+            continue;
+        }
+        if (next != earliest)
         {
+            // IDs collected so far are of a later instant
             earliest = next;
+            if (count) *count = 0;
+        }
+        if (count)
+        {
+            collectUnitIds(impl, unit, after, next, ids, ids ? capacity : 0, *count);
         }
     }
     return earliest;
 }
+
+// ----------------------------------------------------------------------------
+
+time_t CronCalc::nextCached(time_t after)
+{
+    return nextCached(after, NULL, 0, NULL);
+}
+
+// ----------------------------------------------------------------------------
+
+time_t CronCalc::nextCached(time_t after, size_t* ids, size_t capacity, size_t* count)
+{
+    if (count) *count = 0;
+
+    RET_UNLESS_INIT(CRON_CALC_INVALID_TIME);
+
+    CronCalcImpl& impl = *mPimpl;
+    CronCalcEntry* heap = impl.mEntries.data();
+    size_t& heapSize = impl.mHeapSize;
+
+    if (!impl.mValid || after < impl.mAfter)
+    {
+        // cached instants may be not the earliest ones after this time, rebuild all
+        heapSize = 0;
+        for (size_t i = 0; i < impl.mEntries.size(); i++)
+        {
+            heap[i].next = impl.unitNext(heap[i].unit, after);
+            if (heap[i].next != CRON_CALC_INVALID_TIME)
+            {
+                std::swap(heap[i], heap[heapSize]);
+                siftUp(heap, heapSize++);
+            }
+        }
+        impl.mValid = true;
+    }
+    else
+    {
+        // only units, which fired already, need to be recalculated
+        while (heapSize > 0 && heap[0].next <= after)
+        {
+            heap[0].next = impl.unitNext(heap[0].unit, after);
+            if (heap[0].next == CRON_CALC_INVALID_TIME)
+            {
+                removeAt(heap, heapSize, 0);
+            }
+            else
+            {
+                siftDown(heap, heapSize, 0);
+            }
+        }
+    }
+    impl.mAfter = after;
+
+    if (heapSize == 0)
+    {
+        return CRON_CALC_INVALID_TIME;
+    }
+
+    if (count)
+    {
+        collectIds(impl, 0, after, heap[0].next, ids, ids ? capacity : 0, *count);
+    }
+    return heap[0].next;
+}
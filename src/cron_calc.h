@@ -9,6 +9,7 @@
 #define CRON_CALC_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -36,7 +37,7 @@ typedef uint8_t cron_calc_option_mask;
 
 typedef struct cron_calc
 {
-    uint64_t years;
+    uint64_t years;     /* 64 consecutive years starting at 1970 + yearBase */
     uint64_t seconds;
     uint64_t minutes;
     uint32_t hours;
@@ -44,8 +45,56 @@ typedef struct cron_calc
     uint16_t months;
     uint8_t weekDays;
     cron_calc_option_mask options;
+    /* Years after those in `years` bitmap continue arithmetic progression
+     * from its last year with step yearStep up to 1970 + yearEnd,
+     * there are no such years if yearStep is 0. */
+    uint8_t yearBase;
+    uint8_t yearStep;
+    uint8_t yearEnd;
+    /* Index of search specialized for options and day fields, set by cron_calc_parse(),
+     * 0 selects generic search. Otherwise the specialized search is chosen again
+     * from current fields on every search, so changing them manually is safe:
+     * fields no kernel handles, e.g. seconds without CRON_CALC_OPT_WITH_SECONDS,
+     * select generic search. */
+    uint8_t kernel;
 } cron_calc;
 
+/**
+ * Bitmap of times of day matching hours, minutes and seconds of a rule,
+ * see cron_calc_day_time_create(). It is immutable once created,
+ * so it can be shared between threads and between rules with the same time fields.
+ */
+typedef struct cron_calc_day_time cron_calc_day_time;
+
+/**
+ * Rule with data precomputed for faster search, see cron_calc_compile().
+ * All fields are private.
+ */
+typedef struct cron_calc_compiled
+{
+    cron_calc rule;
+    uint64_t masks[6];
+    uint32_t days[4][7]; /* matching days of month by its length 28..31 and week day of its first day */
+    const cron_calc_day_time* day_time; /* not owned, see cron_calc_compiled_set_day_time() */
+} cron_calc_compiled;
+
+/**
+ * State of incremental search, which allows to find consecutive matching instants
+ * without repeating full search for each of them. See cron_calc_cursor_init().
+ * All fields are private.
+ */
+typedef struct cron_calc_cursor
+{
+    cron_calc rule;
+    uint64_t masks[6];
+    struct tm tm_val;
+    time_t current;
+    time_t day_start;
+    int day_year;
+    int day_month;
+    int day_mday;
+} cron_calc_cursor;
+
 typedef enum cron_calc_error
 {
     CRON_CALC_OK = 0,                       /*!< Success */
@@ -57,13 +106,23 @@ typedef enum cron_calc_error
     CRON_CALC_ERROR_INVALID_NAME = 6,       /*!< Unknown value name detected */
     CRON_CALC_ERROR_NUMBER_EXPECTED = 7,    /*!< Number could not be parsed */
     CRON_CALC_ERROR_IMPOSSIBLE_DATE = 8,    /*!< Date specified in expression never matches, e.g. Nov-31 or 2001-Feb-29 */
-    CRON_CALC_ERROR_OOM = 9                 /*!< Out-of-memory. This error may only be returned
+    CRON_CALC_ERROR_OOM = 9,                /*!< Out-of-memory. This error may only be returned
                                                  by C++ interface (CronCalc) if this library
-                                                 is compiled with exceptions disabled. */
+                                                 is compiled with exceptions disabled,
+                                                 or by functions allocating time zone objects. */
+    CRON_CALC_ERROR_TZ_DATA = 10            /*!< Time zone data could not be read or is malformed */
 } cron_calc_error;
 
+/**
+ * Time zone object, which allows to calculate time instants in arbitrary time zone.
+ * It is immutable once loaded, so it can be shared between threads without locking.
+ */
+typedef struct cron_calc_tz cron_calc_tz;
+
 #define CRON_CALC_INVALID_TIME ((time_t) -1) /* as defined in mktime() */
 
+#define CRON_CALC_INVALID_OFFSET ((size_t) -1) /* no error location, see cron_calc_parse_n() */
+
 /**
  * Supported format:
  *  [<seconds> SP] <minutes> SP <hours> SP <days> SP <months> SP <week days> [SP <years>]
@@ -78,7 +137,11 @@ typedef enum cron_calc_error
  *  <days>      : 1-31 or L
  *  <months>    : 1-12 or JAN through DEC
  *  <week days> : 0-7 or SUN through SAT; 0 and 7 == SUN
- *  <years>     : 2000-2063     CRON_CALC_OPT_WITH_YEARS must be set in options
+ *  <years>     : 1970-2199     CRON_CALC_OPT_WITH_YEARS must be set in options
+ *
+ * Years allowed by the rule must fit into 64 consecutive years, although
+ * the later ones may continue arithmetic progression of years after these 64,
+ * e.g. 2020,2030-2199/10. CRON_CALC_ERROR_NUMBER_RANGE is returned otherwise.
  *
  * Step is allowed only after range (i.e. * or x-y). It must be > 0.
  * Value names are also allowed in ranges (e.g. MON-WED), even mixed (0-TUE).
@@ -100,6 +163,28 @@ typedef enum cron_calc_error
  */
 cron_calc_error cron_calc_parse(cron_calc* self, const char* expr, cron_calc_option_mask options, const char** err_location);
 
+/**
+ * Same as cron_calc_parse(), but expression is given by its length, so that it can be
+ * parsed in place, e.g. from a line of memory-mapped file, without copying.
+ * Nothing is read at or after `len`. Parsing stops at NUL character before `len` as well,
+ * and trailing spaces, including line terminators, are accepted after the last field.
+ *
+ * @param self The object to store parsed Cron rule
+ * @param expr Cron expression, not necessarily NULL-terminated.
+ * @param len Length of the expression in bytes.
+ * @param options Parsing options
+ * @param[out] err_offset If not NULL, receives offset of the first character in the expression,
+ *                        where parsing error occured, or offset of its end if it ended too early.
+ *                        CRON_CALC_INVALID_OFFSET on success or if arguments are invalid.
+ * @see cron_calc_parse() for details on format and return values.
+ */
+cron_calc_error cron_calc_parse_n(
+    cron_calc* self,
+    const char* expr,
+    size_t len,
+    cron_calc_option_mask options,
+    size_t* err_offset);
+
 /**
  * Calculates next time instant with regards to given reference time.
  * This function takes reference time from given `struct tm` object and updates it
@@ -122,6 +207,287 @@ cron_calc_error cron_calc_parse(cron_calc* self, const char* expr, cron_calc_opt
  */
 time_t cron_calc_next(const cron_calc* self, time_t after);
 
+/**
+ * Calculates previous time instant with regards to given reference time,
+ * i.e. the latest instant before it, which matches the rule.
+ * This is a reverse of cron_calc_next(), so the same rules apply to arguments.
+ * Local times repeated by backward DST transition match at their latest instant before `before`.
+ *
+ * @param self The cron_calc object, initialized by successful cron_calc_parse() call.
+ *             Must not be NULL.
+ * @param before Time instant to start search before. Even if it matches the rule,
+ *               it will not be returned, only some moment before it.
+ * @return Previous time instant, or CRON_CALC_INVALID_TIME if arguments are invalid
+ *         or there is no such instant.
+ */
+time_t cron_calc_prev(const cron_calc* self, time_t before);
+
+/**
+ * Prepares the rule for repeated searches with cron_calc_compiled_next().
+ * Days of month matching both day-of-month and day-of-week fields are precomputed
+ * for all month lengths and week days of the first day of month, so that search
+ * finds matching day of month by a table lookup and a bit scan.
+ * Copy of the rule is kept in compiled object, so it can be released after this call.
+ *
+ * @param self Object to initialize. Must not be NULL.
+ * @param rule The cron_calc object, initialized by successful cron_calc_parse() call.
+ * @return CRON_CALC_OK on success
+ * @return CRON_CALC_ERROR_ARGUMENT if one or more arguments invalid.
+ */
+cron_calc_error cron_calc_compile(cron_calc_compiled* self, const cron_calc* rule);
+
+/**
+ * Same as cron_calc_next() for the rule given to cron_calc_compile().
+ *
+ * @param self Object initialized by successful cron_calc_compile() call.
+ * @see cron_calc_next() for details on other arguments and return values.
+ */
+time_t cron_calc_compiled_next(const cron_calc_compiled* self, time_t after);
+
+/**
+ * Builds bitmap of times of day matching hours, minutes and seconds fields of the rule,
+ * so that search within a day is a scan of bitmap words, where empty words
+ * are skipped by a summary bitmap. Bitmap has a bit per second of day (10800 bytes),
+ * or a bit per minute of day if the rule matches only 0th second (180 bytes).
+ *
+ * @param[out] day_time Receives created object, which must be freed with cron_calc_day_time_free()
+ * @param rule The cron_calc object, initialized by successful cron_calc_parse() call.
+ * @return CRON_CALC_OK on success
+ * @return CRON_CALC_ERROR_OOM if memory allocation failed
+ * @return CRON_CALC_ERROR_ARGUMENT if one or more arguments invalid.
+ */
+cron_calc_error cron_calc_day_time_create(cron_calc_day_time** day_time, const cron_calc* rule);
+
+/**
+ * Frees object created by cron_calc_day_time_create().
+ * NULL is allowed.
+ */
+void cron_calc_day_time_free(cron_calc_day_time* day_time);
+
+/**
+ * Attaches time of day bitmap to compiled rule, so that cron_calc_compiled_next()
+ * uses it for search within a day. Bitmap is not copied, it must outlive
+ * the compiled rule or be detached. The same bitmap may be attached to any number
+ * of rules with the same hours, minutes and seconds fields.
+ *
+ * @param self Object initialized by successful cron_calc_compile() call.
+ * @param day_time Bitmap created for a rule with the same hours, minutes and seconds fields,
+ *                 or NULL to detach current one.
+ * @return CRON_CALC_OK on success
+ * @return CRON_CALC_ERROR_ARGUMENT if one or more arguments invalid,
+ *         or bitmap was built for different time fields.
+ */
+cron_calc_error cron_calc_compiled_set_day_time(cron_calc_compiled* self, const cron_calc_day_time* day_time);
+
+/**
+ * Finds all time instants matching the rule within given time range.
+ * Result is the same as of calling cron_calc_next() in a loop, but search is done
+ * with cron_calc_cursor, so libc time functions are called only few times per day.
+ *
+ * @param self The cron_calc object, initialized by successful cron_calc_parse() call.
+ * @param from Start of the range, inclusive.
+ * @param to End of the range, exclusive.
+ * @param[out] out Buffer for found time instants, in ascending order.
+ * @param capacity Size of the buffer in elements.
+ *                 Search stops when buffer is full, even if end of range is not reached,
+ *                 it can be continued from the instant following the last found one.
+ * @param[out] count Number of instants written to the buffer.
+ * @return CRON_CALC_OK on success, even if nothing was found
+ * @return CRON_CALC_ERROR_ARGUMENT if one or more arguments invalid.
+ */
+cron_calc_error cron_calc_enumerate(
+    const cron_calc* self,
+    time_t from,
+    time_t to,
+    time_t* out,
+    size_t capacity,
+    size_t* count);
+
+/**
+ * Checks whether the rule matches given time instant, i.e. its local calendar fields
+ * match all fields of the rule. Only time splitting is done, there is no search.
+ * Result equals to `cron_calc_next(self, t - 1) == t` except local times skipped
+ * or repeated by DST transitions, which cron_calc_next() moves to other instants.
+ *
+ * @param self The cron_calc object, initialized by successful cron_calc_parse() call.
+ * @param t Time instant to check.
+ * @return Whether the rule matches, false also if arguments are invalid.
+ */
+bool cron_calc_matches(const cron_calc* self, time_t t);
+
+/**
+ * Same as cron_calc_matches() for local time already split into fields by localtime(),
+ * so that one instant is split once for many rules. Unlike cron_calc_matches(),
+ * local time is given, so DST transitions play no role.
+ *
+ * @param self The cron_calc object, initialized by successful cron_calc_parse() call.
+ * @param local Local time with fields as set by localtime(): years since 1900, months 0-11.
+ * @return Whether the rule matches, false also if arguments are invalid.
+ */
+bool cron_calc_matches_tm(const cron_calc* self, const struct tm* local);
+
+/**
+ * Same as cron_calc_matches() for an array of time instants.
+ * Instants are split incrementally: local date is found and checked once per day,
+ * and instants within this day are checked without libc calls. It works with
+ * any order of instants, but is fastest if they are sorted.
+ *
+ * @param self The cron_calc object, initialized by successful cron_calc_parse() call.
+ * @param ts Array of `n` time instants.
+ * @param n Number of instants.
+ * @param[out] out Array of `n` elements, receives 1 for matching instants and 0 for others.
+ * @return CRON_CALC_OK on success
+ * @return CRON_CALC_ERROR_ARGUMENT if one or more arguments invalid.
+ */
+cron_calc_error cron_calc_filter(const cron_calc* self, const time_t* ts, size_t n, uint8_t* out);
+
+/**
+ * Counts time instants matching the rule within given time range.
+ * Result is the same as number of instants found by cron_calc_enumerate(), but they are
+ * not searched one by one: matching days are found once per day, and instants within
+ * a day are counted from number of bits in hours, minutes and seconds fields.
+ * Only hours around DST transitions are searched instant by instant.
+ *
+ * @param self The cron_calc object, initialized by successful cron_calc_parse() call.
+ * @param from Start of the range, inclusive.
+ * @param to End of the range, exclusive.
+ * @param[out] count Number of matching instants.
+ * @return CRON_CALC_OK on success, even if nothing was found
+ * @return CRON_CALC_ERROR_ARGUMENT if one or more arguments invalid.
+ */
+cron_calc_error cron_calc_count(const cron_calc* self, time_t from, time_t to, uint64_t* count);
+
+/**
+ * Inverted index of a rule set, which finds all rules matching given instant
+ * without checking them one by one, see cron_calc_index_create().
+ * It is immutable once created, so it can be shared between threads without locking.
+ */
+typedef struct cron_calc_index cron_calc_index;
+
+/**
+ * Builds index of rules, where each value of each field (second, minute, hour,
+ * day of month, month, week day and year) has a bitset of rules allowing this value.
+ * Query combines bitsets of the instant's field values with bitwise operations,
+ * vectorized with AVX2 or SSE2 if compiler targets them.
+ * Index takes about 430 bits per rule.
+ *
+ * @param[out] index Receives created object, which must be freed with cron_calc_index_free()
+ * @param rules Array of `n` cron_calc objects, initialized by successful cron_calc_parse() calls.
+ *              Rule IDs reported by cron_calc_index_query() are indexes in this array.
+ * @param n Number of rules.
+ * @return CRON_CALC_OK on success
+ * @return CRON_CALC_ERROR_OOM if memory allocation failed
+ * @return CRON_CALC_ERROR_ARGUMENT if one or more arguments invalid.
+ */
+cron_calc_error cron_calc_index_create(cron_calc_index** index, const cron_calc* rules, size_t n);
+
+/**
+ * Frees object created by cron_calc_index_create().
+ * NULL is allowed.
+ */
+void cron_calc_index_free(cron_calc_index* index);
+
+/**
+ * Finds all indexed rules matching given time instant, i.e. those,
+ * for which cron_calc_matches() returns true.
+ *
+ * @param index Index created by cron_calc_index_create().
+ * @param t Time instant to check.
+ * @param[out] ids Buffer for IDs of matching rules, in ascending order. May be NULL if capacity is 0.
+ * @param capacity Size of the buffer in elements.
+ * @param[out] count Number of matching rules, which may exceed capacity,
+ *                   then only first `capacity` IDs are written.
+ * @return CRON_CALC_OK on success, even if nothing matches
+ * @return CRON_CALC_ERROR_ARGUMENT if one or more arguments invalid.
+ */
+cron_calc_error cron_calc_index_query(
+    const cron_calc_index* index,
+    time_t t,
+    size_t* ids,
+    size_t capacity,
+    size_t* count);
+
+/**
+ * Starts incremental search for consecutive time instants matching the rule.
+ * Copy of the rule is kept in the cursor, so it can be released after this call.
+ *
+ * @param cursor Cursor object to initialize. Must not be NULL.
+ * @param rule The cron_calc object, initialized by successful cron_calc_parse() call.
+ * @param after Time instant to start search after.
+ * @return The first matching instant, same as cron_calc_next() returns,
+ *         or CRON_CALC_INVALID_TIME if arguments are invalid or no match found.
+ */
+time_t cron_calc_cursor_init(cron_calc_cursor* cursor, const cron_calc* rule, time_t after);
+
+/**
+ * Finds next time instant after the last one found by this cursor.
+ * Result is the same as of cron_calc_next() for the last found instant.
+ * Search continues from calendar state of the last match, so within a day
+ * only the lowest changing fields are advanced, without any libc time functions called.
+ *
+ * @param cursor Cursor initialized by cron_calc_cursor_init().
+ * @return Next matching instant or CRON_CALC_INVALID_TIME if no more matches.
+ */
+time_t cron_calc_cursor_advance(cron_calc_cursor* cursor);
+
+/**
+ * Same as cron_calc_next(), but calculates in UTC instead of local time zone.
+ * The rule is matched against UTC calendar time, which is computed arithmetically,
+ * so no libc time functions (and no global time zone state) are involved.
+ *
+ * @see cron_calc_next() for details on arguments and return values.
+ */
+time_t cron_calc_next_utc(const cron_calc* self, time_t after);
+
+/**
+ * Same as cron_calc_next_utc(), but calculates in a time zone with fixed offset from UTC.
+ *
+ * @param utc_offset Offset of the time zone in seconds east of UTC (e.g. 3600 for UTC+01:00).
+ *                   Must be within one day in either direction.
+ * @see cron_calc_next() for details on other arguments and return values.
+ */
+time_t cron_calc_next_offset(const cron_calc* self, time_t after, int32_t utc_offset);
+
+/**
+ * Loads time zone from TZif file (see RFC 8536), e.g. from system time zone database.
+ * All transitions are read into memory, as well as POSIX TZ rule from the file footer,
+ * which is applied to time instants after the last transition.
+ *
+ * @param[out] tz Receives loaded object, which must be freed with cron_calc_tz_free()
+ * @param name Time zone name relative to CRON_CALC_TZ_DIR (/usr/share/zoneinfo
+ *             by default), e.g. "Europe/Berlin", or absolute path to TZif file.
+ *             Names containing ".." are rejected.
+ * @return CRON_CALC_OK on success
+ * @return CRON_CALC_ERROR_TZ_DATA if file could not be read or has invalid format
+ * @return CRON_CALC_ERROR_OOM if memory allocation failed
+ * @return CRON_CALC_ERROR_ARGUMENT if one or more arguments invalid.
+ */
+cron_calc_error cron_calc_tz_load(cron_calc_tz** tz, const char* name);
+
+/**
+ * Same as cron_calc_tz_load(), but takes TZif data from memory buffer.
+ */
+cron_calc_error cron_calc_tz_parse(cron_calc_tz** tz, const void* data, size_t size);
+
+/**
+ * Frees time zone object loaded by cron_calc_tz_load() or cron_calc_tz_parse().
+ * NULL is allowed.
+ */
+void cron_calc_tz_free(cron_calc_tz* tz);
+
+/**
+ * Same as cron_calc_next(), but calculates in given time zone instead of local one.
+ * Local times skipped by forward DST transition are handled like mktime() does,
+ * i.e. moved forward by the transition size. Local times repeated by backward
+ * transition match at their earliest instant after `after`.
+ * UTC offset lookup is a binary search in loaded transitions, no global state is used,
+ * so this function is thread-safe.
+ *
+ * @param tz Time zone loaded by cron_calc_tz_load(). Must not be NULL.
+ * @see cron_calc_next() for details on other arguments and return values.
+ */
+time_t cron_calc_next_tz(const cron_calc* self, const cron_calc_tz* tz, time_t after);
+
 /**
  * Utility function, compares two initialized `cron_calc` objects.
  * @return Whether given objects are same.
@@ -129,6 +495,44 @@ time_t cron_calc_next(const cron_calc* self, time_t after);
  */
 bool cron_calc_is_same(const cron_calc* left, const cron_calc* right);
 
+#ifdef CRON_CALC_WITH_STATS
+
+/* Levels of search in cron_calc_stats::level_iterations */
+#define CRON_CALC_STATS_LEVELS 6 /* years, months, days, hours, minutes, seconds */
+
+/**
+ * Search cost counters, available if library is built with CRON_CALC_WITH_STATS.
+ * Counters are kept per thread. Search calls are cron_calc_next(), cron_calc_compiled_next(),
+ * cron_calc_next_utc(), cron_calc_next_offset(), cron_calc_next_tz() and cron_calc_prev(),
+ * work of other functions (e.g. cursors) is added to the last call and to totals.
+ */
+typedef struct cron_calc_stats
+{
+    uint64_t calls;                 /* search calls, 1 in stats of the last call */
+    uint64_t max_depth;             /* deepest level search descended to, 1 for years to 6 for seconds */
+    uint64_t level_iterations[CRON_CALC_STATS_LEVELS]; /* values tried on each level */
+    uint64_t years_scanned;         /* years visited by year search, including skipped ones */
+    uint64_t week_day_calls;        /* week day calculations */
+    uint64_t time_conversions;      /* calls of libc localtime_r() and mktime() */
+    uint64_t time_conversion_ns;    /* time spent in them */
+} cron_calc_stats;
+
+/**
+ * Reads search cost counters of calling thread.
+ *
+ * @param[out] last Counters of the last search call, may be NULL.
+ * @param[out] total Counters summed over all calls since cron_calc_stats_reset(),
+ *                   max_depth is the maximum of all calls. May be NULL.
+ */
+void cron_calc_stats_get(cron_calc_stats* last, cron_calc_stats* total);
+
+/**
+ * Clears search cost counters of calling thread.
+ */
+void cron_calc_stats_reset(void);
+
+#endif
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
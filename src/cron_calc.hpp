@@ -10,6 +10,19 @@
 
 class CronCalcImpl;
 
+/**
+ * Parses Cron expression for CronCalc::addRule(), see CronCalc::setParser().
+ *
+ * @param context Context pointer given to CronCalc::setParser().
+ * @see cron_calc_parse() for details on other arguments and return values.
+ */
+typedef cron_calc_error (*CronCalcParser)(
+    cron_calc* self,
+    const char* expr,
+    cron_calc_option_mask options,
+    const char** err_location,
+    void* context);
+
 /**
  * C++ wrapper interface for cron_calc C API
  */
@@ -33,15 +46,128 @@ public:
      */
     cron_calc_error addRule(const char* expr);
 
+    /**
+     * Adds a batch of Cron expressions to this container, storage is allocated once.
+     * Valid expressions are added in given order, invalid ones are skipped.
+     *
+     * @param exprs Array of `n` Cron expressions.
+     * @param n Number of expressions.
+     * @param options Options applied to all expressions.
+     * @param[out] errors Optional array of `n` elements for parsing result of each expression.
+     * @param[out] err_locations Optional array of `n` elements for error location in each expression,
+     *                           NULL for valid ones.
+     * @return CRON_CALC_OK If all expressions are added.
+     * @return CRON_CALC_ERROR_OOM If storage can't be allocated, then nothing is added.
+     * @return The first parsing error otherwise.
+     * @see cron_calc_parse() for details on parsing errors.
+     */
+    cron_calc_error addRules(
+        const char* const* exprs,
+        size_t n,
+        cron_calc_option_mask options,
+        cron_calc_error* errors,
+        const char** err_locations);
+
+    /**
+     * Replaces cron_calc_parse() called by addRule() and addRules(), e.g. with
+     * CronCalcCache::parser, which returns cached results of repeated expressions.
+     *
+     * @param parser Function to parse expressions, NULL restores cron_calc_parse().
+     * @param context Pointer passed to parser as is.
+     */
+    void setParser(CronCalcParser parser, void* context);
+
+    /**
+     * Reduces number of rules evaluated by next(), without changing its results.
+     * Duplicate rules are collapsed, and rules with same options differing in exactly
+     * one field are merged into one rule with union of this field.
+     * Rule IDs stay the same, rules firing at returned instant are still reported individually.
+     * Rules added after this call are evaluated separately until it is called again.
+     *
+     * @return CRON_CALC_OK On success.
+     * @return CRON_CALC_ERROR_OOM If temporary storage can't be allocated, rules stay as they were.
+     */
+    cron_calc_error optimize();
+
+    /**
+     * Precomputes search data of all rules, see cron_calc_compile() and cron_calc_day_time_create().
+     * Rules with the same hours, minutes and seconds fields share one time of day bitmap.
+     * Also builds index of rules used by match(), see cron_calc_index_create().
+     * Results of next() stay the same, rules added after this call are evaluated without
+     * precomputed data until it is called again. optimize() discards precomputed data.
+     *
+     * @return CRON_CALC_OK On success.
+     * @return CRON_CALC_ERROR_OOM If storage can't be allocated, precomputed data stays as it was.
+     */
+    cron_calc_error compile();
+
+    /**
+     * Finds rules, which match given time instant, see cron_calc_matches().
+     * Rules indexed by compile() are found by cron_calc_index_query(),
+     * rules added after it are checked one by one.
+     *
+     * @param at Time instant to check.
+     * @param[out] ids Buffer for IDs of matching rules, in ascending order. May be NULL if capacity is 0.
+     * @param capacity Size of the buffer in elements.
+     * @param[out] count Number of matching rules, which may exceed capacity,
+     *                   then only first `capacity` IDs are written.
+     * @return CRON_CALC_OK On success, even if nothing matches.
+     * @return CRON_CALC_ERROR_ARGUMENT If arguments are invalid.
+     */
+    cron_calc_error match(time_t at, size_t* ids, size_t capacity, size_t* count) const;
+
+    /**
+     * @return Number of rules added so far.
+     *         Rules are identified by their index in order of successful addition.
+     */
+    size_t size() const;
+
     /**
      * Calculates next time instant with regards to given reference time.
      * Checks all rules added with addRule() and picks the earliest matching time.
      * If no rules have been added so far, CRON_CALC_INVALID_TIME.
+     *
+     * All rules are evaluated on every call and no state is changed, so concurrent calls
+     * of const methods on the same object are safe. See nextCached() for faster search,
+     * when the object is not shared.
+     *
      * @see cron_calc_next() for details on arguments and return values.
      * @return CRON_CALC_INVALID_TIME Also if no rules have been added yet.
      */
     time_t next(time_t after) const;
 
+    /**
+     * Same as next(time_t), but also reports which rules fire at returned instant.
+     *
+     * @param[out] ids Buffer for IDs of the rules firing at returned instant,
+     *                 in ascending order. May be NULL if capacity is 0.
+     * @param capacity Size of the buffer in elements.
+     * @param[out] count Number of the rules firing at returned instant,
+     *                   which may exceed capacity, then only first `capacity` IDs
+     *                   are written. May be NULL.
+     */
+    time_t next(time_t after, size_t* ids, size_t capacity, size_t* count) const;
+
+    /**
+     * Same as next(time_t), but next instant of each rule is cached in a min-heap,
+     * so that only rules, which fired at or before `after`, are recalculated.
+     * Calls with non-decreasing `after` are cheapest, going back in time recalculates all rules.
+     * Like other non-const methods, it must not be called concurrently with any other method
+     * on the same object.
+     *
+     * Cached instant of a rule stays valid until `after` passes it. Near DST transitions,
+     * where cron_calc_next() moves skipped local times to other instants, it may differ
+     * from the instant next(time_t) finds for the same `after`: e.g. 02:30 of a day,
+     * when clocks jump from 02:00 to 03:00, is moved to 03:30 and stays cached until then,
+     * while next(time_t) from 03:00 or later skips this day.
+     */
+    time_t nextCached(time_t after);
+
+    /**
+     * Same as next(time_t, size_t*, size_t, size_t*), but uses cache of nextCached(time_t).
+     */
+    time_t nextCached(time_t after, size_t* ids, size_t capacity, size_t* count);
+
 private:
     CronCalc(const CronCalc&);
     const CronCalc& operator=(const CronCalc&);
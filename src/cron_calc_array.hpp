@@ -0,0 +1,105 @@
+// Copyright (c) 2018-2019 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// Private header of C++ wrappers, not installed.
+
+#ifndef CRON_CALC_ARRAY_HPP_
+#define CRON_CALC_ARRAY_HPP_
+
+#include <algorithm>
+
+#ifndef CRON_CALC_NO_EXCEPT
+#include <vector>
+#else
+#include <memory>
+#include <cstring>
+#endif
+
+/**
+ * Growable array of POD elements.
+ * resize() reports allocation failure in CRON_CALC_NO_EXCEPT build, shrinking never fails.
+ */
+
+#ifndef CRON_CALC_NO_EXCEPT
+
+template <typename T>
+class CronCalcArray
+{
+public:
+    bool resize(size_t size)
+    {
+        mData.resize(size);
+        return true;
+    }
+
+    void swap(CronCalcArray& other) { mData.swap(other.mData); }
+
+    T* data() { return mData.empty() ? NULL : &mData[0]; }
+    const T* data() const { return mData.empty() ? NULL : &mData[0]; }
+    size_t size() const { return mData.size(); }
+
+private:
+    std::vector<T> mData;
+};
+
+#else // CRON_CALC_NO_EXCEPT
+
+template <typename T>
+class CronCalcArray
+{
+public:
+    CronCalcArray() : mData(NULL), mSize(0), mCapacity(0)
+    {
+    }
+
+    ~CronCalcArray()
+    {
+        delete[] mData;
+    }
+
+    bool resize(size_t size)
+    {
+        if (size > mCapacity)
+        {
+            size_t capacity = mCapacity ? mCapacity : 8;
+            while (capacity < size) capacity *= 2;
+
+            T* data = new (std::nothrow) T[capacity];
+            if (!data) return false;
+
+            if (mSize) memcpy(data, mData, mSize * sizeof(T));
+            delete[] mData;
+            mData = data;
+            mCapacity = capacity;
+        }
+
+        if (size > mSize) memset(mData + mSize, 0, (size - mSize) * sizeof(T));
+        mSize = size;
+        return true;
+    }
+
+    void swap(CronCalcArray& other)
+    {
+        std::swap(mData, other.mData);
+        std::swap(mSize, other.mSize);
+        std::swap(mCapacity, other.mCapacity);
+    }
+
+    T* data() { return mData; }
+    const T* data() const { return mData; }
+    size_t size() const { return mSize; }
+
+private:
+    CronCalcArray(const CronCalcArray&);
+    const CronCalcArray& operator=(const CronCalcArray&);
+
+    T* mData;
+    size_t mSize;
+    size_t mCapacity;
+};
+
+#endif
+
+#endif // CRON_CALC_ARRAY_HPP_
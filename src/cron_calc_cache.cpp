@@ -0,0 +1,264 @@
+// Copyright (c) 2018-2019 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cron_calc_cache.hpp"
+
+// ----------------------------------------------------------------------------
+
+namespace
+{
+
+const size_t NONE = size_t(-1);
+const ptrdiff_t NO_LOCATION = -1;
+
+// FNV-1a of expression bytes and options
+uint64_t hashOf(const char* expr, size_t len, cron_calc_option_mask options)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ uint8_t(expr[i])) * 1099511628211ull;
+    }
+    return (hash ^ options) * 1099511628211ull;
+}
+
+} // namespace
+
+/**
+ * Part of the cache with its own lock. Slots are chained into hash buckets by `next`,
+ * `mHand` is the clock hand choosing slot to reuse.
+ */
+class CronCalcCacheShard
+{
+public:
+    struct Slot
+    {
+        std::string expr;
+        uint64_t hash;
+        cron_calc rule;
+        cron_calc_error err;
+        ptrdiff_t errOffset;        // NO_LOCATION if parser reported no location
+        cron_calc_option_mask options;
+        bool used;
+        bool referenced;            // hit since the clock hand passed it
+        size_t next;
+    };
+
+    void init(size_t slots)
+    {
+        size_t buckets = 1;
+        while (buckets < slots) buckets *= 2;
+
+        mSlots.resize(slots);
+        mBuckets.resize(buckets);
+        clear();
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < mSlots.size(); i++)
+        {
+            mSlots[i].used = false;
+            mSlots[i].expr.clear();
+        }
+        std::fill(mBuckets.begin(), mBuckets.end(), NONE);
+        mHand = 0;
+        mSize = 0;
+    }
+
+    // Must be called under the lock
+    Slot* find(uint64_t hash, const char* expr, size_t len, cron_calc_option_mask options)
+    {
+        for (size_t i = mBuckets[hash & (mBuckets.size() - 1)]; i != NONE; i = mSlots[i].next)
+        {
+            Slot& slot = mSlots[i];
+            if (slot.hash == hash && slot.options == options &&
+                slot.expr.size() == len && memcmp(slot.expr.data(), expr, len) == 0)
+            {
+                return &slot;
+            }
+        }
+        return NULL;
+    }
+
+    // Must be called under the lock, @return Slot to fill, which is already linked to its bucket
+    Slot& take(uint64_t hash, bool& evicted)
+    {
+        evicted = false;
+        size_t victim = NONE;
+        while (victim == NONE)
+        {
+            Slot& slot = mSlots[mHand];
+            if (slot.used && slot.referenced)
+            {
+                slot.referenced = false;
+            }
+            else
+            {
+                victim = mHand;
+            }
+            mHand = (mHand + 1) % mSlots.size();
+        }
+
+        Slot& slot = mSlots[victim];
+        if (slot.used)
+        {
+            unlink(victim);
+            evicted = true;
+        }
+        else
+        {
+            mSize++;
+        }
+
+        size_t& head = mBuckets[hash & (mBuckets.size() - 1)];
+        slot.hash = hash;
+        slot.used = true;
+        slot.referenced = false;
+        slot.next = head;
+        head = victim;
+        return slot;
+    }
+
+    size_t size() const { return mSize; }
+
+    mutable std::mutex mLock;
+
+private:
+    void unlink(size_t index)
+    {
+        size_t* link = &mBuckets[mSlots[index].hash & (mBuckets.size() - 1)];
+        while (*link != index)
+        {
+            link = &mSlots[*link].next;
+        }
+        *link = mSlots[index].next;
+    }
+
+    std::vector<Slot> mSlots;
+    std::vector<size_t> mBuckets;
+    size_t mHand;
+    size_t mSize;
+};
+
+// ----------------------------------------------------------------------------
+
+CronCalcCache::CronCalcCache(size_t capacity) :
+    mShards(new CronCalcCacheShard[SHARDS]),
+    mCapacity(std::max<size_t>((capacity + SHARDS - 1) / SHARDS, 1) * SHARDS),
+    mHits(0),
+    mMisses(0),
+    mEvictions(0)
+{
+    for (size_t i = 0; i < SHARDS; i++)
+    {
+        mShards[i].init(mCapacity / SHARDS);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+CronCalcCache::~CronCalcCache()
+{
+}
+
+// ----------------------------------------------------------------------------
+
+cron_calc_error CronCalcCache::parse(
+    cron_calc* self,
+    const char* expr,
+    cron_calc_option_mask options,
+    const char** err_location)
+{
+    if (!self || !expr)
+    {
+        return cron_calc_parse(self, expr, options, err_location);
+    }
+
+    const size_t len = strlen(expr);
+    const uint64_t hash = hashOf(expr, len, options);
+    CronCalcCacheShard& shard = mShards[(hash >> 32) % SHARDS];
+    {
+        std::lock_guard<std::mutex> lock(shard.mLock);
+        CronCalcCacheShard::Slot* slot = shard.find(hash, expr, len, options);
+        if (slot)
+        {
+            slot->referenced = true;
+            *self = slot->rule;
+            if (err_location) *err_location = slot->errOffset == NO_LOCATION ? NULL : expr + slot->errOffset;
+            mHits.fetch_add(1, std::memory_order_relaxed);
+            return slot->err;
+        }
+    }
+
+    // parse without the lock, result is the same if another thread does it concurrently
+    cron_calc rule = cron_calc();
+    const char* location = NULL;
+    const cron_calc_error err = cron_calc_parse(&rule, expr, options, &location);
+    *self = rule;
+    if (err_location) *err_location = location;
+    mMisses.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(shard.mLock);
+    if (!shard.find(hash, expr, len, options))
+    {
+        bool evicted = false;
+        CronCalcCacheShard::Slot& slot = shard.take(hash, evicted);
+        slot.expr.assign(expr, len);
+        slot.options = options;
+        slot.rule = rule;
+        slot.err = err;
+        slot.errOffset = location ? location - expr : NO_LOCATION;
+        if (evicted) mEvictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    return err;
+}
+
+// ----------------------------------------------------------------------------
+
+void CronCalcCache::clear()
+{
+    for (size_t i = 0; i < SHARDS; i++)
+    {
+        std::lock_guard<std::mutex> lock(mShards[i].mLock);
+        mShards[i].clear();
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+CronCalcCache::Metrics CronCalcCache::metrics() const
+{
+    Metrics metrics;
+    metrics.size = 0;
+    for (size_t i = 0; i < SHARDS; i++)
+    {
+        std::lock_guard<std::mutex> lock(mShards[i].mLock);
+        metrics.size += mShards[i].size();
+    }
+    metrics.capacity = mCapacity;
+    metrics.hits = mHits.load(std::memory_order_relaxed);
+    metrics.misses = mMisses.load(std::memory_order_relaxed);
+    metrics.evictions = mEvictions.load(std::memory_order_relaxed);
+    return metrics;
+}
+
+// ----------------------------------------------------------------------------
+
+cron_calc_error CronCalcCache::parser(
+    cron_calc* self,
+    const char* expr,
+    cron_calc_option_mask options,
+    const char** err_location,
+    void* context)
+{
+    return static_cast<CronCalcCache*>(context)->parse(self, expr, options, err_location);
+}
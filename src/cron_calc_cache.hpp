@@ -0,0 +1,106 @@
+// Copyright (c) 2018-2019 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CRON_CALC_CACHE_HPP_
+#define CRON_CALC_CACHE_HPP_
+
+// Cache of parsing results, requires C++11 and threads.
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "cron_calc.h"
+
+class CronCalcCacheShard;
+
+/**
+ * Interns results of cron_calc_parse() by expression and options, so that repeated
+ * expressions are parsed once. Errors are cached too, with their location kept
+ * as offset in the expression.
+ *
+ * Entries are spread over shards by hash, each shard has its own lock, hash chains
+ * and fixed number of slots. When shard is full, a slot is evicted by clock algorithm:
+ * hits mark the slot, the clock hand clears marks and takes the first unmarked slot.
+ * Memory is bounded by capacity given to constructor, plus the expressions themselves.
+ *
+ * All methods are thread-safe. Expression is parsed outside of the lock on a miss.
+ *
+ *     CronCalcCache cache(4096);
+ *     CronCalc cron;
+ *     cron.setParser(CronCalcCache::parser, &cache);
+ *     cron.addRule("0 0 * * *");
+ */
+class CronCalcCache
+{
+public:
+    enum
+    {
+        SHARDS = 16
+    };
+
+    /**
+     * Snapshot of cache counters.
+     */
+    struct Metrics
+    {
+        size_t size;            // entries cached at the moment
+        size_t capacity;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    /**
+     * @param capacity Maximum number of cached entries, rounded up to multiple of SHARDS.
+     */
+    explicit CronCalcCache(size_t capacity);
+    ~CronCalcCache();
+
+    /**
+     * Same as cron_calc_parse(), but returns cached result if this expression has been
+     * parsed with the same options before.
+     *
+     * @see cron_calc_parse() for details on arguments and return values.
+     */
+    cron_calc_error parse(cron_calc* self, const char* expr, cron_calc_option_mask options, const char** err_location);
+
+    /**
+     * Drops all cached entries, counters stay.
+     */
+    void clear();
+
+    /**
+     * @return Counters of the cache, each counter is consistent by itself,
+     *         but they are not sampled at exactly the same moment.
+     */
+    Metrics metrics() const;
+
+    /**
+     * CronCalcParser, which calls parse() of the cache given in context.
+     *
+     * @param context Pointer to CronCalcCache.
+     */
+    static cron_calc_error parser(
+        cron_calc* self,
+        const char* expr,
+        cron_calc_option_mask options,
+        const char** err_location,
+        void* context);
+
+private:
+    CronCalcCache(const CronCalcCache&) = delete;
+    CronCalcCache& operator=(const CronCalcCache&) = delete;
+
+private:
+    std::unique_ptr<CronCalcCacheShard[]> mShards;
+    const size_t mCapacity;
+
+    std::atomic<uint64_t> mHits;
+    std::atomic<uint64_t> mMisses;
+    std::atomic<uint64_t> mEvictions;
+};
+
+#endif // CRON_CALC_CACHE_HPP_
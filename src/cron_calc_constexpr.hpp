@@ -0,0 +1,553 @@
+// Copyright (c) 2018-2019 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CRON_CALC_CONSTEXPR_HPP_
+#define CRON_CALC_CONSTEXPR_HPP_
+
+// Compile-time parsing of Cron expressions, requires C++14.
+//
+//     constexpr cron_calc rule = cron::compile("0 */5 * * *");
+//
+// produces the same cron_calc object as cron_calc_parse() called with the same
+// arguments, invalid expression fails compilation of constexpr initialization.
+// Functions are usable at run time as well.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cron_calc.h"
+#include "cron_calc_fields.h"
+
+namespace cron
+{
+
+/**
+ * Result of parse(), the same as results of cron_calc_parse().
+ */
+struct parse_result
+{
+    cron_calc rule;         // valid only if error is CRON_CALC_OK
+    cron_calc_error error;
+    size_t error_offset;    // offset of error location in expression, if error is not CRON_CALC_OK
+};
+
+namespace detail
+{
+
+// Mirrors of private definitions of cron_calc.c
+
+enum
+{
+    YEAR_START = CRON_CALC_FIELD_YEAR_FIRST,
+    YEAR_COUNT = CRON_CALC_FIELD_YEAR_LAST - CRON_CALC_FIELD_YEAR_FIRST + 1,
+    YEAR_END = CRON_CALC_FIELD_YEAR_LAST,
+    YEAR_WINDOW = CRON_CALC_FIELD_YEAR_WINDOW,
+    YEAR_WORDS = (YEAR_COUNT + 63) / 64,
+    YEAR_NONE = INT32_MAX,
+    NAME_LEN = 3,
+    NAME_UPCASE = 'a' - 'A',
+    LAST_CODE = INT32_MAX,
+    OPT_MDAY_STARRED = CRON_CALC_FIELD_MDAY_STARRED,
+    OPT_WDAY_STARRED = CRON_CALC_FIELD_WDAY_STARRED
+};
+
+enum field
+{
+    FIELD_SECONDS,
+    FIELD_MINUTES,
+    FIELD_HOURS,
+    FIELD_DAYS,
+    FIELD_MONTHS,
+    FIELD_WDAYS,
+    FIELD_YEARS
+};
+
+constexpr const char* kDays[] = { CRON_CALC_DAY_NAMES };
+constexpr const char* kMonths[] = { CRON_CALC_MONTH_NAMES };
+
+struct field_def
+{
+    uint32_t min;
+    uint32_t max;
+    const char* const* names;
+    uint32_t names_count;
+};
+
+#define CRON_CALC_CONSTEXPR_NAMES_NONE nullptr, 0
+#define CRON_CALC_CONSTEXPR_NAMES_MONTHS kMonths, sizeof kMonths / sizeof kMonths[0]
+#define CRON_CALC_CONSTEXPR_NAMES_DAYS kDays, sizeof kDays / sizeof kDays[0]
+#define CRON_CALC_CONSTEXPR_FIELD_DEF(min_, max_, names_) { min_, max_, CRON_CALC_CONSTEXPR_NAMES_##names_ },
+
+constexpr field_def kFieldDefs[] = {
+    CRON_CALC_FIELDS(CRON_CALC_CONSTEXPR_FIELD_DEF)
+};
+
+#undef CRON_CALC_CONSTEXPR_FIELD_DEF
+#undef CRON_CALC_CONSTEXPR_NAMES_DAYS
+#undef CRON_CALC_CONSTEXPR_NAMES_MONTHS
+#undef CRON_CALC_CONSTEXPR_NAMES_NONE
+
+constexpr uint64_t mask(uint32_t bit)
+{
+    return uint64_t(1) << bit;
+}
+
+constexpr bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+constexpr bool is_name_char(char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+constexpr bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+constexpr bool is_leap_year(int year)
+{
+    return year % 400 == 0 ? true : year % 100 == 0 ? false : year % 4 == 0;
+}
+
+constexpr int highest_bit(uint64_t value)
+{
+    int index = 63;
+    for (; !(value & mask(63)); value <<= 1) index--;
+    return index;
+}
+
+// The same as cron_calc_parse_limited_number(), `pos` is advanced only on success
+constexpr cron_calc_error parse_limited_number(
+    const char* expr, size_t& pos, uint32_t& value, uint32_t minimum, uint32_t maximum)
+{
+    uint32_t val = 0;
+    size_t p = pos;
+
+    for (; expr[p] && is_digit(expr[p]); p++)
+    {
+        val = val * 10 + expr[p] - '0';
+        if (val > maximum)
+        {
+            return CRON_CALC_ERROR_NUMBER_RANGE;
+        }
+    }
+    if (p == pos)
+    {
+        return CRON_CALC_ERROR_NUMBER_EXPECTED;
+    }
+    if (val < minimum)
+    {
+        return CRON_CALC_ERROR_NUMBER_RANGE;
+    }
+    pos = p;
+    value = val;
+    return CRON_CALC_OK;
+}
+
+// The same as cron_calc_parse_name()
+constexpr cron_calc_error parse_name(const char* expr, size_t& pos, uint32_t& value, const field_def& def)
+{
+    char name[NAME_LEN + 1] = {};
+    int name_len = 0;
+    size_t p = pos;
+
+    for (; expr[p] && is_name_char(expr[p]) && name_len < NAME_LEN; p++)
+    {
+        name[name_len++] = expr[p];
+    }
+    if (name_len != NAME_LEN)
+    {
+        return CRON_CALC_ERROR_INVALID_NAME;
+    }
+    for (uint32_t i = 0; i < def.names_count; i++)
+    {
+        const char* fname = def.names[i];
+        if ((fname[0] == name[0] || fname[0] == name[0] - NAME_UPCASE) &&
+            (fname[1] == name[1] || fname[1] == name[1] - NAME_UPCASE) &&
+            (fname[2] == name[2] || fname[2] == name[2] - NAME_UPCASE))
+        {
+            value = i;
+            pos = p;
+            return CRON_CALC_OK;
+        }
+    }
+    return CRON_CALC_ERROR_INVALID_NAME;
+}
+
+// The same as cron_calc_parse_value()
+constexpr cron_calc_error parse_value(const char* expr, size_t& pos, uint32_t& value, int fld)
+{
+    const field_def& def = kFieldDefs[fld];
+    if (def.names_count && is_name_char(expr[pos]))
+    {
+        return parse_name(expr, pos, value, def);
+    }
+    return parse_limited_number(expr, pos, value, def.min, def.max);
+}
+
+// The same as cron_calc_set_field()
+constexpr cron_calc_error set_field(cron_calc& rule, uint32_t min, uint32_t max, uint32_t step, bool is_star, int fld)
+{
+    uint64_t value = 0;
+
+    if (max < min)
+    {
+        return CRON_CALC_ERROR_NUMBER_RANGE;
+    }
+    if (max != LAST_CODE)
+    {
+        for (uint32_t i = min; i <= max; i += step)
+        {
+            value |= mask(i);
+        }
+    }
+
+    switch (fld)
+    {
+        case FIELD_SECONDS:
+            rule.seconds |= value;
+            break;
+        case FIELD_MINUTES:
+            rule.minutes |= value;
+            break;
+        case FIELD_HOURS:
+            rule.hours |= uint32_t(value);
+            break;
+        case FIELD_DAYS:
+            if (max == LAST_CODE)
+            {
+                value = mask(0);
+            }
+            rule.days |= uint32_t(value);
+            rule.options |= is_star ? OPT_MDAY_STARRED : 0;
+            break;
+        case FIELD_MONTHS:
+            rule.months |= uint16_t(value);
+            break;
+        case FIELD_WDAYS:
+            if (value & mask(7))
+            {
+                value |= mask(0);
+                value &= ~mask(7);
+            }
+            rule.weekDays |= uint8_t(value);
+            rule.options |= is_star ? OPT_WDAY_STARRED : 0;
+            break;
+        default:
+            break;
+    }
+    return CRON_CALC_OK;
+}
+
+// The same as cron_calc_set_years()
+constexpr cron_calc_error set_years(uint64_t (&years)[YEAR_WORDS], uint32_t min, uint32_t max, uint32_t step)
+{
+    if (max < min)
+    {
+        return CRON_CALC_ERROR_NUMBER_RANGE;
+    }
+    for (uint32_t i = min - YEAR_START; i <= max - YEAR_START; i += step)
+    {
+        years[i / 64] |= mask(i % 64);
+    }
+    return CRON_CALC_OK;
+}
+
+// The same as cron_calc_pack_years()
+constexpr bool pack_years(cron_calc& rule, const uint64_t (&years)[YEAR_WORDS])
+{
+    int base = -1, last = -1, step = 0;
+
+    for (int y = 0; y < YEAR_COUNT; y++)
+    {
+        if (!(years[y / 64] & mask(y % 64)))
+        {
+            continue;
+        }
+        if (base < 0)
+        {
+            base = y;
+        }
+        if (y < base + YEAR_WINDOW)
+        {
+            rule.years |= mask(y - base);
+        }
+        else if (!step)
+        {
+            step = y - last;
+        }
+        else if (y - last != step)
+        {
+            return false;
+        }
+        last = y;
+    }
+
+    rule.yearBase = uint8_t(base);
+    rule.yearStep = uint8_t(step);
+    rule.yearEnd = uint8_t(step ? last : 0);
+    return true;
+}
+
+// The same as cron_calc_next_year_value() for rules with years
+constexpr int next_year_value(const cron_calc& rule, int year)
+{
+    const int base = YEAR_START + rule.yearBase;
+    if (year < base)
+    {
+        year = base;
+    }
+    if (year < base + YEAR_WINDOW)
+    {
+        const uint64_t rest = rule.years & (~uint64_t(0) << (year - base));
+        if (rest)
+        {
+            int bit = 0;
+            while (!(rest & mask(bit))) bit++;
+            return base + bit;
+        }
+    }
+    if (!rule.yearStep)
+    {
+        return YEAR_NONE;
+    }
+
+    const int last = base + highest_bit(rule.years);
+    const int steps = (year - last + rule.yearStep - 1) / rule.yearStep;
+    year = last + steps * rule.yearStep;
+    return year <= YEAR_START + rule.yearEnd ? year : YEAR_NONE;
+}
+
+// The same as cron_calc_is_impossible()
+constexpr bool is_impossible(const cron_calc& rule)
+{
+    if ((rule.options & CRON_CALC_OPT_WITH_YEARS) && rule.months == mask(2) && rule.days == mask(29))
+    {
+        int y = next_year_value(rule, YEAR_START);
+        for (; y <= YEAR_END; y = next_year_value(rule, y + 1))
+        {
+            if (is_leap_year(y))
+            {
+                break;
+            }
+        }
+        if (y > YEAR_END)
+        {
+            return true;
+        }
+    }
+
+    if (rule.days == mask(31))
+    {
+        const uint64_t long_months = mask(1) | mask(3) | mask(5) | mask(7) | mask(8) | mask(10) | mask(12);
+        if ((rule.months & long_months) == 0)
+        {
+            return true;
+        }
+    }
+
+    if (rule.months == mask(2))
+    {
+        const uint64_t feb_days = ~(mask(30) | mask(31));
+        if ((rule.days & feb_days) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The same as cron_calc_kernel_index()
+constexpr uint8_t kernel_index(const cron_calc& rule)
+{
+    return uint8_t(CRON_CALC_FIELD_KERNEL_INDEX(rule.options, rule.seconds, rule.weekDays, rule.days));
+}
+
+// Not constexpr, so that invalid expression stops constant evaluation of compile()
+inline cron_calc invalid_expression(cron_calc_error)
+{
+    return cron_calc();
+}
+
+constexpr cron_calc checked(const parse_result& result)
+{
+    return result.error == CRON_CALC_OK ? result.rule : invalid_expression(result.error);
+}
+
+} // namespace detail
+
+/**
+ * The same as cron_calc_parse(), but can be evaluated at compile time.
+ * Error location is reported as offset in expression.
+ */
+constexpr parse_result parse(const char* expr, cron_calc_option_mask options = CRON_CALC_OPT_DEFAULT)
+{
+    using namespace detail;
+
+    parse_result res = { cron_calc(), CRON_CALC_OK, 0 };
+    cron_calc& rule = res.rule;
+    cron_calc_error err = CRON_CALC_OK;
+    size_t p = 0;
+    int fld = FIELD_SECONDS;
+    int last_field = FIELD_YEARS;
+    uint64_t years[YEAR_WORDS] = {};
+    size_t years_start = 0;
+    bool years_started = false;
+
+    if (!expr)
+    {
+        res.error = CRON_CALC_ERROR_ARGUMENT;
+        return res;
+    }
+
+    rule.options = options;
+    if (!(options & CRON_CALC_OPT_WITH_SECONDS))
+    {
+        set_field(rule, kFieldDefs[FIELD_SECONDS].min, kFieldDefs[FIELD_SECONDS].min, 1, true, FIELD_SECONDS);
+        fld = FIELD_MINUTES;
+    }
+    if (!(options & CRON_CALC_OPT_WITH_YEARS))
+    {
+        last_field = FIELD_WDAYS;
+    }
+
+    while (fld <= last_field)
+    {
+        uint32_t min = 0, max = 0, step = 1;
+        bool is_range = false, is_star = false;
+
+        if (fld == FIELD_YEARS && !years_started)
+        {
+            years_start = p;
+            years_started = true;
+        }
+
+        if (expr[p] == '*')
+        {
+            min = kFieldDefs[fld].min;
+            max = kFieldDefs[fld].max;
+            is_range = is_star = true;
+            p++;
+        }
+        else if (expr[p] == 'L')
+        {
+            if (fld == FIELD_DAYS)
+            {
+                min = max = LAST_CODE;
+                p++;
+            }
+            else
+            {
+                err = CRON_CALC_ERROR_NUMBER_EXPECTED;
+                break;
+            }
+        }
+        else
+        {
+            err = parse_value(expr, p, min, fld);
+            if (err) break;
+
+            if (expr[p] == '-')
+            {
+                p++;
+                err = parse_value(expr, p, max, fld);
+                if (err) break;
+                is_range = true;
+            }
+            else
+            {
+                max = min;
+            }
+        }
+
+        if (is_range && expr[p] == '/')
+        {
+            p++;
+            err = parse_limited_number(expr, p, step, 1, kFieldDefs[fld].max);
+            if (err) break;
+        }
+
+        if (expr[p] == 0 || is_space(expr[p]) || expr[p] == ',')
+        {
+            err = (fld == FIELD_YEARS) ? set_years(years, min, max, step) : set_field(rule, min, max, step, is_star, fld);
+            if (err) break;
+
+            if (is_space(expr[p]))
+            {
+                while (is_space(expr[p])) p++;
+                fld++;
+            }
+            else if (expr[p] == ',')
+            {
+                p++;
+            }
+            else
+            {
+                fld++;
+                break;
+            }
+        }
+        else
+        {
+            err = CRON_CALC_ERROR_FIELD_FORMAT;
+            break;
+        }
+    }
+
+    if (!err)
+    {
+        if (fld <= last_field)
+        {
+            err = CRON_CALC_ERROR_EXPR_SHORT;
+        }
+        else if (expr[p] != 0)
+        {
+            err = CRON_CALC_ERROR_EXPR_LONG;
+        }
+    }
+
+    if (!err && (options & CRON_CALC_OPT_WITH_YEARS) && !pack_years(rule, years))
+    {
+        err = CRON_CALC_ERROR_NUMBER_RANGE;
+        p = years_start;
+    }
+
+    if (!err && is_impossible(rule))
+    {
+        err = CRON_CALC_ERROR_IMPOSSIBLE_DATE;
+    }
+
+    if (err)
+    {
+        res.error = err;
+        res.error_offset = p;
+    }
+    else
+    {
+        rule.kernel = kernel_index(rule);
+    }
+    return res;
+}
+
+/**
+ * Parses string literal into cron_calc object at compile time, if used in constant expression.
+ * Invalid expression can't be evaluated at compile time, then the error is reported
+ * as call to non-constexpr function detail::invalid_expression().
+ * At run time invalid expression yields object, which is rejected by all cron_calc functions.
+ *
+ * @see cron_calc_parse() for details on arguments.
+ */
+template <size_t N>
+constexpr cron_calc compile(const char (&expr)[N], cron_calc_option_mask options = CRON_CALC_OPT_DEFAULT)
+{
+    return detail::checked(parse(expr, options));
+}
+
+} // namespace cron
+
+#endif // CRON_CALC_CONSTEXPR_HPP_
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2018 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+/*
+ * Definitions of expression fields, shared by run-time parser in cron_calc.c
+ * and compile-time parser in cron_calc_constexpr.hpp, so that both accept
+ * the same values and names, and produce the same layout of cron_calc.
+ */
+
+#ifndef CRON_CALC_FIELDS_H_
+#define CRON_CALC_FIELDS_H_
+
+#define CRON_CALC_FIELD_YEAR_FIRST 1970
+#define CRON_CALC_FIELD_YEAR_LAST 2199
+#define CRON_CALC_FIELD_YEAR_WINDOW 64 /* years in bitmap of cron_calc */
+
+/* Private option bits of parsed rule, set if day field is starred */
+#define CRON_CALC_FIELD_MDAY_STARRED CRON_CALC_OPT_RESERVED_40
+#define CRON_CALC_FIELD_WDAY_STARRED CRON_CALC_OPT_RESERVED_80
+
+/* How day of month and week day fields are combined by search kernel */
+#define CRON_CALC_FIELD_DAYS_EITHER 0   /* neither field is starred, either of them matches */
+#define CRON_CALC_FIELD_DAYS_BOTH 1     /* both fields must match */
+#define CRON_CALC_FIELD_DAYS_MDAY 2     /* all week days match, only days of month are checked */
+#define CRON_CALC_FIELD_DAYS_WDAY 3     /* all days of month match, only week days are checked */
+
+#define CRON_CALC_FIELD_ALL_DAYS 0xFFFFFFFEu /* days 1-31 */
+
+#define CRON_CALC_FIELD_DAYS_MODE(options_, week_days_, days_) \
+    (!((options_) & (CRON_CALC_FIELD_MDAY_STARRED | CRON_CALC_FIELD_WDAY_STARRED)) ? CRON_CALC_FIELD_DAYS_EITHER : \
+     ((week_days_) & 0x7F) == 0x7F ? CRON_CALC_FIELD_DAYS_MDAY : \
+     ((days_) & CRON_CALC_FIELD_ALL_DAYS) == CRON_CALC_FIELD_ALL_DAYS ? CRON_CALC_FIELD_DAYS_WDAY : \
+     CRON_CALC_FIELD_DAYS_BOTH)
+
+/* Index of search kernel of parsed rule: 0 is generic search, then kernels for every
+ * combination of seconds option, years option and days mode. Kernels without seconds
+ * match only 0th second, so other seconds masks fall back to generic search */
+#define CRON_CALC_FIELD_KERNEL_INDEX(options_, seconds_, week_days_, days_) \
+    (!((options_) & CRON_CALC_OPT_WITH_SECONDS) && (seconds_) != 1 ? 0 : \
+     1 + ((options_) & CRON_CALC_OPT_WITH_SECONDS ? 1 : 0) + 2 * ((options_) & CRON_CALC_OPT_WITH_YEARS ? 1 : 0) + \
+     4 * CRON_CALC_FIELD_DAYS_MODE(options_, week_days_, days_))
+
+#define CRON_CALC_DAY_NAMES \
+    "SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT"
+
+#define CRON_CALC_MONTH_NAMES \
+    "", "JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"
+
+/* X_(min_, max_, names_) for each field in order of cron_calc_field,
+ * names_ is one of NONE, MONTHS, DAYS */
+#define CRON_CALC_FIELDS(X_) \
+    X_(0, 59, NONE)         /* seconds */ \
+    X_(0, 59, NONE)         /* minutes */ \
+    X_(0, 23, NONE)         /* hours */ \
+    X_(1, 31, NONE)         /* days */ \
+    X_(1, 12, MONTHS)       /* months */ \
+    X_(0,  7, DAYS)         /* week days, 7 is Sunday as well as 0 */ \
+    X_(CRON_CALC_FIELD_YEAR_FIRST, CRON_CALC_FIELD_YEAR_LAST, NONE) /* years */
+
+#endif /* CRON_CALC_FIELDS_H_ */
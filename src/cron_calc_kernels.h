@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2018 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+/*
+ * Search kernels specialized for options and day fields of a rule.
+ *
+ * This is private part of cron_calc.c, it is included there after generic search
+ * functions, which it relies on. Generic search goes through table of tm fields
+ * and checks options on every level, while each kernel is the same search inlined
+ * with constant flags, so fields are accessed directly and dead branches are removed.
+ * Rules with kernel set by cron_calc_parse() are searched by kernel chosen from their
+ * current fields by cron_calc_kernel_index(), which is index into K_CRON_CALC_KERNELS,
+ * 0 selects generic search.
+ *
+ * Kernels speed up the search itself, see "kernel_speedup" of cron_calc_bench for UTC search.
+ * Search in local time spends most of the time in localtime() and mktime(), which kernels
+ * don't change, so its gain is small.
+ */
+
+#ifndef CRON_CALC_KERNELS_H_
+#define CRON_CALC_KERNELS_H_
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CRON_CALC_KERNEL_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define CRON_CALC_KERNEL_INLINE static __forceinline
+#else
+#define CRON_CALC_KERNEL_INLINE static inline
+#endif
+
+/* How day of month and week day fields are combined, see cron_calc_fields.h */
+typedef enum cron_calc_kernel_days
+{
+    CRON_CALC_KERNEL_DAYS_EITHER = CRON_CALC_FIELD_DAYS_EITHER,
+    CRON_CALC_KERNEL_DAYS_BOTH = CRON_CALC_FIELD_DAYS_BOTH,
+    CRON_CALC_KERNEL_DAYS_MDAY = CRON_CALC_FIELD_DAYS_MDAY,
+    CRON_CALC_KERNEL_DAYS_WDAY = CRON_CALC_FIELD_DAYS_WDAY,
+
+    CRON_CALC_KERNEL_DAYS_COUNT
+} cron_calc_kernel_days;
+
+enum
+{
+    /* index 0 is generic search, then kernels for every combination of
+     * seconds option, years option and days mode */
+    CRON_CALC_KERNEL_COUNT = 1 + 2 * 2 * CRON_CALC_KERNEL_DAYS_COUNT
+};
+
+typedef bool (*cron_calc_kernel)(const cron_calc* self, struct tm* tm_val);
+
+/* ---------------------------------------------------------------------------- */
+
+/* Same as cron_calc_find_next() from hour level */
+CRON_CALC_KERNEL_INLINE bool cron_calc_kernel_time(
+    const cron_calc* self,
+    struct tm* tm_val,
+    bool rollover,
+    bool with_seconds)
+{
+    const int start_hour = rollover ? 0 : tm_val->tm_hour;
+    int hour = cron_calc_next_bit(self->hours, start_hour);
+
+    CRON_CALC_STATS_DEPTH(CRON_CALC_TM_HOUR);
+    for (; hour >= 0 && hour <= 23; hour = cron_calc_next_bit(self->hours, hour + 1))
+    {
+        const bool hour_rollover = rollover || hour != start_hour;
+        const int start_minute = hour_rollover ? 0 : tm_val->tm_min;
+        int minute = cron_calc_next_bit(self->minutes, start_minute);
+
+        CRON_CALC_STATS_ITERATION(CRON_CALC_TM_HOUR);
+        CRON_CALC_STATS_DEPTH(CRON_CALC_TM_MINUTE);
+        for (; minute >= 0 && minute <= 59; minute = cron_calc_next_bit(self->minutes, minute + 1))
+        {
+            const bool minute_rollover = hour_rollover || minute != start_minute;
+            int second = 0;
+
+            CRON_CALC_STATS_ITERATION(CRON_CALC_TM_MINUTE);
+            CRON_CALC_STATS_DEPTH(CRON_CALC_TM_SECOND);
+            if (with_seconds)
+            {
+                second = cron_calc_next_bit(self->seconds, minute_rollover ? 0 : tm_val->tm_sec);
+                if (second < 0 || second > 59)
+                {
+                    continue;
+                }
+            }
+            else if (!minute_rollover && tm_val->tm_sec > 0)
+            {
+                continue; /* only 0th second matches, and it has passed already */
+            }
+
+            CRON_CALC_STATS_ITERATION(CRON_CALC_TM_SECOND);
+            tm_val->tm_hour = hour;
+            tm_val->tm_min = minute;
+            tm_val->tm_sec = second;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Same as cron_calc_month_day_mask() */
+CRON_CALC_KERNEL_INLINE uint64_t cron_calc_kernel_day_mask(
+    const cron_calc* self,
+    int year,
+    int month,
+    int month_len,
+    cron_calc_kernel_days days_mode)
+{
+    const uint64_t month_mask = CRON_CALC_MASK(month_len + 1) - CRON_CALC_MASK(1);
+    uint64_t days = 0;
+    uint64_t wdays = 0;
+
+    if (days_mode != CRON_CALC_KERNEL_DAYS_WDAY)
+    {
+        days = self->days;
+        if (CRON_CALC_MATCHES_MASK(0, days))
+        {
+            days |= CRON_CALC_MASK(month_len);
+        }
+    }
+    if (days_mode != CRON_CALC_KERNEL_DAYS_MDAY)
+    {
+        const int first_wday = cron_calc_get_week_day(year, month, 1);
+        const uint64_t week_days = self->weekDays & 0x7F;
+        const uint64_t rotated = ((week_days >> first_wday) | (week_days << (7 - first_wday))) & 0x7F;
+        wdays = (rotated * CRON_CALC_WEEK_REPEAT) << 1;
+    }
+
+    switch (days_mode)
+    {
+        case CRON_CALC_KERNEL_DAYS_EITHER: return (days | wdays) & month_mask;
+        case CRON_CALC_KERNEL_DAYS_BOTH: return days & wdays & month_mask;
+        case CRON_CALC_KERNEL_DAYS_MDAY: return days & month_mask;
+        default: return wdays & month_mask;
+    }
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Same as cron_calc_find_next() from month level */
+CRON_CALC_KERNEL_INLINE bool cron_calc_kernel_month(
+    const cron_calc* self,
+    struct tm* tm_val,
+    bool rollover,
+    bool with_seconds,
+    cron_calc_kernel_days days_mode)
+{
+    const int start_month = rollover ? 1 : tm_val->tm_mon;
+    int month = cron_calc_next_bit(self->months, start_month);
+
+    CRON_CALC_STATS_DEPTH(CRON_CALC_TM_MONTH);
+    for (; month >= 0 && month <= 12; month = cron_calc_next_bit(self->months, month + 1))
+    {
+        const bool month_rollover = rollover || month != start_month;
+        const int month_len = cron_calc_month_days(tm_val->tm_year, month);
+        const uint64_t days = cron_calc_kernel_day_mask(self, tm_val->tm_year, month, month_len, days_mode);
+        const int start_day = month_rollover ? 1 : tm_val->tm_mday;
+        int day = cron_calc_next_bit(days, start_day);
+
+        CRON_CALC_STATS_ITERATION(CRON_CALC_TM_MONTH);
+        CRON_CALC_STATS_DEPTH(CRON_CALC_TM_DAY);
+        for (; day >= 0; day = cron_calc_next_bit(days, day + 1))
+        {
+            CRON_CALC_STATS_ITERATION(CRON_CALC_TM_DAY);
+            if (cron_calc_kernel_time(self, tm_val, month_rollover || day != start_day, with_seconds))
+            {
+                tm_val->tm_mon = month;
+                tm_val->tm_mday = day;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Same as cron_calc_find_next_year() */
+CRON_CALC_KERNEL_INLINE bool cron_calc_kernel_search(
+    const cron_calc* self,
+    struct tm* tm_val,
+    bool with_seconds,
+    bool with_years,
+    cron_calc_kernel_days days_mode)
+{
+    const int start = tm_val->tm_year;
+    int year = with_years ? cron_calc_next_year_value(self, start) : start;
+    uint32_t types = 0;
+    int failures = 0;
+
+    CRON_CALC_STATS_DEPTH(CRON_CALC_TM_YEAR);
+    for (; year <= CRON_CALC_YEAR_MAX; year = with_years ? cron_calc_next_year_value(self, year + 1) : year + 1)
+    {
+        CRON_CALC_STATS_ADD(years_scanned, 1);
+        if (types && !(types & (1u << cron_calc_year_type(year))))
+        {
+            continue;
+        }
+
+        tm_val->tm_year = year;
+        CRON_CALC_STATS_ITERATION(CRON_CALC_TM_YEAR);
+        if (cron_calc_kernel_month(self, tm_val, year != start, with_seconds, days_mode))
+        {
+            return true;
+        }
+
+        if (++failures == CRON_CALC_YEAR_TYPES_AFTER)
+        {
+            cron_calc_mask_array levels = { 0 };
+            const cron_calc_masks masks = { levels, NULL, NULL };
+            levels[CRON_CALC_TM_MONTH] = self->months;
+
+            types = cron_calc_year_types(self, &masks);
+            if (!types)
+            {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Kernels in order of their index: 1 + seconds + 2 * years + 4 * days mode */
+#define CRON_CALC_KERNELS(X_) \
+    X_(0, 0, EITHER) X_(1, 0, EITHER) X_(0, 1, EITHER) X_(1, 1, EITHER) \
+    X_(0, 0, BOTH)   X_(1, 0, BOTH)   X_(0, 1, BOTH)   X_(1, 1, BOTH) \
+    X_(0, 0, MDAY)   X_(1, 0, MDAY)   X_(0, 1, MDAY)   X_(1, 1, MDAY) \
+    X_(0, 0, WDAY)   X_(1, 0, WDAY)   X_(0, 1, WDAY)   X_(1, 1, WDAY)
+
+#define CRON_CALC_KERNEL_NAME(seconds_, years_, days_) cron_calc_kernel_##seconds_##_##years_##_##days_
+
+#define CRON_CALC_KERNEL_DEFINE(seconds_, years_, days_) \
+    static bool CRON_CALC_KERNEL_NAME(seconds_, years_, days_)(const cron_calc* self, struct tm* tm_val) \
+    { \
+        return cron_calc_kernel_search(self, tm_val, seconds_, years_, CRON_CALC_KERNEL_DAYS_##days_); \
+    }
+
+#define CRON_CALC_KERNEL_ENTRY(seconds_, years_, days_) CRON_CALC_KERNEL_NAME(seconds_, years_, days_),
+
+CRON_CALC_KERNELS(CRON_CALC_KERNEL_DEFINE)
+
+static const cron_calc_kernel K_CRON_CALC_KERNELS[CRON_CALC_KERNEL_COUNT] = {
+    NULL, /* generic search */
+    CRON_CALC_KERNELS(CRON_CALC_KERNEL_ENTRY)
+};
+
+/* ---------------------------------------------------------------------------- */
+
+/* @return Index of kernel matching options and day fields of parsed rule */
+static uint8_t cron_calc_kernel_index(const cron_calc* self)
+{
+    return (uint8_t) CRON_CALC_FIELD_KERNEL_INDEX(self->options, self->seconds, self->weekDays, self->days);
+}
+
+#endif /* CRON_CALC_KERNELS_H_ */
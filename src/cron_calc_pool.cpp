@@ -0,0 +1,371 @@
+// Copyright (c) 2018-2019 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include <algorithm>
+#include <chrono>
+
+#include "cron_calc_pool.hpp"
+
+// ----------------------------------------------------------------------------
+
+namespace
+{
+
+struct Task
+{
+    CronCalcCallback callback;
+    size_t id;
+    time_t at;
+    void* context;
+};
+
+const size_t CACHE_LINE = 64;
+
+// Padding, which keeps atomic counter away from other data written by other threads
+struct PaddedIndex
+{
+    std::atomic<size_t> value;
+    char pad[CACHE_LINE - sizeof(std::atomic<size_t>)];
+};
+
+} // namespace
+
+/**
+ * Bounded FIFO ring of tasks, filled at the tail by one thread, taken from the head by any thread
+ * by CAS of the head index. Indexes grow monotonically, slot of index `i` is `i & mMask`.
+ * Slot fields are atomic, because consumer may read slot, while it's taken by another one
+ * and filled again, then its CAS of head fails and read values are dropped.
+ */
+class CronCalcPoolRing
+{
+public:
+    explicit CronCalcPoolRing(size_t capacity) : mMask(capacity - 1), mSlots(new Slot[capacity])
+    {
+        mHead.value.store(0, std::memory_order_relaxed);
+        mTail.value.store(0, std::memory_order_relaxed);
+    }
+
+    // Must be called by one thread at a time
+    bool push(const Task& task)
+    {
+        const size_t tail = mTail.value.load(std::memory_order_relaxed);
+        const size_t head = mHead.value.load(std::memory_order_acquire);
+        if (tail - head > mMask)
+        {
+            return false;
+        }
+
+        Slot& slot = mSlots[tail & mMask];
+        slot.callback.store(task.callback, std::memory_order_relaxed);
+        slot.id.store(task.id, std::memory_order_relaxed);
+        slot.at.store(task.at, std::memory_order_relaxed);
+        slot.context.store(task.context, std::memory_order_relaxed);
+        mTail.value.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // May be called by any number of threads
+    bool take(Task& task)
+    {
+        size_t head = mHead.value.load(std::memory_order_acquire);
+        for (;;)
+        {
+            const size_t tail = mTail.value.load(std::memory_order_acquire);
+            if (head >= tail)
+            {
+                return false;
+            }
+
+            const Slot& slot = mSlots[head & mMask];
+            task.callback = slot.callback.load(std::memory_order_relaxed);
+            task.id = slot.id.load(std::memory_order_relaxed);
+            task.at = slot.at.load(std::memory_order_relaxed);
+            task.context = slot.context.load(std::memory_order_relaxed);
+            if (mHead.value.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                return true;
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        const size_t head = mHead.value.load(std::memory_order_relaxed);
+        const size_t tail = mTail.value.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<CronCalcCallback> callback;
+        std::atomic<size_t> id;
+        std::atomic<time_t> at;
+        std::atomic<void*> context;
+    };
+
+    const size_t mMask;
+    std::unique_ptr<Slot[]> mSlots;
+    PaddedIndex mHead;
+    PaddedIndex mTail;
+};
+
+// ----------------------------------------------------------------------------
+
+CronCalcPool::CronCalcPool(size_t workers, size_t capacity, Overflow overflow) :
+    mOverflow(overflow),
+    mNext(0),
+    mQueued(0),
+    mTaken(0),
+    mRunning(0),
+    mSleeping(0),
+    mWaiting(0),
+    mStop(false),
+    mMaxDepth(0),
+    mSubmitted(0),
+    mRejected(0),
+    mExecuted(0),
+    mStolen(0),
+    mBlocked(0),
+    mLagTotalUs(0),
+    mLagMaxUs(0)
+{
+    for (size_t i = 0; i < LAG_BUCKETS; i++)
+    {
+        mLagBuckets[i].store(0);
+    }
+
+    size_t rounded = 1;
+    while (rounded < capacity) rounded *= 2;
+
+    workers = std::max<size_t>(workers, 1);
+    for (size_t i = 0; i < workers; i++)
+    {
+        mRings.push_back(std::unique_ptr<CronCalcPoolRing>(new CronCalcPoolRing(rounded)));
+    }
+    for (size_t i = 0; i < workers; i++)
+    {
+        mThreads.push_back(std::thread(&CronCalcPool::work, this, i));
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+CronCalcPool::~CronCalcPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStop = true;
+    }
+    mWork.notify_all();
+    for (size_t i = 0; i < mThreads.size(); i++)
+    {
+        mThreads[i].join();
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+bool CronCalcPool::trySubmit(CronCalcCallback callback, size_t id, time_t at, void* context)
+{
+    const Task task = { callback, id, at, context };
+
+    // count the task before it can be taken, so that the counter never goes below 0
+    const size_t depth = mQueued.fetch_add(1) + 1;
+    for (size_t i = 0; i < mRings.size(); i++)
+    {
+        const size_t worker = (mNext + i) % mRings.size();
+        if (mRings[worker]->push(task))
+        {
+            mNext = (worker + 1) % mRings.size();
+
+            size_t maxDepth = mMaxDepth.load(std::memory_order_relaxed);
+            while (depth > maxDepth && !mMaxDepth.compare_exchange_weak(maxDepth, depth, std::memory_order_relaxed))
+            {
+            }
+            // pairs with check of mQueued by worker going to sleep
+            if (mSleeping.load() > 0)
+            {
+                std::lock_guard<std::mutex> lock(mLock);
+                mWork.notify_one();
+            }
+            return true;
+        }
+    }
+    mQueued.fetch_sub(1);
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+
+bool CronCalcPool::submit(CronCalcCallback callback, size_t id, time_t at, void* context)
+{
+    if (trySubmit(callback, id, at, context))
+    {
+        mSubmitted.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    if (mOverflow == REJECT)
+    {
+        mRejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    mBlocked.fetch_add(1, std::memory_order_relaxed);
+    // pairs with check of mWaiting by worker, which has taken a task
+    mWaiting++;
+    for (;;)
+    {
+        // a task taken after this point frees a slot and changes the counter
+        const uint64_t taken = mTaken.load();
+        if (trySubmit(callback, id, at, context)) break;
+
+        std::unique_lock<std::mutex> lock(mLock);
+        mDone.wait(lock, [this, taken] { return mTaken.load() != taken; });
+    }
+    mWaiting--;
+    mSubmitted.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void CronCalcPool::drain()
+{
+    std::unique_lock<std::mutex> lock(mLock);
+    mWaiting++;
+    while (mQueued.load() > 0 || mRunning.load() > 0)
+    {
+        mDone.wait(lock);
+    }
+    mWaiting--;
+}
+
+// ----------------------------------------------------------------------------
+
+void CronCalcPool::record(time_t at)
+{
+    const int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    const int64_t lagUs = std::max<int64_t>(0, nowUs - int64_t(at) * 1000000);
+
+    mLagTotalUs.fetch_add(uint64_t(lagUs), std::memory_order_relaxed);
+    uint64_t maxLag = mLagMaxUs.load(std::memory_order_relaxed);
+    while (uint64_t(lagUs) > maxLag && !mLagMaxUs.compare_exchange_weak(maxLag, uint64_t(lagUs), std::memory_order_relaxed))
+    {
+    }
+
+    size_t bucket = 0;
+    for (int64_t ms = lagUs / 1000; ms > 0 && bucket + 1 < LAG_BUCKETS; ms /= 2)
+    {
+        bucket++;
+    }
+    mLagBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+// Wakes submit() and drain() calls, if they wait for workers
+void CronCalcPool::notifyWaiting()
+{
+    if (mWaiting.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mDone.notify_all();
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void CronCalcPool::work(size_t worker)
+{
+    const size_t numRings = mRings.size();
+    for (;;)
+    {
+        Task task = Task();
+        size_t from = 0;
+        for (; from < numRings; from++)
+        {
+            // own ring first, then other ones
+            mRunning++;
+            if (mRings[(worker + from) % numRings]->take(task)) break;
+            mRunning--;
+        }
+
+        if (from < numRings)
+        {
+            mQueued--;
+            // slot is free, submit() blocked on full rings may proceed
+            mTaken++;
+            notifyWaiting();
+            record(task.at);
+            task.callback(task.id, task.at, task.context);
+
+            mExecuted.fetch_add(1, std::memory_order_relaxed);
+            if (from > 0) mStolen.fetch_add(1, std::memory_order_relaxed);
+            mRunning--;
+            notifyWaiting();
+            continue;
+        }
+        // failed attempts changed mRunning, drain() may wait for it to become 0
+        notifyWaiting();
+
+        std::unique_lock<std::mutex> lock(mLock);
+        mSleeping++;
+        // pairs with check of mSleeping in trySubmit()
+        while (mQueued.load() == 0 && !mStop)
+        {
+            mWork.wait(lock);
+        }
+        mSleeping--;
+        if (mQueued.load() == 0 && mStop)
+        {
+            return;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+CronCalcPool::Metrics CronCalcPool::metrics() const
+{
+    Metrics m;
+    m.depth = mQueued.load();
+    m.maxDepth = mMaxDepth.load();
+    m.submitted = mSubmitted.load();
+    m.rejected = mRejected.load();
+    m.executed = mExecuted.load();
+    m.stolen = mStolen.load();
+    m.blocked = mBlocked.load();
+    m.lagTotalUs = mLagTotalUs.load();
+    m.lagMaxUs = mLagMaxUs.load();
+    for (size_t i = 0; i < LAG_BUCKETS; i++)
+    {
+        m.lagBuckets[i] = mLagBuckets[i].load();
+    }
+    return m;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t CronCalcPool::depth(size_t worker) const
+{
+    return worker < mRings.size() ? mRings[worker]->size() : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t CronCalcPool::workers() const
+{
+    return mThreads.size();
+}
+
+// ----------------------------------------------------------------------------
+
+void CronCalcPool::dispatch(size_t id, time_t at, void* context)
+{
+    const CronCalcPoolCallback* job = static_cast<const CronCalcPoolCallback*>(context);
+    job->pool->submit(job->callback, id, at, job->context);
+}
@@ -0,0 +1,177 @@
+// Copyright (c) 2018-2019 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CRON_CALC_POOL_HPP_
+#define CRON_CALC_POOL_HPP_
+
+// Worker pool for callbacks of fired rules, requires C++11 and threads.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cron_calc_scheduler.hpp"
+
+class CronCalcPoolRing;
+
+/**
+ * Runs callbacks of fired rules on worker threads.
+ *
+ * Each worker has bounded ring of tasks, submit() puts task at the tail of one of them
+ * in round-robin order, workers take tasks from the head of their own ring, and steal
+ * from the head of other ones when it's empty. Rings are plain lock-free FIFO queues with
+ * single producer and many consumers, not work-stealing deques: tasks are queued by
+ * submit() rather than by workers, so there is no owner end to take newest tasks from,
+ * and tasks of each ring start in order they were queued. Locks are taken only to put idle workers
+ * to sleep and to wake them up, and to block submit() until a worker takes a task
+ * while all rings are full.
+ *
+ * submit() must be called from one thread at a time, which is the case for the thread
+ * running CronCalcScheduler, callbacks may be run concurrently and in any order.
+ *
+ *     CronCalcPool pool(4, 1024, CronCalcPool::BLOCK);
+ *     CronCalcPoolCallback job = { &pool, onFire, context };
+ *     scheduler.addRule("0 0 * * *", CRON_CALC_OPT_DEFAULT, CronCalcPool::dispatch, &job, NULL, NULL);
+ */
+class CronCalcPool
+{
+public:
+    /**
+     * What submit() does when all rings are full.
+     */
+    enum Overflow
+    {
+        BLOCK,      // waits until a worker takes a task
+        REJECT      // returns false, task is counted as rejected
+    };
+
+    enum
+    {
+        LAG_BUCKETS = 16    // lag histogram buckets, see Metrics::lagBuckets
+    };
+
+    /**
+     * Snapshot of pool counters.
+     */
+    struct Metrics
+    {
+        size_t depth;           // tasks queued at the moment
+        size_t maxDepth;        // the largest depth so far
+        uint64_t submitted;
+        uint64_t rejected;
+        uint64_t executed;
+        uint64_t stolen;        // tasks executed by worker other than the one they were queued to
+        uint64_t blocked;       // submit() calls, which waited for space
+        uint64_t lagTotalUs;    // sum of lags between scheduled instant and start of execution
+        uint64_t lagMaxUs;
+        // lagBuckets[0] counts lags under 1 ms, lagBuckets[i] counts lags in [2^(i-1), 2^i) ms,
+        // the last bucket counts all longer lags
+        uint64_t lagBuckets[LAG_BUCKETS];
+    };
+
+    /**
+     * Starts worker threads.
+     *
+     * @param workers Number of worker threads, at least 1.
+     * @param capacity Capacity of each worker ring, rounded up to power of 2.
+     * @param overflow What submit() does when all rings are full.
+     */
+    CronCalcPool(size_t workers, size_t capacity, Overflow overflow);
+
+    /**
+     * Runs all queued tasks, then stops worker threads.
+     */
+    ~CronCalcPool();
+
+    /**
+     * Queues callback to run on a worker thread.
+     *
+     * @param callback Function to call, see CronCalcCallback.
+     * @param id Rule ID passed to callback.
+     * @param at Instant the rule fired at, lag is measured from it.
+     * @param context Pointer passed to callback as is.
+     * @return false If task was rejected.
+     */
+    bool submit(CronCalcCallback callback, size_t id, time_t at, void* context);
+
+    /**
+     * Blocks until all queued tasks have been run.
+     */
+    void drain();
+
+    /**
+     * @return Counters of the pool, each counter is consistent by itself,
+     *         but they are not sampled at exactly the same moment.
+     */
+    Metrics metrics() const;
+
+    /**
+     * @return Number of tasks queued to given worker.
+     */
+    size_t depth(size_t worker) const;
+
+    /**
+     * @return Number of worker threads.
+     */
+    size_t workers() const;
+
+    /**
+     * CronCalcCallback, which submits callback given in context to the pool.
+     *
+     * @param context Pointer to CronCalcPoolCallback, which must live while the rule is scheduled.
+     */
+    static void dispatch(size_t id, time_t at, void* context);
+
+private:
+    CronCalcPool(const CronCalcPool&) = delete;
+    CronCalcPool& operator=(const CronCalcPool&) = delete;
+
+    bool trySubmit(CronCalcCallback callback, size_t id, time_t at, void* context);
+    void work(size_t worker);
+    void record(time_t at);
+    void notifyWaiting();
+
+private:
+    std::vector<std::unique_ptr<CronCalcPoolRing> > mRings;
+    std::vector<std::thread> mThreads;
+    const Overflow mOverflow;
+    size_t mNext;                           // worker to queue the next task to
+
+    std::mutex mLock;
+    std::condition_variable mWork;          // signalled when tasks are queued or pool stops
+    std::condition_variable mDone;          // signalled when tasks are taken or done while submit() or drain() waits
+    std::atomic<size_t> mQueued;
+    std::atomic<uint64_t> mTaken;           // tasks taken by workers so far, waited for by submit()
+    std::atomic<size_t> mRunning;
+    std::atomic<size_t> mSleeping;
+    std::atomic<size_t> mWaiting;           // submit() and drain() calls waiting for workers
+    std::atomic<bool> mStop;
+
+    std::atomic<size_t> mMaxDepth;
+    std::atomic<uint64_t> mSubmitted;
+    std::atomic<uint64_t> mRejected;
+    std::atomic<uint64_t> mExecuted;
+    std::atomic<uint64_t> mStolen;
+    std::atomic<uint64_t> mBlocked;
+    std::atomic<uint64_t> mLagTotalUs;
+    std::atomic<uint64_t> mLagMaxUs;
+    std::atomic<uint64_t> mLagBuckets[LAG_BUCKETS];
+};
+
+/**
+ * Context of CronCalcPool::dispatch(), callback to run in the pool.
+ */
+struct CronCalcPoolCallback
+{
+    CronCalcPool* pool;
+    CronCalcCallback callback;
+    void* context;
+};
+
+#endif // CRON_CALC_POOL_HPP_
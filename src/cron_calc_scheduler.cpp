@@ -0,0 +1,455 @@
+// Copyright (c) 2018-2019 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include <algorithm>
+
+#include "cron_calc_scheduler.hpp"
+#include "cron_calc_array.hpp"
+
+// ----------------------------------------------------------------------------
+
+namespace
+{
+
+const size_t NONE = size_t(-1);
+
+const time_t LEVEL_SPANS[] = { 1, 60, 3600, 86400 };    // slot span of each level, and span of all wheel
+const size_t LEVEL_SLOTS[] = { 60, 60, 24 };
+const size_t LEVEL_FIRST[] = { 0, 60, 120 };            // index of first slot of each level in list heads
+const size_t LEVELS = 3;
+
+// Lists of rules, besides wheel slots
+enum
+{
+    LIST_FIRING = 144,      // rules firing at current instant
+    LIST_HEADS,             // number of lists with heads
+    LIST_OVERFLOW = LIST_HEADS, // rules in the heap
+    LIST_FREE               // unused storage, linked by `next`
+};
+
+} // namespace
+
+/**
+ * Scheduled rule, which is an element of doubly linked list of wheel slot,
+ * or an element of the heap, then `prev` is its position there.
+ */
+struct CronCalcTimer
+{
+    cron_calc rule;
+    time_t due;
+    CronCalcCallback callback;
+    void* context;
+    size_t prev;
+    size_t next;
+    size_t list;
+};
+
+/**
+ * Rule ID is the index in `mTimers`. Wheel levels of seconds, minutes and hours
+ * have slots of 1, 60 and 3600 seconds, rule is placed at the lowest level, which spans
+ * its instant from current time, into slot of this instant. When current time reaches
+ * start of higher level slot, its rules are placed again, moving down the wheel.
+ * Rules firing later than in a day are kept in min-heap `mHeap` by their instants,
+ * its storage is as large as `mTimers`, so that moving rules there never fails.
+ */
+class CronCalcSchedulerImpl
+{
+public:
+    explicit CronCalcSchedulerImpl(time_t now) : mFree(NONE), mSize(0), mHeapSize(0), mNow(now), mStopped(false)
+    {
+        std::fill(mHeads, mHeads + LIST_HEADS, NONE);
+        std::fill(mCounts, mCounts + LEVELS, 0);
+    }
+
+    CronCalcTimer& timer(size_t id) { return mTimers.data()[id]; }
+
+    void link(size_t id, size_t list)
+    {
+        CronCalcTimer& t = timer(id);
+        t.list = list;
+        t.prev = NONE;
+        t.next = mHeads[list];
+        if (t.next != NONE) timer(t.next).prev = id;
+        mHeads[list] = id;
+        if (list < LIST_FIRING) mCounts[list < LEVEL_FIRST[1] ? 0 : list < LEVEL_FIRST[2] ? 1 : 2]++;
+    }
+
+    void unlink(size_t id)
+    {
+        CronCalcTimer& t = timer(id);
+        if (t.list == LIST_OVERFLOW)
+        {
+            heapRemove(t.prev);
+            return;
+        }
+        if (t.prev != NONE) timer(t.prev).next = t.next;
+        else mHeads[t.list] = t.next;
+        if (t.next != NONE) timer(t.next).prev = t.prev;
+        if (t.list < LIST_FIRING) mCounts[t.list < LEVEL_FIRST[1] ? 0 : t.list < LEVEL_FIRST[2] ? 1 : 2]--;
+    }
+
+    // Places rule by its instant, which is not earlier than current time
+    void schedule(size_t id)
+    {
+        const time_t due = timer(id).due;
+        for (size_t level = 0; level < LEVELS; level++)
+        {
+            if (due - mNow < LEVEL_SPANS[level + 1])
+            {
+                link(id, LEVEL_FIRST[level] + size_t(due / LEVEL_SPANS[level]) % LEVEL_SLOTS[level]);
+                return;
+            }
+        }
+        heapPush(id);
+    }
+
+    // Places all rules of given list again
+    void cascade(size_t list)
+    {
+        size_t id = mHeads[list];
+        while (id != NONE)
+        {
+            const size_t next = timer(id).next;
+            unlink(id);
+            schedule(id);
+            id = next;
+        }
+    }
+
+    void release(size_t id)
+    {
+        timer(id).list = LIST_FREE;
+        timer(id).next = mFree;
+        mFree = id;
+        mSize--;
+    }
+
+    // Fires rules of current time, after moving rules, which reach it, down the wheel
+    size_t tick()
+    {
+        while (mHeapSize > 0 && timer(mHeap.data()[0]).due - mNow < LEVEL_SPANS[LEVELS])
+        {
+            const size_t id = mHeap.data()[0];
+            heapRemove(0);
+            schedule(id);
+        }
+        for (size_t level = LEVELS - 1; level > 0; level--)
+        {
+            if (mNow % LEVEL_SPANS[level] == 0)
+            {
+                cascade(LEVEL_FIRST[level] + size_t(mNow / LEVEL_SPANS[level]) % LEVEL_SLOTS[level]);
+            }
+        }
+
+        size_t fired = 0;
+        for (size_t id = mHeads[size_t(mNow % LEVEL_SLOTS[0])]; id != NONE; id = mHeads[size_t(mNow % LEVEL_SLOTS[0])])
+        {
+            unlink(id);
+            link(id, LIST_FIRING);
+        }
+        // callbacks may add rules, which moves storage, or cancel rules in this list
+        while (mHeads[LIST_FIRING] != NONE)
+        {
+            const size_t id = mHeads[LIST_FIRING];
+            const CronCalcCallback callback = timer(id).callback;
+            void* const context = timer(id).context;
+
+            unlink(id);
+            timer(id).due = cron_calc_next(&timer(id).rule, mNow);
+            if (timer(id).due != CRON_CALC_INVALID_TIME)
+            {
+                schedule(id);
+            }
+            else
+            {
+                release(id);
+            }
+            callback(id, mNow, context);
+            fired++;
+        }
+        return fired;
+    }
+
+    // @return The earliest instant in given wheel level, CRON_CALC_INVALID_TIME if it's empty
+    time_t levelFiring(size_t level) const
+    {
+        if (!mCounts[level]) return CRON_CALC_INVALID_TIME;
+
+        // slots in order of time starting after current one, the last is current slot itself,
+        // which holds rules of the next wheel turn
+        const size_t current = size_t(mNow / LEVEL_SPANS[level]);
+        for (size_t k = 1; k <= LEVEL_SLOTS[level]; k++)
+        {
+            size_t id = mHeads[LEVEL_FIRST[level] + (current + k) % LEVEL_SLOTS[level]];
+            if (id == NONE) continue;
+
+            time_t earliest = mTimers.data()[id].due;
+            for (; id != NONE; id = mTimers.data()[id].next)
+            {
+                earliest = std::min(earliest, mTimers.data()[id].due);
+            }
+            return earliest;
+        }
+        return CRON_CALC_INVALID_TIME;
+    }
+
+    void heapPush(size_t id)
+    {
+        timer(id).list = LIST_OVERFLOW;
+        mHeap.data()[mHeapSize] = id;
+        siftUp(mHeapSize++);
+    }
+
+    void heapRemove(size_t pos)
+    {
+        size_t* heap = mHeap.data();
+        if (pos != --mHeapSize)
+        {
+            const size_t moved = heap[mHeapSize];
+            heap[pos] = moved;
+            siftDown(pos);
+            siftUp(timer(moved).prev);
+        }
+    }
+
+    void siftUp(size_t pos)
+    {
+        size_t* heap = mHeap.data();
+        const size_t id = heap[pos];
+        while (pos > 0)
+        {
+            const size_t parent = (pos - 1) / 2;
+            if (timer(heap[parent]).due <= timer(id).due) break;
+            heap[pos] = heap[parent];
+            timer(heap[pos]).prev = pos;
+            pos = parent;
+        }
+        heap[pos] = id;
+        timer(id).prev = pos;
+    }
+
+    void siftDown(size_t pos)
+    {
+        size_t* heap = mHeap.data();
+        const size_t id = heap[pos];
+        for (;;)
+        {
+            size_t child = 2 * pos + 1;
+            if (child >= mHeapSize) break;
+            if (child + 1 < mHeapSize && timer(heap[child + 1]).due < timer(heap[child]).due) child++;
+            if (timer(id).due <= timer(heap[child]).due) break;
+            heap[pos] = heap[child];
+            timer(heap[pos]).prev = pos;
+            pos = child;
+        }
+        heap[pos] = id;
+        timer(id).prev = pos;
+    }
+
+    CronCalcArray<CronCalcTimer> mTimers;
+    CronCalcArray<size_t> mHeap;
+    size_t mHeads[LIST_HEADS];
+    size_t mCounts[LEVELS];     // number of rules in each wheel level
+    size_t mFree;               // the first unused element of `mTimers`
+    size_t mSize;               // number of scheduled rules
+    size_t mHeapSize;
+    time_t mNow;
+    bool mStopped;
+};
+
+// ----------------------------------------------------------------------------
+
+CronCalcScheduler::CronCalcScheduler(time_t now) :
+#ifndef CRON_CALC_NO_EXCEPT
+    mPimpl(new CronCalcSchedulerImpl(now))
+#else
+    mPimpl(new (std::nothrow) CronCalcSchedulerImpl(now))
+#endif
+{
+}
+
+// ----------------------------------------------------------------------------
+
+CronCalcScheduler::~CronCalcScheduler()
+{
+    delete mPimpl;
+}
+
+// ----------------------------------------------------------------------------
+
+#ifdef CRON_CALC_NO_EXCEPT
+    #define RET_UNLESS_INIT(ret_) if (!mPimpl) return (ret_);
+#else
+    #define RET_UNLESS_INIT(ret_)
+#endif
+
+// ----------------------------------------------------------------------------
+
+cron_calc_error CronCalcScheduler::addRule(
+    const char* expr,
+    cron_calc_option_mask options,
+    CronCalcCallback callback,
+    void* context,
+    size_t* id,
+    const char** err_location)
+{
+    RET_UNLESS_INIT(CRON_CALC_ERROR_OOM);
+
+    if (!callback)
+    {
+        return CRON_CALC_ERROR_ARGUMENT;
+    }
+
+    cron_calc rule;
+    const cron_calc_error err = cron_calc_parse(&rule, expr, options, err_location);
+    if (err)
+    {
+        return err;
+    }
+
+    CronCalcSchedulerImpl& impl = *mPimpl;
+    const time_t due = cron_calc_next(&rule, impl.mNow);
+    if (due == CRON_CALC_INVALID_TIME)
+    {
+        return CRON_CALC_ERROR_IMPOSSIBLE_DATE;
+    }
+
+    size_t newId = impl.mFree;
+    if (newId == NONE)
+    {
+        newId = impl.mTimers.size();
+        if (!impl.mTimers.resize(newId + 1) || !impl.mHeap.resize(newId + 1))
+        {
+            impl.mTimers.resize(newId);
+            return CRON_CALC_ERROR_OOM;
+        }
+    }
+    else
+    {
+        impl.mFree = impl.timer(newId).next;
+    }
+
+    CronCalcTimer& timer = impl.timer(newId);
+    timer.rule = rule;
+    timer.due = due;
+    timer.callback = callback;
+    timer.context = context;
+    impl.schedule(newId);
+    impl.mSize++;
+
+    if (id) *id = newId;
+    return CRON_CALC_OK;
+}
+
+// ----------------------------------------------------------------------------
+
+bool CronCalcScheduler::cancel(size_t id)
+{
+    RET_UNLESS_INIT(false);
+
+    CronCalcSchedulerImpl& impl = *mPimpl;
+    if (id >= impl.mTimers.size() || impl.timer(id).list == LIST_FREE)
+    {
+        return false;
+    }
+    impl.unlink(id);
+    impl.release(id);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t CronCalcScheduler::size() const
+{
+    RET_UNLESS_INIT(0);
+
+    return mPimpl->mSize;
+}
+
+// ----------------------------------------------------------------------------
+
+time_t CronCalcScheduler::now() const
+{
+    RET_UNLESS_INIT(CRON_CALC_INVALID_TIME);
+
+    return mPimpl->mNow;
+}
+
+// ----------------------------------------------------------------------------
+
+time_t CronCalcScheduler::nextFiring() const
+{
+    RET_UNLESS_INIT(CRON_CALC_INVALID_TIME);
+
+    const CronCalcSchedulerImpl& impl = *mPimpl;
+    time_t earliest = impl.mHeapSize > 0 ? impl.mTimers.data()[impl.mHeap.data()[0]].due : CRON_CALC_INVALID_TIME;
+    for (size_t level = 0; level < LEVELS; level++)
+    {
+        const time_t t = impl.levelFiring(level);
+        if (t != CRON_CALC_INVALID_TIME && (earliest == CRON_CALC_INVALID_TIME || t < earliest))
+        {
+            earliest = t;
+        }
+    }
+    return earliest;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t CronCalcScheduler::advance(time_t now)
+{
+    RET_UNLESS_INIT(0);
+
+    CronCalcSchedulerImpl& impl = *mPimpl;
+    size_t fired = 0;
+
+    while (impl.mNow < now)
+    {
+        // skip to the start of slot of the lowest non-empty level, there is nothing to do before
+        time_t next = impl.mNow + 1;
+        for (size_t level = 0; level < LEVELS && !impl.mCounts[level]; level++)
+        {
+            next = level + 1 < LEVELS ? (impl.mNow / LEVEL_SPANS[level + 1] + 1) * LEVEL_SPANS[level + 1] : now;
+        }
+        if (impl.mHeapSize > 0)
+        {
+            // when the earliest rule in the heap gets into the wheel
+            const time_t due = impl.timer(impl.mHeap.data()[0]).due;
+            next = std::min(next, std::max(impl.mNow + 1, due - LEVEL_SPANS[LEVELS] + 1));
+        }
+
+        impl.mNow = std::min(next, now);
+        fired += impl.tick();
+    }
+    return fired;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t CronCalcScheduler::run(CronCalcWait wait, void* context)
+{
+    RET_UNLESS_INIT(0);
+
+    CronCalcSchedulerImpl& impl = *mPimpl;
+    size_t fired = 0;
+
+    impl.mStopped = false;
+    while (!impl.mStopped && impl.mSize > 0)
+    {
+        fired += advance(time(NULL));
+        if (impl.mStopped || impl.mSize == 0 || !wait(nextFiring(), context))
+        {
+            break;
+        }
+    }
+    return fired;
+}
+
+// ----------------------------------------------------------------------------
+
+void CronCalcScheduler::stop()
+{
+    if (mPimpl) mPimpl->mStopped = true;
+}
@@ -0,0 +1,132 @@
+// Copyright (c) 2018-2019 Sergey Burnevsky (sergey.burnevsky @ gmail.com)
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CRON_CALC_SCHEDULER_HPP_
+#define CRON_CALC_SCHEDULER_HPP_
+
+#include "cron_calc.h"
+
+class CronCalcSchedulerImpl;
+
+/**
+ * Called when rule fires.
+ *
+ * @param id ID of the rule, as returned by CronCalcScheduler::addRule().
+ * @param at Instant the rule fires at, which may be earlier than current time,
+ *           if scheduler was advanced late.
+ * @param context Context pointer given to CronCalcScheduler::addRule().
+ */
+typedef void (*CronCalcCallback)(size_t id, time_t at, void* context);
+
+/**
+ * Waits for the time to pass, used by CronCalcScheduler::run().
+ *
+ * @param until Instant of the earliest rule, waiting may end earlier, e.g. to add rules.
+ * @param context Context pointer given to CronCalcScheduler::run().
+ * @return false To stop run().
+ */
+typedef bool (*CronCalcWait)(time_t until, void* context);
+
+/**
+ * Calls callbacks of Cron rules when they fire.
+ *
+ * Rules are kept in hierarchical timing wheel of seconds, minutes and hours,
+ * with rules firing later than in a day kept in a min-heap. Each rule is placed into
+ * wheel by its next instant calculated by cron_calc_next(), moves to lower levels
+ * as time passes and is placed again by its following instant after it fires.
+ * Adding, cancelling and firing a rule takes constant time, except for rules in the heap.
+ *
+ * Scheduler is not synchronized, all calls must be done from one thread,
+ * callbacks are called from advance() and may add or cancel rules.
+ */
+class CronCalcScheduler
+{
+public:
+    /**
+     * @param now Current time, rules fire after it.
+     */
+    explicit CronCalcScheduler(time_t now);
+    ~CronCalcScheduler();
+
+    /**
+     * Adds Cron expression, which fires after current time.
+     *
+     * @param expr Cron expression.
+     * @param options Parsing options.
+     * @param callback Function to call when rule fires.
+     * @param context Pointer passed to callback as is.
+     * @param[out] id ID of added rule, may be NULL. IDs of cancelled rules are reused.
+     * @param[out] err_location Location of parsing error, may be NULL.
+     * @return CRON_CALC_OK On success.
+     * @return CRON_CALC_ERROR_IMPOSSIBLE_DATE If rule never fires after current time.
+     * @return CRON_CALC_ERROR_ARGUMENT If callback is NULL.
+     * @return CRON_CALC_ERROR_OOM If storage can't be allocated.
+     * @see cron_calc_parse() for details on parsing errors.
+     */
+    cron_calc_error addRule(
+        const char* expr,
+        cron_calc_option_mask options,
+        CronCalcCallback callback,
+        void* context,
+        size_t* id,
+        const char** err_location);
+
+    /**
+     * Removes rule, it won't fire anymore and its ID may be reused.
+     *
+     * @return false If there is no such rule.
+     */
+    bool cancel(size_t id);
+
+    /**
+     * @return Number of rules, which may fire.
+     *         Rules having no more instants are removed after their last firing.
+     */
+    size_t size() const;
+
+    /**
+     * @return Current time, until which all rules have fired.
+     */
+    time_t now() const;
+
+    /**
+     * @return The earliest instant, at which some rule fires,
+     *         CRON_CALC_INVALID_TIME if there are no rules.
+     */
+    time_t nextFiring() const;
+
+    /**
+     * Moves current time forward and calls callbacks of rules firing up to given time,
+     * inclusively, in order of their instants. Each rule fires once per instant,
+     * even if advanced late. Does nothing if given time is not after current time.
+     *
+     * @return Number of callbacks called.
+     */
+    size_t advance(time_t now);
+
+    /**
+     * Runs scheduling loop: advances to system time, then waits until the next firing,
+     * until there are no rules, stop() is called, or wait function returns false.
+     *
+     * @param wait Function to wait for the next firing.
+     * @param context Pointer passed to wait function as is.
+     * @return Number of callbacks called.
+     */
+    size_t run(CronCalcWait wait, void* context);
+
+    /**
+     * Makes run() return after current advance, may be called from callbacks.
+     */
+    void stop();
+
+private:
+    CronCalcScheduler(const CronCalcScheduler&);
+    const CronCalcScheduler& operator=(const CronCalcScheduler&);
+
+private:
+    CronCalcSchedulerImpl* mPimpl;
+};
+
+#endif // CRON_CALC_SCHEDULER_HPP_
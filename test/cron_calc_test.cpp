@@ -11,8 +11,15 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstddef>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 #include "cron_calc.hpp"
+#include "cron_calc_constexpr.hpp"
+#include "cron_calc_scheduler.hpp"
+#include "cron_calc_pool.hpp"
+#include "cron_calc_cache.hpp"
 
 /* ---------------------------------------------------------------------------- */
 
@@ -93,6 +100,26 @@ time_t parseTimeString(const char* tm_str)
 
 /* ---------------------------------------------------------------------------- */
 
+time_t parseUtcTimeString(const char* tm_str)
+{
+    struct tm tm_val = { 0 };
+
+    if (sscanf(tm_str, TM_SCAN_FMT,
+        &tm_val.tm_year, &tm_val.tm_mon, &tm_val.tm_mday,
+        &tm_val.tm_hour, &tm_val.tm_min, &tm_val.tm_sec) != 6)
+    {
+        printf("ERROR: Can't parse time string '%s'\n", tm_str);
+        return CRON_CALC_INVALID_TIME;
+    }
+    tm_val.tm_year -= 1900;
+    tm_val.tm_mon -= 1;
+    return timegm(&tm_val);
+}
+
+#define TSU(str_) parseUtcTimeString(str_)
+
+/* ---------------------------------------------------------------------------- */
+
 void print_test(const char* kind, const char* expr, cron_calc_option_mask options)
 {
 #if CRON_CALC_TEST_VERBOSE
@@ -136,6 +163,39 @@ bool check_eq_time(time_t t1, time_t t2, const char* expr1, const char* expr2, i
 
 /* ---------------------------------------------------------------------------- */
 
+/* Compile-time parser must give the same results as run-time one */
+void check_constexpr_parse(const char* expr, cron_calc_option_mask options, int lineno)
+{
+    cron_calc expected;
+    const char* err_location = NULL;
+    const cron_calc_error err = cron_calc_parse(&expected, expr, options, &err_location);
+    const cron::parse_result actual = cron::parse(expr, options);
+
+    CHECK_EQ_INT_LN(err, actual.error, lineno);
+    if (err)
+    {
+        CHECK_EQ_INT_LN(err_location - expr, actual.error_offset, lineno);
+    }
+    else
+    {
+        CHECK_TRUE_LN(expected.years == actual.rule.years, lineno);
+        CHECK_TRUE_LN(expected.seconds == actual.rule.seconds, lineno);
+        CHECK_TRUE_LN(expected.minutes == actual.rule.minutes, lineno);
+        CHECK_EQ_INT_LN(expected.hours, actual.rule.hours, lineno);
+        CHECK_EQ_INT_LN(expected.days, actual.rule.days, lineno);
+        CHECK_EQ_INT_LN(expected.months, actual.rule.months, lineno);
+        CHECK_EQ_INT_LN(expected.weekDays, actual.rule.weekDays, lineno);
+        CHECK_EQ_INT_LN(expected.options, actual.rule.options, lineno);
+        CHECK_EQ_INT_LN(expected.yearBase, actual.rule.yearBase, lineno);
+        CHECK_EQ_INT_LN(expected.yearStep, actual.rule.yearStep, lineno);
+        CHECK_EQ_INT_LN(expected.yearEnd, actual.rule.yearEnd, lineno);
+        CHECK_EQ_INT_LN(expected.kernel, actual.rule.kernel, lineno);
+        CHECK_EQ_INT_LN(0, memcmp(&expected, &actual.rule, sizeof expected), lineno);
+    }
+}
+
+/* ---------------------------------------------------------------------------- */
+
 void check_invalid(
     const char* expr,
     cron_calc_option_mask options,
@@ -148,6 +208,14 @@ void check_invalid(
     print_test("invalid", expr, options);
     CHECK_EQ_INT_LN(err, cron.addRule(expr, options, &err_location), lineno);
     CHECK_EQ_INT_LN(err_offset, err_location - expr, lineno);
+    check_constexpr_parse(expr, options, lineno);
+
+    /* the same in a buffer with more data after the expression */
+    const std::string buffer = std::string(expr) + "* 1";
+    cron_calc cc;
+    size_t offset = 0;
+    CHECK_EQ_INT_LN(err, cron_calc_parse_n(&cc, buffer.data(), strlen(expr), options, &offset), lineno);
+    CHECK_EQ_INT_LN(err_offset, offset, lineno);
 }
 
 #define CHECK_INVALID(expr_, opts_, err_, err_offset_) \
@@ -181,6 +249,7 @@ bool check_next(
     {
         return false;
     }
+    check_constexpr_parse(expr, options, __LINE__);
 
     time_t tinit = parseTimeString(initial);
     CHECK_TRUE(tinit != CRON_CALC_INVALID_TIME);
@@ -213,6 +282,104 @@ bool check_next(
 
 /* ---------------------------------------------------------------------------- */
 
+bool check_prev(
+    const char* expr,
+    cron_calc_option_mask options,
+    const char* initial,
+    const char* prev)
+{
+    int numErrors = gNumErrors;
+
+    cron_calc cc;
+    const char* err_location = NULL;
+
+    print_test("valid", expr, options);
+
+    CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc, expr, options, &err_location));
+    CHECK_TRUE(NULL == err_location);
+
+    time_t tinit = parseTimeString(initial);
+    CHECK_TRUE(tinit != CRON_CALC_INVALID_TIME);
+
+    while (prev)
+    {
+        time_t tprev = CRON_CALC_INVALID_TIME;
+
+        if (*prev != '-')
+        {
+            tprev = parseTimeString(prev);
+            CHECK_TRUE(tprev != CRON_CALC_INVALID_TIME);
+        }
+
+        CHECK_EQ_TIME(tprev, cron_calc_prev(&cc, tinit));
+        tinit = tprev;
+
+        prev = strchr(prev, ',');
+        if (prev)
+        {
+            prev++;
+        }
+    }
+
+    return (numErrors == gNumErrors);
+}
+
+#define CHECK_PREV(expr_, opts_, start_, prev_) \
+    CHECK_TRUE_LN(check_prev(expr_, opts_, start_, prev_), __LINE__)
+
+/* ---------------------------------------------------------------------------- */
+
+/* Checks that optimized rule set fires at the same instants as original one, reporting same rules */
+void check_optimized(
+    const char* const* exprs,
+    size_t n,
+    cron_calc_option_mask options,
+    const char* initial,
+    int steps,
+    int lineno)
+{
+    CronCalc plain;
+    CronCalc optimized;
+    CHECK_EQ_INT_LN(CRON_CALC_OK, plain.addRules(exprs, n, options, NULL, NULL), lineno);
+    CHECK_EQ_INT_LN(CRON_CALC_OK, optimized.addRules(exprs, n - 1, options, NULL, NULL), lineno);
+    CHECK_EQ_INT_LN(CRON_CALC_OK, optimized.optimize(), lineno);
+    /* the last rule is not optimized on the first pass */
+    CHECK_EQ_INT_LN(CRON_CALC_OK, optimized.addRules(exprs + n - 1, 1, options, NULL, NULL), lineno);
+    CHECK_EQ_INT_LN(n, optimized.size(), lineno);
+
+    std::vector<size_t> expected_ids(n);
+    size_t expected_count = 0;
+    size_t ids[4] = { 0 };
+    size_t count = 0;
+    /* passes: partially optimized, fully optimized, compiled */
+    for (int pass = 0; pass < 3; pass++)
+    {
+        time_t t = parseTimeString(initial);
+        for (int step = 0; step < steps && t != CRON_CALC_INVALID_TIME; step++)
+        {
+            const time_t expected = plain.next(t, &expected_ids[0], n, &expected_count);
+            /* both without and with cache */
+            for (int cached = 0; cached < 2; cached++)
+            {
+                CHECK_EQ_INT_LN(expected, cached ? optimized.nextCached(t, ids, 4, &count)
+                                                 : optimized.next(t, ids, 4, &count), lineno);
+                CHECK_EQ_INT_LN(expected_count, count, lineno);
+                for (size_t i = 0; i < count && i < 4; i++)
+                {
+                    CHECK_EQ_INT_LN(expected_ids[i], ids[i], lineno);
+                }
+            }
+            t = expected;
+        }
+        CHECK_EQ_INT_LN(CRON_CALC_OK, pass == 0 ? optimized.optimize() : optimized.compile(), lineno);
+    }
+}
+
+#define CHECK_OPTIMIZED(exprs_, opts_, initial_, steps_) \
+    check_optimized(exprs_, sizeof(exprs_) / sizeof(exprs_[0]), opts_, initial_, steps_, __LINE__)
+
+/* ---------------------------------------------------------------------------- */
+
 bool check_same(
     const char* expr1,
     cron_calc_option_mask options1,
@@ -266,6 +433,74 @@ bool check_same(
 
 /* ---------------------------------------------------------------------------- */
 
+/* Makes TZif v2 data without transitions, only with given footer */
+size_t makeTzData(uint8_t* data, const char* footer)
+{
+    size_t size = 0;
+    for (int block = 0; block < 2; block++)
+    {
+        static const uint8_t header[] = {
+            'T', 'Z', 'i', 'f', '2', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 1,  0, 0, 0, 4,
+            0, 0, 0, 0, 0, 0, 'U', 'T', 'C', 0 /* ttinfo and designation */
+        };
+        memcpy(data + size, header, sizeof header);
+        size += sizeof header;
+    }
+    size += sprintf((char*) data + size, "\n%s\n", footer);
+    return size;
+}
+
+/* ---------------------------------------------------------------------------- */
+
+/* Records firings of scheduler rules */
+struct SchedulerLog
+{
+    CronCalcScheduler* scheduler;
+    std::vector<std::pair<size_t, time_t> > fired;
+    size_t cancelId;    /* rule to cancel on next firing */
+    size_t waits;
+};
+
+void onSchedulerFire(size_t id, time_t at, void* context)
+{
+    SchedulerLog* log = static_cast<SchedulerLog*>(context);
+    log->fired.push_back(std::make_pair(id, at));
+    if (log->cancelId != size_t(-1))
+    {
+        log->scheduler->cancel(log->cancelId);
+        log->cancelId = size_t(-1);
+    }
+}
+
+bool onSchedulerWait(time_t until, void* context)
+{
+    SchedulerLog* log = static_cast<SchedulerLog*>(context);
+    log->waits++;
+    return until > log->scheduler->now() && log->waits < 2;
+}
+
+/* Counts tasks run in worker pool, holds them while `hold` is set */
+struct PoolLog
+{
+    std::atomic<size_t> runs;
+    std::atomic<size_t> idSum;
+    std::atomic<bool> hold;
+};
+
+void onPoolRun(size_t id, time_t, void* context)
+{
+    PoolLog* log = static_cast<PoolLog*>(context);
+    while (log->hold.load())
+    {
+        std::this_thread::yield();
+    }
+    log->idSum += id;
+    log->runs++;
+}
+
+/* ---------------------------------------------------------------------------- */
+
 int main()
 {
     /* bad invocation */
@@ -318,10 +553,16 @@ int main()
     g_new_fail_count = 0;
 
     CronCalc cron_fail_add;
-    CHECK_EQ_INT(CRON_CALC_OK, cron_fail_add.addRule("* * * * *", CRON_CALC_OPT_DEFAULT, &err_location));
+    for (int i = 0; i < 8; i++)
+    {
+        CHECK_EQ_INT(CRON_CALC_OK, cron_fail_add.addRule("* * * * *", CRON_CALC_OPT_DEFAULT, &err_location));
+    }
     g_new_fail_count = 1;
     CHECK_EQ_INT(CRON_CALC_ERROR_OOM, cron_fail_add.addRule("1 * * * *", CRON_CALC_OPT_DEFAULT, &err_location));
     g_new_fail_count = 0;
+    CHECK_EQ_INT(8, cron_fail_add.size());
+    CHECK_EQ_INT(CRON_CALC_OK, cron_fail_add.addRule("1 * * * *", CRON_CALC_OPT_DEFAULT, &err_location));
+    CHECK_EQ_INT(9, cron_fail_add.size());
 #endif
 
     /* bad format */
@@ -369,17 +610,21 @@ int main()
     CHECK_INVALID("60 59 23 31 12 6", CRON_CALC_OPT_WITH_SECONDS, CRON_CALC_ERROR_NUMBER_RANGE, 0);
     CHECK_INVALID("0-60 59 23 31 12 6", CRON_CALC_OPT_WITH_SECONDS, CRON_CALC_ERROR_NUMBER_RANGE, 2);
     CHECK_INVALID("59,60 59 23 31 12 6", CRON_CALC_OPT_WITH_SECONDS, CRON_CALC_ERROR_NUMBER_RANGE, 3);
-    CHECK_INVALID("59 23 31 12 6 1999", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 14);
-    CHECK_INVALID("59 23 31 12 6 2000,1999", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 19);
-    CHECK_INVALID("59 23 31 12 6 1999-2063", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 14);
-    CHECK_INVALID("59 23 31 12 6 2000-2063,1999", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 24);
-    CHECK_INVALID("59 23 31 12 6 2064", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 14);
-    CHECK_INVALID("59 23 31 12 6 2000,2064", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 19);
-    CHECK_INVALID("59 23 31 12 6 2000-2064", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 19);
-    CHECK_INVALID("59 59 23 31 12 6 1999", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 17);
-    CHECK_INVALID("59 59 23 31 12 6 1999-2063", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 17);
-    CHECK_INVALID("59 59 23 31 12 6 2064", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 17);
-    CHECK_INVALID("59 59 23 31 12 6 2000-2064", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 22);
+    CHECK_INVALID("59 23 31 12 6 1969", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 14);
+    CHECK_INVALID("59 23 31 12 6 2000,1969", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 19);
+    CHECK_INVALID("59 23 31 12 6 1969-2063", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 14);
+    CHECK_INVALID("59 23 31 12 6 2000-2063,1969", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 24);
+    CHECK_INVALID("59 23 31 12 6 2200", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 14);
+    CHECK_INVALID("59 23 31 12 6 2000,2200", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 19);
+    CHECK_INVALID("59 23 31 12 6 2000-2200", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 19);
+    CHECK_INVALID("59 59 23 31 12 6 1969", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 17);
+    CHECK_INVALID("59 59 23 31 12 6 1969-2063", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 17);
+    CHECK_INVALID("59 59 23 31 12 6 2200", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 17);
+    CHECK_INVALID("59 59 23 31 12 6 2000-2200", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 22);
+    /* years must fit into 64 years, followed by arithmetic progression */
+    CHECK_INVALID("59 23 31 12 6 1970,2034,2035", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 14);
+    CHECK_INVALID("59 23 31 12 6 2000,2100,2150,2199", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 14);
+    CHECK_INVALID("59 23 31 12 6 2000-2199/5,2198", CRON_CALC_OPT_WITH_YEARS, CRON_CALC_ERROR_NUMBER_RANGE, 14);
     CHECK_INVALID("59-58 * * * * * *", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 5); /* after wrong number is parsed */
     CHECK_INVALID("59-0 * * * * * *", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 4);
     CHECK_INVALID("* 59-58 * * * * *", CRON_CALC_OPT_FULL, CRON_CALC_ERROR_NUMBER_RANGE, 7);
@@ -430,6 +675,63 @@ int main()
     CHECK_INVALID("* * * MAY-FRI *", CRON_CALC_OPT_DEFAULT, CRON_CALC_ERROR_INVALID_NAME, 10);
     CHECK_INVALID("* * * AUG AUG", CRON_CALC_OPT_DEFAULT, CRON_CALC_ERROR_INVALID_NAME, 10);
 
+    /* separators are the same in any locale, names are matched in any case */
+    {
+        cron_calc names = { 0 }, numbers = { 0 };
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&names, "1\t2\v3\f4\r5", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&numbers, "1 2 3 4 5", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_TRUE(cron_calc_is_same(&names, &numbers));
+        CHECK_INVALID("1\xa0" "2 3 4 5", CRON_CALC_OPT_DEFAULT, CRON_CALC_ERROR_FIELD_FORMAT, 1);
+        CHECK_INVALID("1 2 3 4 \xc4\xc5\xc3", CRON_CALC_OPT_DEFAULT, CRON_CALC_ERROR_NUMBER_EXPECTED, 8);
+
+        static const char* const months[] = { "jan", "FEB", "Mar", "aPR", "MAY", "jUn", "JUL", "aug", "SEP", "Oct", "NOV", "dEC" };
+        static const char* const days[] = { "sun", "MON", "Tue", "wED", "THU", "fri", "SaT" };
+        char expr[32];
+        for (int i = 0; i < 12; i++)
+        {
+            snprintf(expr, sizeof(expr), "0 0 1 %s *", months[i]);
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&names, expr, CRON_CALC_OPT_DEFAULT, NULL));
+            snprintf(expr, sizeof(expr), "0 0 1 %d *", i + 1);
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&numbers, expr, CRON_CALC_OPT_DEFAULT, NULL));
+            CHECK_TRUE(cron_calc_is_same(&names, &numbers));
+        }
+        for (int i = 0; i < 7; i++)
+        {
+            snprintf(expr, sizeof(expr), "0 0 * * %s", days[i]);
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&names, expr, CRON_CALC_OPT_DEFAULT, NULL));
+            snprintf(expr, sizeof(expr), "0 0 * * %d", i);
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&numbers, expr, CRON_CALC_OPT_DEFAULT, NULL));
+            CHECK_TRUE(cron_calc_is_same(&names, &numbers));
+        }
+    }
+
+    /* length-bounded parsing */
+    {
+        const char lines[] = "0 0 * * MON\n*/5 * * * *\r\n0 0 1 1 *\0* * * * *";
+        cron_calc bounded = { 0 }, terminated = { 0 };
+        size_t offset = 0;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse_n(&bounded, lines, 12, CRON_CALC_OPT_DEFAULT, &offset));
+        CHECK_TRUE(offset == CRON_CALC_INVALID_OFFSET);
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&terminated, "0 0 * * MON", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_TRUE(cron_calc_is_same(&bounded, &terminated));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse_n(&bounded, lines + 12, 13, CRON_CALC_OPT_DEFAULT, &offset));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&terminated, "*/5 * * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_TRUE(cron_calc_is_same(&bounded, &terminated));
+        /* NUL ends expression before the length */
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse_n(&bounded, lines + 25, sizeof lines - 26, CRON_CALC_OPT_DEFAULT, &offset));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&terminated, "0 0 1 1 *", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_TRUE(cron_calc_is_same(&bounded, &terminated));
+        /* expression cut in the middle of a name or a number */
+        CHECK_EQ_INT(CRON_CALC_ERROR_INVALID_NAME, cron_calc_parse_n(&bounded, lines, 10, CRON_CALC_OPT_DEFAULT, &offset));
+        CHECK_EQ_INT(8, offset);
+        CHECK_EQ_INT(CRON_CALC_ERROR_EXPR_SHORT, cron_calc_parse_n(&bounded, lines, 1, CRON_CALC_OPT_DEFAULT, &offset));
+        CHECK_EQ_INT(1, offset);
+        CHECK_EQ_INT(CRON_CALC_ERROR_NUMBER_EXPECTED, cron_calc_parse_n(&bounded, lines, 0, CRON_CALC_OPT_DEFAULT, &offset));
+        CHECK_EQ_INT(0, offset);
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_parse_n(&bounded, NULL, 0, CRON_CALC_OPT_DEFAULT, &offset));
+        CHECK_TRUE(offset == CRON_CALC_INVALID_OFFSET);
+    }
+
     /* last is only allowed for days */
     CHECK_INVALID("L * * * *", CRON_CALC_OPT_DEFAULT, CRON_CALC_ERROR_NUMBER_EXPECTED, 0);
     CHECK_INVALID("L * * * * *", CRON_CALC_OPT_WITH_SECONDS, CRON_CALC_ERROR_NUMBER_EXPECTED, 0);
@@ -593,6 +895,40 @@ int main()
         "2108-02-29_00:00:00,"
         "2112-02-29_00:00:00");
 
+    /* Years are skipped by their type after few failed years */
+    CHECK_NEXT("30 12 29 FEB *", CRON_CALC_OPT_DEFAULT,
+        "2196-03-01_00:00:00",
+        "2204-02-29_12:30:00,"
+        "2208-02-29_12:30:00");
+
+    CHECK_NEXT("30 12 29 FEB *", CRON_CALC_OPT_DEFAULT,
+        "2397-03-01_00:00:00",
+        "2400-02-29_12:30:00,"
+        "2404-02-29_12:30:00");
+
+    /* Years after 64-year window */
+    CHECK_NEXT("0 0 1 1 * 1970,2000,2033-2199/40", CRON_CALC_OPT_WITH_YEARS,
+        "1960-01-01_00:00:00",
+        "1970-01-01_00:00:00,"
+        "2000-01-01_00:00:00,"
+        "2033-01-01_00:00:00,"
+        "2073-01-01_00:00:00,"
+        "2113-01-01_00:00:00,"
+        "2153-01-01_00:00:00,"
+        "2193-01-01_00:00:00,"
+        "-");
+
+    CHECK_NEXT("0 0 29 FEB * *", CRON_CALC_OPT_WITH_YEARS,
+        "2191-01-01_00:00:00",
+        "2192-02-29_00:00:00,"
+        "2196-02-29_00:00:00,"
+        "-");
+
+    CHECK_NEXT("0 0 1 1 * 2030,2150", CRON_CALC_OPT_WITH_YEARS,
+        "2030-01-01_00:00:00",
+        "2150-01-01_00:00:00,"
+        "-");
+
     /* 29-Feb with restricted year range */
     CHECK_NEXT("0 0 29 FEB * 2015-2021", CRON_CALC_OPT_WITH_YEARS,
         "1999-01-01_00:00:00",
@@ -720,6 +1056,683 @@ int main()
         "2020-02-01_07:10:00,2020-02-18_07:10:00,2020-02-19_07:10:00,2020-02-20_07:10:00,2020-02-29_07:10:00,"
         "2020-03-01_07:10:00,2020-03-18_07:10:00,2020-03-19_07:10:00,2020-03-20_07:10:00,2020-03-31_07:10:00");
 
+    /* Sparse rules */
+    CHECK_NEXT("0 0 1 */3 *", CRON_CALC_OPT_DEFAULT,
+        "2018-12-30_23:00:00",
+        "2019-01-01_00:00:00,2019-04-01_00:00:00,2019-07-01_00:00:00,"
+        "2019-10-01_00:00:00,2020-01-01_00:00:00");
+
+    CHECK_NEXT("59 23 L * *", CRON_CALC_OPT_DEFAULT,
+        "2020-01-31_23:59:00",
+        "2020-02-29_23:59:00,2020-03-31_23:59:00,2020-04-30_23:59:00");
+
+    CHECK_NEXT("59 59 23 L 2 * 2020,2022,2063", CRON_CALC_OPT_FULL,
+        "2020-03-01_00:00:00",
+        "2022-02-28_23:59:59,2063-02-28_23:59:59,-");
+
+    /* Both day fields restricted, week days are 'either' matched after last day */
+    CHECK_NEXT("0 0 L * SAT", CRON_CALC_OPT_DEFAULT,
+        "2019-02-22_00:00:00",
+        "2019-02-23_00:00:00,2019-02-28_00:00:00,2019-03-02_00:00:00");
+
+    /* Prev */
+    CHECK_EQ_INT(cron_calc_prev(NULL, 1549747649), CRON_CALC_INVALID_TIME);
+    CHECK_EQ_INT(cron_calc_prev(&cc, 1549747649), CRON_CALC_INVALID_TIME);
+
+    CHECK_PREV("* * * * *", CRON_CALC_OPT_DEFAULT,
+        "2019-01-01_00:01:00",
+        "2019-01-01_00:00:00,"
+        "2018-12-31_23:59:00,"
+        "2018-12-31_23:58:00");
+
+    CHECK_PREV("* * * * * *", CRON_CALC_OPT_WITH_SECONDS,
+        "2019-01-01_00:00:01",
+        "2019-01-01_00:00:00,"
+        "2018-12-31_23:59:59,"
+        "2018-12-31_23:59:58");
+
+    CHECK_PREV("5,10 5-10/2 * * * *", CRON_CALC_OPT_WITH_SECONDS,
+        "2019-01-01_00:05:06",
+        "2019-01-01_00:05:05,"
+        "2018-12-31_23:09:10,2018-12-31_23:09:05,"
+        "2018-12-31_23:07:10");
+
+    CHECK_PREV("10 7 1,L * *", CRON_CALC_OPT_DEFAULT,
+        "2020-04-01_07:10:00",
+        "2020-03-31_07:10:00,2020-03-01_07:10:00,"
+        "2020-02-29_07:10:00,2020-02-01_07:10:00,"
+        "2020-01-31_07:10:00");
+
+    /* Both day fields restricted -> match on either of them */
+    CHECK_PREV("1 2 28-31 * 5", CRON_CALC_OPT_DEFAULT,
+        "2019-01-30_00:00:00",
+        "2019-01-29_02:01:00,"
+        "2019-01-28_02:01:00,"
+        "2019-01-25_02:01:00,"  /* FRI */
+        "2019-01-18_02:01:00"); /* FRI */
+
+    /* Month day unrestricted -> match on both of them */
+    CHECK_PREV("1 2 * * 5", CRON_CALC_OPT_DEFAULT,
+        "2019-02-08_02:01:00",
+        "2019-02-01_02:01:00,"
+        "2019-01-25_02:01:00");
+
+    CHECK_PREV("0 0 29 FEB *", CRON_CALC_OPT_DEFAULT,
+        "2104-02-29_00:00:00",
+        "2096-02-29_00:00:00,"
+        "2092-02-29_00:00:00");
+
+    CHECK_PREV("30 12 29 FEB *", CRON_CALC_OPT_DEFAULT,
+        "2304-01-01_00:00:00",
+        "2296-02-29_12:30:00,"
+        "2292-02-29_12:30:00");
+
+    CHECK_PREV("0 0 29 FEB * 2015-2021", CRON_CALC_OPT_WITH_YEARS,
+        "2063-01-01_00:00:00",
+        "2020-02-29_00:00:00,"
+        "2016-02-29_00:00:00,"
+        "-");
+
+    CHECK_PREV("0 0 1 1 * 1970,2000,2033-2199/40", CRON_CALC_OPT_WITH_YEARS,
+        "2199-01-01_00:00:00",
+        "2193-01-01_00:00:00,"
+        "2153-01-01_00:00:00,"
+        "2113-01-01_00:00:00,"
+        "2073-01-01_00:00:00,"
+        "2033-01-01_00:00:00,"
+        "2000-01-01_00:00:00,"
+        "1970-01-01_00:00:00,"
+        "-");
+
+    CHECK_PREV("59 23 31 12 * 2020", CRON_CALC_OPT_WITH_YEARS,
+        "2022-12-30_23:00:00",
+        "2020-12-31_23:59:00,-");
+
+    /* Previous instants at DST transitions of local time */
+    {
+        const char* tz_env = getenv("TZ");
+        const std::string tz_saved = tz_env ? tz_env : "";
+        setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+        tzset();
+
+        cron_calc cc_dst;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_dst, "30 2 * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        /* repeated by DST end: both instants match, the latest one before given is returned */
+        CHECK_EQ_TIME(cron_calc_prev(&cc_dst, TSU("2019-10-27_01:40:00")), TSU("2019-10-27_01:30:00"));
+        CHECK_EQ_TIME(cron_calc_prev(&cc_dst, TSU("2019-10-27_01:30:00")), TSU("2019-10-27_00:30:00"));
+        CHECK_EQ_TIME(cron_calc_prev(&cc_dst, TSU("2019-10-27_01:10:00")), TSU("2019-10-27_00:30:00"));
+        CHECK_EQ_TIME(cron_calc_prev(&cc_dst, TSU("2019-10-27_00:30:00")), TSU("2019-10-26_00:30:00"));
+        /* skipped by DST start: moved 1 hour forward */
+        CHECK_EQ_TIME(cron_calc_prev(&cc_dst, TSU("2019-03-31_02:00:00")), TSU("2019-03-31_01:30:00"));
+        CHECK_EQ_TIME(cron_calc_prev(&cc_dst, TSU("2019-03-31_01:30:00")), TSU("2019-03-30_01:30:00"));
+
+        /* every matching instant is found around DST end */
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_dst, "*/20 1-3 * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        size_t mismatches = 0;
+        for (time_t before = TSU("2019-10-27_03:00:00"); before > TSU("2019-10-26_22:00:00"); before -= 300)
+        {
+            time_t expected = before - 60;
+            while (!cron_calc_matches(&cc_dst, expected)) expected -= 60;
+            mismatches += cron_calc_prev(&cc_dst, before) == expected ? 0 : 1;
+        }
+        CHECK_EQ_INT(0, mismatches);
+
+        if (tz_env) setenv("TZ", tz_saved.c_str(), 1); else unsetenv("TZ");
+        tzset();
+    }
+
+    /* Enumerate */
+    {
+        cron_calc cc_enum;
+        size_t count = 0;
+        static time_t times[86400 + 1];
+
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_enumerate(NULL, 0, 1, times, 1, &count));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_enumerate(&cc, 0, 1, times, 1, &count));
+
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_enum, "* * * * * *", CRON_CALC_OPT_WITH_SECONDS, NULL));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_enumerate(&cc_enum, 0, 1, NULL, 1, &count));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_enumerate(&cc_enum, 0, 1, times, 1, NULL));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_enumerate(&cc_enum, 0, 1, NULL, 0, &count));
+        CHECK_EQ_INT(0, count);
+
+        const time_t day = TS("2019-06-01_00:00:00");
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_enumerate(&cc_enum,
+            day, TS("2019-06-02_00:00:00"), times, sizeof times / sizeof times[0], &count));
+        CHECK_EQ_INT(86400, count);
+        bool all_seconds = true;
+        for (size_t i = 0; i < count; i++)
+        {
+            all_seconds = all_seconds && (times[i] == day + (time_t) i);
+        }
+        CHECK_TRUE(all_seconds);
+
+        /* buffer is full */
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_enumerate(&cc_enum, day, day + 100, times, 10, &count));
+        CHECK_EQ_INT(10, count);
+        CHECK_EQ_TIME(times[9], day + 9);
+
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_enum, "5,10 5-10/2 23 L * *", CRON_CALC_OPT_WITH_SECONDS, NULL));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_enumerate(&cc_enum,
+            TS("2019-01-31_23:05:10"), TS("2019-02-28_23:09:05"), times, 100, &count));
+        CHECK_EQ_INT(9, count);
+        CHECK_EQ_TIME(times[0], TS("2019-01-31_23:05:10"));
+        CHECK_EQ_TIME(times[1], TS("2019-01-31_23:07:05"));
+        CHECK_EQ_TIME(times[2], TS("2019-01-31_23:07:10"));
+        CHECK_EQ_TIME(times[3], TS("2019-01-31_23:09:05"));
+        CHECK_EQ_TIME(times[4], TS("2019-01-31_23:09:10"));
+        CHECK_EQ_TIME(times[5], TS("2019-02-28_23:05:05"));
+        CHECK_EQ_TIME(times[8], TS("2019-02-28_23:07:10"));
+
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_enum, "0 0 29 2 * 2019-2025", CRON_CALC_OPT_WITH_YEARS, NULL));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_enumerate(&cc_enum,
+            TS("2019-01-01_00:00:00"), TS("2030-01-01_00:00:00"), times, 100, &count));
+        CHECK_EQ_INT(2, count);
+        CHECK_EQ_TIME(times[0], TS("2020-02-29_00:00:00"));
+        CHECK_EQ_TIME(times[1], TS("2024-02-29_00:00:00"));
+    }
+
+    /* Cursor */
+    {
+        cron_calc_cursor cursor;
+        cron_calc cc_cur;
+
+        CHECK_EQ_TIME(cron_calc_cursor_init(NULL, &cc, 0), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_TIME(cron_calc_cursor_init(&cursor, NULL, 0), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_TIME(cron_calc_cursor_advance(&cursor), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_TIME(cron_calc_cursor_advance(NULL), CRON_CALC_INVALID_TIME);
+
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_cur, "58 59 23 L 2 * 2019-2021", CRON_CALC_OPT_FULL, NULL));
+        CHECK_EQ_TIME(cron_calc_cursor_init(&cursor, &cc_cur, TS("2019-01-01_00:00:00")), TS("2019-02-28_23:59:58"));
+        CHECK_EQ_TIME(cron_calc_cursor_advance(&cursor), TS("2020-02-29_23:59:58"));
+        CHECK_EQ_TIME(cron_calc_cursor_advance(&cursor), TS("2021-02-28_23:59:58"));
+        CHECK_EQ_TIME(cron_calc_cursor_advance(&cursor), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_TIME(cron_calc_cursor_advance(&cursor), CRON_CALC_INVALID_TIME);
+
+        const char* const cursor_exprs[] = {
+            "*/20 * * * * *", "0 */7 1-3 * * 1", "30 59 23 * * *", "0 0 0 L * *", "0 0 12 29 FEB *" };
+        for (size_t i = 0; i < sizeof cursor_exprs / sizeof cursor_exprs[0]; i++)
+        {
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_cur, cursor_exprs[i], CRON_CALC_OPT_WITH_SECONDS, NULL));
+            time_t expected = cron_calc_next(&cc_cur, TS("2019-12-31_00:00:00"));
+            time_t actual = cron_calc_cursor_init(&cursor, &cc_cur, TS("2019-12-31_00:00:00"));
+            for (int n = 0; n < 1000 && expected == actual && expected != CRON_CALC_INVALID_TIME; n++)
+            {
+                expected = cron_calc_next(&cc_cur, expected);
+                actual = cron_calc_cursor_advance(&cursor);
+            }
+            CHECK_EQ_TIME(expected, actual);
+        }
+    }
+
+    /* Compiled */
+    {
+        cron_calc_compiled compiled;
+        cron_calc cc_comp;
+
+        memset(&compiled, 0, sizeof compiled);
+        CHECK_EQ_TIME(cron_calc_compiled_next(&compiled, 0), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_TIME(cron_calc_compiled_next(NULL, 0), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_compile(NULL, &cc));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_compile(&compiled, NULL));
+
+        const char* const compiled_exprs[] = {
+            "0 0 12 13 * FRI", "0 0 12 * * 1-5", "0 30 6 1,15,L * SUN", "0 0 0 L * *", "0 0 12 29 FEB *",
+            "0 0 0 31 * *", "0 0 0 29-31 * 0", "* * * 10-20/3 */2 SAT",
+            "*/7 5-10 3,15 * * *", "59 59 23 L * *", "0 */5 * * * *", "30 0 0,12 * * *", "0 59 23 * * 1-5" };
+        cron_calc_day_time* day_time = NULL;
+        for (size_t i = 0; i < 2 * sizeof compiled_exprs / sizeof compiled_exprs[0]; i++)
+        {
+            /* second pass searches within a day by time of day bitmap */
+            const size_t expr = i % (sizeof compiled_exprs / sizeof compiled_exprs[0]);
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_comp, compiled_exprs[expr], CRON_CALC_OPT_WITH_SECONDS, NULL));
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_compile(&compiled, &cc_comp));
+            if (expr != i)
+            {
+                cron_calc_day_time_free(day_time);
+                CHECK_EQ_INT(CRON_CALC_OK, cron_calc_day_time_create(&day_time, &cc_comp));
+                CHECK_EQ_INT(CRON_CALC_OK, cron_calc_compiled_set_day_time(&compiled, day_time));
+            }
+            time_t expected = cron_calc_next(&cc_comp, TS("2019-12-31_00:00:00"));
+            time_t actual = cron_calc_compiled_next(&compiled, TS("2019-12-31_00:00:00"));
+            for (int n = 0; n < 500 && expected == actual && expected != CRON_CALC_INVALID_TIME; n++)
+            {
+                expected = cron_calc_next(&cc_comp, expected + 3600 * n);
+                actual = cron_calc_compiled_next(&compiled, actual + 3600 * n);
+            }
+            CHECK_EQ_TIME(expected, actual);
+        }
+
+        /* bitmap is accepted only by rules with the same time fields */
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_comp, "0 59 23 1 1 *", CRON_CALC_OPT_WITH_SECONDS, NULL));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_compile(&compiled, &cc_comp));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_compiled_set_day_time(&compiled, day_time));
+        CHECK_EQ_TIME(cron_calc_compiled_next(&compiled, TS("2019-12-31_23:59:00")), TS("2020-01-01_23:59:00"));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_comp, "0 58 23 1 1 *", CRON_CALC_OPT_WITH_SECONDS, NULL));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_compile(&compiled, &cc_comp));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_compiled_set_day_time(&compiled, day_time));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_compiled_set_day_time(&compiled, NULL));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_compiled_set_day_time(NULL, day_time));
+        cron_calc_day_time_free(day_time);
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_day_time_create(NULL, &cc_comp));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_day_time_create(&day_time, NULL));
+        CHECK_EQ_INT(0, day_time == NULL ? 0 : 1);
+    }
+
+    /* Specialized kernels */
+    {
+        static const struct
+        {
+            const char* expr;
+            cron_calc_option_mask options;
+        } kernel_rules[] = {
+            { "0 12 13 * FRI", CRON_CALC_OPT_DEFAULT }, { "0 12 */2 * 1-5", CRON_CALC_OPT_DEFAULT },
+            { "30 6 1,15,L * *", CRON_CALC_OPT_DEFAULT }, { "*/20 * * * */2", CRON_CALC_OPT_DEFAULT },
+            { "59 23 29 FEB *", CRON_CALC_OPT_DEFAULT }, { "* * * 10-20/3 */2 SAT", CRON_CALC_OPT_WITH_SECONDS },
+            { "*/7 5-10 3,15 * * *", CRON_CALC_OPT_WITH_SECONDS }, { "0 0 L * * 2020-2199/4", CRON_CALC_OPT_WITH_YEARS },
+            { "*/30 0 0 * * SUN 2021,2030", CRON_CALC_OPT_FULL }, { "0 0 0 29 2 * *", CRON_CALC_OPT_FULL } };
+        for (size_t i = 0; i < sizeof kernel_rules / sizeof kernel_rules[0]; i++)
+        {
+            cron_calc cc_kernel, cc_generic;
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_kernel, kernel_rules[i].expr, kernel_rules[i].options, NULL));
+            CHECK_EQ_INT(1, cc_kernel.kernel != 0);
+            cc_generic = cc_kernel;
+            cc_generic.kernel = 0;
+
+            time_t expected = cron_calc_next_utc(&cc_generic, TSU("2019-12-31_00:00:00"));
+            time_t actual = cron_calc_next_utc(&cc_kernel, TSU("2019-12-31_00:00:00"));
+            for (int n = 0; n < 500 && expected == actual && expected != CRON_CALC_INVALID_TIME; n++)
+            {
+                expected = cron_calc_next_utc(&cc_generic, expected + 3600 * n);
+                actual = cron_calc_next_utc(&cc_kernel, actual + 3600 * n);
+            }
+            CHECK_EQ_TIME(expected, actual);
+        }
+
+        /* kernel follows day fields changed after parsing */
+        cron_calc cc_kernel, cc_generic;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_kernel, "0 12 1 * *", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_generic, "0 12 1 * MON", CRON_CALC_OPT_DEFAULT, NULL));
+        cc_kernel.weekDays = cc_generic.weekDays;
+        cc_generic = cc_kernel;
+        cc_generic.kernel = 0;
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_generic, TSU("2020-01-01_00:00:00")), TSU("2020-06-01_12:00:00"));
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_kernel, TSU("2020-01-01_00:00:00")), TSU("2020-06-01_12:00:00"));
+
+        /* seconds other than 0th without seconds option are not handled by kernels */
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_kernel, "0 12 * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        cc_kernel.seconds = 1ull << 30;
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_kernel, TSU("2020-01-01_00:00:00")), TSU("2020-01-01_12:00:30"));
+        cc_generic = cc_kernel;
+        cc_generic.kernel = 0;
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_generic, TSU("2020-01-01_00:00:00")), TSU("2020-01-01_12:00:30"));
+    }
+
+    /* Matching instants */
+    {
+        static const struct
+        {
+            const char* expr;
+            cron_calc_option_mask options;
+        } match_rules[] = {
+            { "*/15 9-17 * * MON-FRI", CRON_CALC_OPT_DEFAULT }, { "0 0 L * *", CRON_CALC_OPT_DEFAULT },
+            { "30 2 * * FRI", CRON_CALC_OPT_DEFAULT }, { "*/10 * 0-3 1,15 * *", CRON_CALC_OPT_WITH_SECONDS },
+            { "0 0 0 29 2 * 2020-2199/8", CRON_CALC_OPT_FULL }, { "* * * * SUN 2020", CRON_CALC_OPT_WITH_YEARS } };
+        std::vector<time_t> instants;
+        for (time_t t = TS("2020-01-01_00:00:00"); t < TS("2020-03-01_00:00:00"); t += 30)
+        {
+            instants.push_back(t);
+        }
+        std::vector<uint8_t> matched(instants.size());
+
+        for (size_t i = 0; i < sizeof match_rules / sizeof match_rules[0]; i++)
+        {
+            cron_calc cc_match;
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_match, match_rules[i].expr, match_rules[i].options, NULL));
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_filter(&cc_match, &instants[0], instants.size(), &matched[0]));
+
+            /* matches of rules at 0th second are checked at instants found by next() */
+            size_t mismatches = 0, matches = 0;
+            for (size_t k = 0; k < instants.size(); k++)
+            {
+                const bool expected = cron_calc_next(&cc_match, instants[k] - 1) == instants[k];
+                if (expected != cron_calc_matches(&cc_match, instants[k]) || expected != (matched[k] == 1))
+                {
+                    mismatches++;
+                }
+                matches += matched[k];
+            }
+            for (time_t t = cron_calc_next(&cc_match, TS("2020-01-01_00:00:00"));
+                 t != CRON_CALC_INVALID_TIME && t < TS("2020-03-01_00:00:00"); t = cron_calc_next(&cc_match, t))
+            {
+                mismatches += cron_calc_matches(&cc_match, t) ? 0 : 1;
+                mismatches += cron_calc_matches(&cc_match, t + 1) == (cron_calc_next(&cc_match, t) == t + 1) ? 0 : 1;
+            }
+            CHECK_EQ_INT(0, mismatches);
+            CHECK_TRUE(matches > 0 || match_rules[i].options == CRON_CALC_OPT_FULL);
+        }
+
+        /* all days of a year including DST transitions, in reverse order */
+        cron_calc cc_match;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_match, "0 * * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        instants.clear();
+        for (time_t t = TS("2021-01-01_00:00:00"); t > TS("2020-01-01_00:00:00"); t -= 1800)
+        {
+            instants.push_back(t);
+        }
+        matched.resize(instants.size());
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_filter(&cc_match, &instants[0], instants.size(), &matched[0]));
+        size_t mismatches = 0;
+        for (size_t k = 0; k < instants.size(); k++)
+        {
+            mismatches += (matched[k] == 1) == cron_calc_matches(&cc_match, instants[k]) ? 0 : 1;
+            const time_t at = instants[k];
+            mismatches += (matched[k] == 1) == cron_calc_matches_tm(&cc_match, localtime(&at)) ? 0 : 1;
+        }
+        CHECK_EQ_INT(0, mismatches);
+
+        CHECK_EQ_INT(0, cron_calc_matches(NULL, 0));
+        CHECK_EQ_INT(0, cron_calc_matches_tm(&cc_match, NULL));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_filter(NULL, &instants[0], 1, &matched[0]));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_filter(&cc_match, NULL, 1, &matched[0]));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_filter(&cc_match, &instants[0], 1, NULL));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_filter(&cc_match, NULL, 0, NULL));
+    }
+
+    /* Counting instants */
+    {
+        static const struct
+        {
+            const char* expr;
+            cron_calc_option_mask options;
+        } count_rules[] = {
+            { "* * * * * *", CRON_CALC_OPT_WITH_SECONDS }, { "*/15 9-17 * * MON-FRI", CRON_CALC_OPT_DEFAULT },
+            { "0 0 L * *", CRON_CALC_OPT_DEFAULT }, { "30 2 * * SUN", CRON_CALC_OPT_DEFAULT },
+            { "*/10 * 0-3 1,15 * *", CRON_CALC_OPT_WITH_SECONDS }, { "0 0 0 29 2 * 2020-2199/8", CRON_CALC_OPT_FULL },
+            { "0 30 2 * MAR,OCT-NOV SUN 2020", CRON_CALC_OPT_FULL } };
+        /* ranges start and end within days, and cover DST transitions */
+        static const char* const ranges[][2] = {
+            { "2020-01-01_00:00:00", "2020-01-01_00:00:00" }, { "2020-01-01_00:00:00", "2020-01-02_00:00:00" },
+            { "2020-01-13_09:07:31", "2020-01-13_16:59:59" }, { "2020-02-27_13:13:13", "2020-04-02_07:00:01" },
+            { "2020-10-20_23:59:59", "2020-11-05_00:00:01" }, { "2019-12-31_12:00:00", "2021-01-01_12:00:00" } };
+        std::vector<time_t> found(400000);
+
+        for (size_t i = 0; i < sizeof count_rules / sizeof count_rules[0]; i++)
+        {
+            cron_calc cc_count;
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_count, count_rules[i].expr, count_rules[i].options, NULL));
+            for (size_t r = 0; r < sizeof ranges / sizeof ranges[0]; r++)
+            {
+                uint64_t count = 0;
+                size_t expected = 0;
+                const time_t from = TS(ranges[r][0]), to = TS(ranges[r][1]);
+                CHECK_EQ_INT(CRON_CALC_OK, cron_calc_count(&cc_count, from, to, &count));
+                if (count < found.size())
+                {
+                    cron_calc_enumerate(&cc_count, from, to, &found[0], found.size(), &expected);
+                    CHECK_EQ_INT(expected, count);
+                }
+                else
+                {
+                    /* every second, apart from DST shift */
+                    CHECK_TRUE(i == 0 && count >= uint64_t(to - from) - 3600 && count <= uint64_t(to - from) + 3600);
+                }
+            }
+        }
+
+        cron_calc cc_count;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_count, "* * * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        uint64_t count = 1;
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_count(NULL, 0, 1, &count));
+        CHECK_EQ_INT(0, count);
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_count(&cc_count, 0, 1, NULL));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_count(&cc_count, 10, 0, &count));
+        CHECK_EQ_INT(0, count);
+    }
+
+    /* Rule index */
+    {
+        static const struct
+        {
+            const char* expr;
+            cron_calc_option_mask options;
+        } index_rules[] = {
+            { "*/15 9-17 * * MON-FRI", CRON_CALC_OPT_DEFAULT }, { "0 0 L * *", CRON_CALC_OPT_DEFAULT },
+            { "30 2 * * FRI", CRON_CALC_OPT_DEFAULT }, { "*/10 * 0-3 1,15 * *", CRON_CALC_OPT_WITH_SECONDS },
+            { "0 0 0 29 2 * 2020-2199/8", CRON_CALC_OPT_FULL }, { "* * * * SUN 2020", CRON_CALC_OPT_WITH_YEARS },
+            { "0 */2 13 * FRI", CRON_CALC_OPT_DEFAULT }, { "0 0 L,15 * MON", CRON_CALC_OPT_DEFAULT },
+            { "* * * * * 2021-2030", CRON_CALC_OPT_WITH_YEARS }, { "*/20 0 * * * SAT", CRON_CALC_OPT_WITH_SECONDS } };
+        const size_t num_rules = sizeof index_rules / sizeof index_rules[0];
+
+        /* enough rules for several blocks of index words, each kind repeated */
+        std::vector<cron_calc> rules(600);
+        CronCalc cron_index;
+        for (size_t i = 0; i < rules.size(); i++)
+        {
+            const size_t k = (i * 7) % num_rules;
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&rules[i], index_rules[k].expr, index_rules[k].options, NULL));
+            CHECK_EQ_INT(CRON_CALC_OK, cron_index.addRule(index_rules[k].expr, index_rules[k].options, NULL));
+        }
+
+        cron_calc_index* index = NULL;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_index_create(&index, &rules[0], rules.size()));
+        CHECK_TRUE(index != NULL);
+
+        std::vector<size_t> ids(rules.size());
+        size_t mismatches = 0, total = 0;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (time_t t = TS("2020-02-28_00:00:00"); t < TS("2020-03-02_00:00:00"); t += 30)
+            {
+                size_t count = 0, expected = 0, fired = 0;
+                if (cron_calc_index_query(index, t, &ids[0], ids.size(), &count) != CRON_CALC_OK ||
+                    cron_index.match(t, &ids[0], ids.size(), &fired) != CRON_CALC_OK)
+                {
+                    mismatches++;
+                    continue;
+                }
+                bool kinds[num_rules]; /* rule 3 * k has kind k */
+                for (size_t k = 0; k < num_rules; k++)
+                {
+                    kinds[k] = cron_calc_matches(&rules[k * 3 % num_rules], t);
+                }
+                for (size_t i = 0; i < rules.size(); i++)
+                {
+                    if (kinds[(i * 7) % num_rules])
+                    {
+                        mismatches += expected < count && ids[expected] == i ? 0 : 1;
+                        expected++;
+                    }
+                }
+                mismatches += count == expected && fired == expected ? 0 : 1;
+                total += count;
+            }
+            /* the same results from index built by compile() */
+            CHECK_EQ_INT(CRON_CALC_OK, cron_index.compile());
+        }
+        CHECK_EQ_INT(0, mismatches);
+        CHECK_TRUE(total > 0);
+
+        /* rules added after compile() are found as well */
+        CHECK_EQ_INT(CRON_CALC_OK, cron_index.addRule("0 0 1 1 *", CRON_CALC_OPT_DEFAULT, NULL));
+        size_t count = 0;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_index.match(TS("2021-01-01_00:00:00"), &ids[0], ids.size(), &count));
+        CHECK_TRUE(count > 0 && ids[count - 1] == rules.size());
+
+        /* only first IDs are written, if buffer is too small */
+        const time_t friday = TS("2020-02-28_02:30:00");
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_index_query(index, friday, NULL, 0, &count));
+        const size_t friday_count = count;
+        CHECK_TRUE(friday_count > 2);
+        ids[2] = 0;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_index_query(index, friday, &ids[0], 2, &count));
+        CHECK_EQ_INT(friday_count, count);
+        CHECK_TRUE(ids[0] < ids[1] && ids[2] == 0);
+
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_index_query(NULL, friday, &ids[0], 1, &count));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_index_query(index, friday, NULL, 1, &count));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_index_query(index, friday, &ids[0], 1, NULL));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_index.match(friday, NULL, 1, &count));
+        cron_calc_index_free(index);
+
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_index_create(&index, NULL, 0));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_index_query(index, friday, NULL, 0, &count));
+        CHECK_EQ_INT(0, count);
+        cron_calc_index_free(index);
+
+        cron_calc cc_bad = rules[0];
+        cc_bad.months = 0;
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_index_create(&index, &cc_bad, 1));
+        CHECK_TRUE(index == NULL);
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_index_create(NULL, &rules[0], 1));
+        cron_calc_index_free(NULL);
+    }
+
+    /* Compile-time parsing */
+    {
+        constexpr cron_calc cc_static = cron::compile("0 */5 * * *");
+        static_assert(cc_static.minutes == 1 && cc_static.hours == 0x108421, "every 5 hours");
+        static_assert(cron::parse("0 0 31 FEB *").error == CRON_CALC_ERROR_IMPOSSIBLE_DATE, "impossible date");
+        static_assert(cron::parse("0 0 * * MOO").error_offset == 8, "error location");
+
+        cron_calc cc_runtime;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_runtime, "0 */5 * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_EQ_INT(0, memcmp(&cc_static, &cc_runtime, sizeof cc_runtime));
+
+        constexpr cron_calc cc_full = cron::compile("*/7 0 12 L FEB-APR SUN 2020-2199/3", CRON_CALC_OPT_FULL);
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_runtime, "*/7 0 12 L FEB-APR SUN 2020-2199/3", CRON_CALC_OPT_FULL, NULL));
+        CHECK_EQ_INT(0, memcmp(&cc_full, &cc_runtime, sizeof cc_runtime));
+
+        /* at run time invalid expression yields invalid object */
+        const char invalid[] = "0 0 30 FEB *";
+        const cron_calc cc_invalid = cron::compile(invalid);
+        CHECK_EQ_TIME(cron_calc_next(&cc_invalid, 0), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron::parse(NULL).error);
+    }
+
+    /* UTC and fixed offset */
+    {
+        cron_calc cc_utc;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_utc, "30 12 L 2 *", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_utc, TSU("2019-01-01_00:00:00")), TSU("2019-02-28_12:30:00"));
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_utc, TSU("2019-02-28_12:30:00")), TSU("2020-02-29_12:30:00"));
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_utc, TSU("2099-03-01_00:00:00")), TSU("2100-02-28_12:30:00"));
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_utc, TSU("1960-01-01_00:00:00")), TSU("1960-02-29_12:30:00"));
+        CHECK_EQ_TIME(cron_calc_next_offset(&cc_utc, TSU("2019-01-01_00:00:00"), 0), TSU("2019-02-28_12:30:00"));
+        /* UTC+05:30 */
+        CHECK_EQ_TIME(cron_calc_next_offset(&cc_utc, TSU("2019-01-01_00:00:00"), 19800), TSU("2019-02-28_07:00:00"));
+        /* UTC-10:00, local day starts 10 hours later */
+        CHECK_EQ_TIME(cron_calc_next_offset(&cc_utc, TSU("2019-02-28_12:00:00"), -36000), TSU("2019-02-28_22:30:00"));
+        CHECK_EQ_TIME(cron_calc_next_offset(&cc_utc, TSU("2019-02-28_12:00:00"), 86400), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_TIME(cron_calc_next_offset(&cc_utc, TSU("2019-02-28_12:00:00"), -86400), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_TIME(cron_calc_next_utc(NULL, TSU("2019-02-28_12:00:00")), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc, TSU("2019-02-28_12:00:00")), CRON_CALC_INVALID_TIME);
+        if (sizeof(time_t) > sizeof(int))
+        {
+            CHECK_EQ_TIME(cron_calc_next_utc(&cc_utc, 2L<<56), CRON_CALC_INVALID_TIME);
+            CHECK_EQ_TIME(cron_calc_next_utc(&cc_utc, -(2L<<56)), CRON_CALC_INVALID_TIME);
+        }
+
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_utc, "*/20 59 23 * * * 2063", CRON_CALC_OPT_FULL, NULL));
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_utc, TSU("2063-12-31_23:59:40")), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_utc, TSU("2063-12-31_23:59:20")), TSU("2063-12-31_23:59:40"));
+    }
+
+    /* Time zones */
+    {
+        cron_calc cc_tz;
+        cron_calc_tz* tz = NULL;
+
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_tz_load(&tz, "Europe/Berlin"));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_tz, "30 2 * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        /* skipped by DST start: moved 1 hour forward */
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2019-03-30_12:00:00")), TSU("2019-03-31_01:30:00"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2019-03-31_01:30:00")), TSU("2019-04-01_00:30:00"));
+        /* repeated by DST end: matches only once */
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2019-10-26_12:00:00")), TSU("2019-10-27_00:30:00"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2019-10-27_00:30:00")), TSU("2019-10-28_01:30:00"));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_tz, "*/20 2 * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2019-10-27_00:40:00")), TSU("2019-10-28_01:00:00"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2019-10-27_01:10:00")), TSU("2019-10-27_01:20:00"));
+        /* far future is calculated from the footer rule */
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_tz, "0 12 1 * *", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2100-06-15_00:00:00")), TSU("2100-07-01_10:00:00"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2100-11-15_00:00:00")), TSU("2100-12-01_11:00:00"));
+        /* and far past from the first transition */
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("1850-06-15_00:00:00")), TSU("1850-07-01_11:06:32"));
+        CHECK_EQ_TIME(cron_calc_next_tz(NULL, tz, TSU("2019-10-27_00:40:00")), CRON_CALC_INVALID_TIME);
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, NULL, TSU("2019-10-27_00:40:00")), CRON_CALC_INVALID_TIME);
+        cron_calc_tz_free(tz);
+
+        /* southern hemisphere: DST across new year */
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_tz_load(&tz, "Australia/Sydney"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2050-01-01_00:00:00")), TSU("2050-01-01_01:00:00"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2050-06-15_00:00:00")), TSU("2050-07-01_02:00:00"));
+        cron_calc_tz_free(tz);
+
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_tz_load(&tz, "/usr/share/zoneinfo/UTC"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2050-06-15_00:00:00")), TSU("2050-07-01_12:00:00"));
+        cron_calc_tz_free(tz);
+
+        /* footer rules */
+        uint8_t tz_data[256];
+        size_t tz_size = makeTzData(tz_data, "<+0330>-3:30");
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_tz_parse(&tz, tz_data, tz_size));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2019-06-15_00:00:00")), TSU("2019-07-01_08:30:00"));
+        cron_calc_tz_free(tz);
+
+        tz_size = makeTzData(tz_data, "EST5EDT,M3.2.0,M11.1.0");
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_tz_parse(&tz, tz_data, tz_size));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2030-06-15_00:00:00")), TSU("2030-07-01_16:00:00"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2030-11-15_00:00:00")), TSU("2030-12-01_17:00:00"));
+        cron_calc_tz_free(tz);
+
+        tz_size = makeTzData(tz_data, "AAA3BBB,J60/0,300/-1:30");
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_tz_parse(&tz, tz_data, tz_size));
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_tz, "0 12 * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2020-02-28_16:00:00")), TSU("2020-02-29_15:00:00"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2020-02-29_16:00:00")), TSU("2020-03-01_14:00:00"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2020-10-25_16:00:00")), TSU("2020-10-26_14:00:00"));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2020-10-26_16:00:00")), TSU("2020-10-27_15:00:00"));
+        cron_calc_tz_free(tz);
+
+        /* invalid footer is ignored */
+        tz_size = makeTzData(tz_data, "AAA3BBB,M3.2.9,M11.1.0");
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_tz_parse(&tz, tz_data, tz_size));
+        CHECK_EQ_TIME(cron_calc_next_tz(&cc_tz, tz, TSU("2020-06-30_16:00:00")), TSU("2020-07-01_12:00:00"));
+        cron_calc_tz_free(tz);
+
+        CHECK_EQ_INT(CRON_CALC_ERROR_TZ_DATA, cron_calc_tz_parse(&tz, tz_data, 40));
+        CHECK_TRUE(tz == NULL);
+        {
+            /* version 1 data with two transitions, each refers to type far beyond the only one */
+            static const uint8_t bad_types[] = {
+                'T', 'Z', 'i', 'f', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 2,  0, 0, 0, 1,  0, 0, 0, 4,
+                0, 0, 0, 1,  0, 0, 0, 2, /* transition times */
+                200, 0, /* transition types */
+                0, 0, 0, 0, 0, 0, 'U', 'T', 'C', 0 /* ttinfo and designation */
+            };
+            uint8_t bad_data[sizeof bad_types];
+            memcpy(bad_data, bad_types, sizeof bad_types);
+            CHECK_EQ_INT(CRON_CALC_ERROR_TZ_DATA, cron_calc_tz_parse(&tz, bad_data, sizeof bad_data));
+            CHECK_TRUE(tz == NULL);
+            bad_data[52] = 0;
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_tz_parse(&tz, bad_data, sizeof bad_data));
+            cron_calc_tz_free(tz);
+            /* transition times must increase */
+            bad_data[51] = 1;
+            CHECK_EQ_INT(CRON_CALC_ERROR_TZ_DATA, cron_calc_tz_parse(&tz, bad_data, sizeof bad_data));
+        }
+        CHECK_EQ_INT(CRON_CALC_ERROR_TZ_DATA, cron_calc_tz_parse(&tz, "TZif2 and some garbage here", 27));
+        CHECK_EQ_INT(CRON_CALC_ERROR_TZ_DATA, cron_calc_tz_load(&tz, "No/Such_Zone"));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_tz_load(&tz, "../../etc/passwd"));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_tz_load(&tz, NULL));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_tz_load(NULL, "UTC"));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cron_calc_tz_parse(&tz, NULL, 0));
+        cron_calc_tz_free(NULL);
+    }
+
     /* Synonyms */
     CHECK_SAME(
         "* * * 1-12 *", CRON_CALC_OPT_DEFAULT,
@@ -783,6 +1796,530 @@ int main()
     cron.addRule("0 * * * *");
     CHECK_EQ_INT(cron.next(T1), TS("2018-12-30_23:00:00")); // rule 5
 
+    /* Fired rules */
+    size_t ids[4] = { 0 };
+    size_t count = 0;
+    CHECK_EQ_INT(5, cron.size());
+    CHECK_EQ_INT(cron.nextCached(T1, ids, 4, &count), TS("2018-12-30_23:00:00"));
+    CHECK_EQ_INT(1, count);
+    CHECK_EQ_INT(4, ids[0]);
+    CHECK_EQ_INT(cron.nextCached(TS("2018-12-31_09:00:00"), ids, 4, &count), TS("2018-12-31_10:00:00"));
+    CHECK_EQ_INT(2, count);
+    CHECK_EQ_INT(2, ids[0]);
+    CHECK_EQ_INT(4, ids[1]);
+    CHECK_EQ_INT(cron.nextCached(TS("2019-01-07_09:59:59"), ids, 1, &count), TS("2019-01-07_10:00:00"));
+    CHECK_EQ_INT(3, count);
+    CHECK_EQ_INT(0, ids[0]);
+    CHECK_EQ_INT(cron.nextCached(TS("2019-01-07_09:59:59"), NULL, 0, &count), TS("2019-01-07_10:00:00"));
+    CHECK_EQ_INT(3, count);
+    CHECK_EQ_INT(cron.nextCached(T1, ids, 4, &count), TS("2018-12-30_23:00:00")); // back in time
+    CHECK_EQ_INT(1, count);
+    CHECK_EQ_INT(4, ids[0]);
+    cron.addRule("0 * 30 DEC *");
+    CHECK_EQ_INT(cron.nextCached(T1, ids, 4, &count), TS("2018-12-30_23:00:00")); // added to cache
+    CHECK_EQ_INT(2, count);
+    CHECK_EQ_INT(4, ids[0]);
+    CHECK_EQ_INT(5, ids[1]);
+    cron.addRule("0 0 0 1 1 * 2000", CRON_CALC_OPT_FULL, NULL);
+    CHECK_EQ_INT(7, cron.size());
+    CHECK_EQ_INT(cron.nextCached(T1, ids, 4, &count), TS("2018-12-30_23:00:00")); // never fires
+    CHECK_EQ_INT(2, count);
+
+    /* Bulk addition */
+    {
+        static const char* const exprs[] = { "0 10 * * *", "0 10 * * * *", "30 9 * * *", "61 * * * *", "0 9 * * *" };
+        cron_calc_error errors[5];
+        const char* err_locations[5];
+        CronCalc bulk;
+        CHECK_EQ_INT(CRON_CALC_OK, bulk.addRules(exprs, 1, CRON_CALC_OPT_DEFAULT, NULL, NULL));
+        CHECK_EQ_INT(bulk.nextCached(T1), TS("2018-12-31_10:00:00"));
+        CHECK_EQ_INT(CRON_CALC_ERROR_EXPR_LONG, bulk.addRules(exprs + 1, 4, CRON_CALC_OPT_DEFAULT, errors, err_locations));
+        CHECK_EQ_INT(CRON_CALC_ERROR_EXPR_LONG, errors[0]);
+        CHECK_EQ_INT(11, err_locations[0] - exprs[1]);
+        CHECK_EQ_INT(CRON_CALC_OK, errors[1]);
+        CHECK_TRUE(NULL == err_locations[1]);
+        CHECK_EQ_INT(CRON_CALC_ERROR_NUMBER_RANGE, errors[2]);
+        CHECK_EQ_INT(0, err_locations[2] - exprs[3]);
+        CHECK_EQ_INT(CRON_CALC_OK, errors[3]);
+        CHECK_EQ_INT(3, bulk.size());
+        CHECK_EQ_INT(bulk.nextCached(T1, ids, 4, &count), TS("2018-12-31_09:00:00"));
+        CHECK_EQ_INT(1, count);
+        CHECK_EQ_INT(2, ids[0]);
+        CHECK_EQ_INT(CRON_CALC_OK, bulk.addRules(exprs, 0, CRON_CALC_OPT_DEFAULT, NULL, NULL));
+        CHECK_EQ_INT(3, bulk.size());
+    }
+
+    /* Cached instants match individual rules */
+    {
+        static const char* const exprs[] = {
+            "*/7 * * * *", "0 */5 * * *", "30 12 * * MON-FRI", "0 0 L * *", "15 3 29 FEB *", "1-5 0 1 * *"
+        };
+        const size_t n = sizeof(exprs) / sizeof(exprs[0]);
+        CronCalc multi;
+        cron_calc rules[n];
+        for (size_t i = 0; i < n; i++)
+        {
+            CHECK_EQ_INT(CRON_CALC_OK, multi.addRule(exprs[i]));
+            cron_calc_parse(&rules[i], exprs[i], CRON_CALC_OPT_DEFAULT, NULL);
+        }
+
+        time_t t = TS("2019-12-31_23:00:00");
+        for (int step = 0; step < 2000; step++)
+        {
+            time_t expected = CRON_CALC_INVALID_TIME;
+            size_t expected_count = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                const time_t next = cron_calc_next(&rules[i], t);
+                if (next == CRON_CALC_INVALID_TIME) continue;
+                if (expected == CRON_CALC_INVALID_TIME || next < expected) expected_count = 0;
+                if (expected == CRON_CALC_INVALID_TIME || next <= expected) { expected = next; expected_count++; }
+            }
+            CHECK_EQ_INT(expected, multi.nextCached(t, ids, 4, &count));
+            CHECK_EQ_INT(expected_count, count);
+            const std::vector<size_t> cached_ids(ids, ids + std::min<size_t>(count, 4));
+            /* next() evaluates all rules without cache */
+            const CronCalc& shared = multi;
+            CHECK_EQ_INT(expected, shared.next(t, ids, 4, &count));
+            CHECK_EQ_INT(expected_count, count);
+            CHECK_TRUE(std::equal(cached_ids.begin(), cached_ids.end(), ids));
+            t = expected + (step % 3 == 0 ? 0 : 59);
+        }
+
+        /* next() can be called concurrently on shared object */
+        const CronCalc& shared = multi;
+        std::vector<std::thread> threads;
+        std::atomic<size_t> failed(0);
+        const time_t start = TS("2020-01-01_00:00:00");
+        for (int k = 0; k < 4; k++)
+        {
+            threads.push_back(std::thread([&shared, &failed, start, k]()
+            {
+                time_t from = start + k * 3600;
+                for (int step = 0; step < 200; step++)
+                {
+                    const time_t next = shared.next(from);
+                    if (next <= from) failed++;
+                    from = next;
+                }
+            }));
+        }
+        for (size_t k = 0; k < threads.size(); k++) threads[k].join();
+        CHECK_EQ_INT(0, failed.load());
+    }
+
+    /* Rules firing at instants moved by DST */
+    {
+        const char* tz_env = getenv("TZ");
+        const std::string tz_saved = tz_env ? tz_env : "";
+        setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+        tzset();
+
+        CronCalc dst;
+        CHECK_EQ_INT(CRON_CALC_OK, dst.addRule("30 2 * * *"));
+        CHECK_EQ_INT(CRON_CALC_OK, dst.addRule("0 9 * * *"));
+        const CronCalc& shared = dst;
+        /* 02:30 skipped by DST start is moved to 03:30 CEST */
+        CHECK_EQ_TIME(shared.next(TSU("2019-03-31_00:00:00"), ids, 4, &count), TSU("2019-03-31_01:30:00"));
+        CHECK_EQ_INT(1, count);
+        CHECK_EQ_INT(0, ids[0]);
+        CHECK_EQ_TIME(dst.nextCached(TSU("2019-03-31_00:00:00"), ids, 4, &count), TSU("2019-03-31_01:30:00"));
+        CHECK_EQ_INT(1, count);
+        CHECK_EQ_INT(0, ids[0]);
+        /* moved instant stays cached until it passes, while search from 03:29:59 CEST skips it */
+        CHECK_EQ_TIME(dst.nextCached(TSU("2019-03-31_01:29:59"), ids, 4, &count), TSU("2019-03-31_01:30:00"));
+        CHECK_EQ_INT(1, count);
+        CHECK_EQ_TIME(shared.next(TSU("2019-03-31_01:29:59"), ids, 4, &count), TSU("2019-03-31_07:00:00"));
+        CHECK_EQ_INT(1, count);
+        CHECK_EQ_INT(1, ids[0]);
+
+        if (tz_env) setenv("TZ", tz_saved.c_str(), 1); else unsetenv("TZ");
+        tzset();
+    }
+
+    /* Optimized rule set */
+    {
+        static const char* const exprs[] = {
+            "0 10 * * MON", "0 10 * * MON", "15 10 * * MON", "30 10 * * MON",
+            "0 10 * * TUE", "0 10 1 * *", "0 10 2 * *", "0 10 1 * MON",
+            "0 0 L FEB *", "0 0 29 FEB *", "45 23 * * *", "45 23 * * 1-5", "0 12 13 * FRI"
+        };
+        CHECK_OPTIMIZED(exprs, CRON_CALC_OPT_DEFAULT, "2019-12-31_12:00:00", 1000);
+
+        /* merged units firing at instants moved by DST */
+        {
+            const char* tz_env = getenv("TZ");
+            const std::string tz_saved = tz_env ? tz_env : "";
+            setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+            tzset();
+
+            static const char* const dst_exprs[] = { "30 2 * * *", "45 2 * * *", "30 2 * * *", "0 9 * * SUN" };
+            CHECK_OPTIMIZED(dst_exprs, CRON_CALC_OPT_DEFAULT, "2019-03-30_12:00:00", 10);
+
+            if (tz_env) setenv("TZ", tz_saved.c_str(), 1); else unsetenv("TZ");
+            tzset();
+        }
+
+        CronCalc optimized;
+        CHECK_EQ_INT(CRON_CALC_OK, optimized.addRules(exprs, 13, CRON_CALC_OPT_DEFAULT, NULL, NULL));
+        CHECK_EQ_INT(CRON_CALC_OK, optimized.optimize());
+        CHECK_EQ_INT(optimized.next(TS("2019-12-30_09:00:00"), ids, 4, &count), TS("2019-12-30_10:00:00"));
+        CHECK_EQ_INT(3, count);
+        CHECK_EQ_INT(0, ids[0]);
+        CHECK_EQ_INT(1, ids[1]);
+        CHECK_EQ_INT(7, ids[2]);
+
+        static const char* const year_exprs[] = {
+            "0 0 1 1 * 2020", "0 0 1 1 * 2021", "0 0 1 1 * 2090-2199/10", "0 0 1 1 * 2100-2199/10",
+            "0 0 1 1 * 2000,2060-2199/20", "0 0 1 1 * 2000,2063", "0 0 1 JUL * 2000,2063", "0 0 1 1 * 2001,2063"
+        };
+        CHECK_OPTIMIZED(year_exprs, CRON_CALC_OPT_WITH_YEARS, "1999-01-01_00:00:00", 100);
+    }
+
+    /* Scheduler */
+    {
+        static const struct
+        {
+            const char* expr;
+            cron_calc_option_mask options;
+        } sched_rules[] = {
+            { "*/15 * 0 * * *", CRON_CALC_OPT_WITH_SECONDS }, { "0 */2 * * *", CRON_CALC_OPT_DEFAULT },
+            { "30 2 * * FRI", CRON_CALC_OPT_DEFAULT }, { "0 0 1 * *", CRON_CALC_OPT_DEFAULT },
+            { "59 59 23 * * *", CRON_CALC_OPT_WITH_SECONDS }, { "0 0 1 3 * 2020", CRON_CALC_OPT_WITH_YEARS },
+            { "7 7 7 L * *", CRON_CALC_OPT_WITH_SECONDS }, { "0 0 0 29 FEB * 2024", CRON_CALC_OPT_FULL } };
+        const size_t num_rules = sizeof sched_rules / sizeof sched_rules[0];
+        const time_t start = TS("2020-01-30_23:58:00");
+        const time_t end = TS("2020-04-02_00:00:00");
+
+        CronCalcScheduler scheduler(start);
+        SchedulerLog log = { &scheduler, std::vector<std::pair<size_t, time_t> >(), size_t(-1), 0 };
+        std::vector<cron_calc> rules(num_rules);
+        size_t id = 0;
+        for (size_t i = 0; i < num_rules; i++)
+        {
+            CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&rules[i], sched_rules[i].expr, sched_rules[i].options, NULL));
+            CHECK_EQ_INT(CRON_CALC_OK, scheduler.addRule(
+                sched_rules[i].expr, sched_rules[i].options, onSchedulerFire, &log, &id, NULL));
+            CHECK_EQ_INT(i, id);
+        }
+        CHECK_EQ_INT(num_rules, scheduler.size());
+
+        /* all (instant, rule) pairs in order, whatever steps time is advanced by,
+         * each rule continues from its previous instant, as the scheduler re-arms it,
+         * so that instants moved by DST transitions at midnight are found too */
+        std::vector<std::pair<time_t, size_t> > expected;
+        for (size_t i = 0; i < num_rules; i++)
+        {
+            for (time_t t = cron_calc_next(&rules[i], start); t != CRON_CALC_INVALID_TIME && t <= end;
+                 t = cron_calc_next(&rules[i], t))
+            {
+                expected.push_back(std::make_pair(t, i));
+            }
+        }
+        std::sort(expected.begin(), expected.end());
+
+        time_t now = start;
+        size_t fired = 0, mismatches = 0, steps = 0;
+        while (now < end)
+        {
+            /* the first pair after all pairs of current time */
+            const std::vector<std::pair<time_t, size_t> >::const_iterator following =
+                std::upper_bound(expected.begin(), expected.end(), std::make_pair(now, size_t(-1)));
+            mismatches += (following == expected.end()
+                ? scheduler.nextFiring() > end
+                : scheduler.nextFiring() == following->first) ? 0 : 1;
+            steps++;
+            now = std::min(end, now + time_t(steps % 7 == 0 ? 90000 : (steps * 37) % 5000 + 1));
+            fired += scheduler.advance(now);
+            mismatches += scheduler.now() == now ? 0 : 1;
+        }
+        CHECK_EQ_INT(0, mismatches);
+        CHECK_EQ_INT(expected.size(), fired);
+        CHECK_EQ_INT(expected.size(), log.fired.size());
+
+        /* rules firing at the same instant may be reported in any order */
+        std::vector<std::pair<time_t, size_t> > reported;
+        for (size_t k = 0; k < log.fired.size(); k++)
+        {
+            reported.push_back(std::make_pair(log.fired[k].second, log.fired[k].first));
+            mismatches += k == 0 || log.fired[k - 1].second <= log.fired[k].second ? 0 : 1;
+        }
+        std::sort(reported.begin(), reported.end());
+        CHECK_TRUE(reported == expected);
+        CHECK_EQ_INT(0, mismatches);
+        CHECK_EQ_INT(num_rules - 1, scheduler.size());  /* 2020-03-01 passed */
+        CHECK_EQ_INT(0, scheduler.advance(now));
+
+        /* cancelling, also from callback */
+        CHECK_TRUE(scheduler.cancel(0));
+        CHECK_TRUE(!scheduler.cancel(0));
+        CHECK_TRUE(!scheduler.cancel(100));
+        CHECK_EQ_INT(CRON_CALC_OK, scheduler.addRule("* * * * *", CRON_CALC_OPT_DEFAULT, onSchedulerFire, &log, &id, NULL));
+        CHECK_EQ_INT(0, id);
+        log.fired.clear();
+        log.cancelId = 1;
+        CHECK_EQ_INT(1, scheduler.advance(now + 60));
+        /* late advance fires at every instant, rule 1 is cancelled */
+        CHECK_EQ_INT(3 * 60 - 1, scheduler.advance(now + 3 * 3600));
+        CHECK_EQ_INT(now + 3 * 3600 + 60, scheduler.nextFiring());
+        CHECK_EQ_INT(3 * 60, log.fired.size());
+        size_t cancelled_fired = 0;
+        for (size_t k = 0; k < log.fired.size(); k++)
+        {
+            cancelled_fired += log.fired[k].first == 1 ? 1 : 0;
+        }
+        CHECK_EQ_INT(0, cancelled_fired);
+        CHECK_EQ_INT(now + 3 * 3600, log.fired.back().second);
+
+        CHECK_EQ_INT(CRON_CALC_ERROR_IMPOSSIBLE_DATE,
+            scheduler.addRule("0 0 1 1 * 2020", CRON_CALC_OPT_WITH_YEARS, onSchedulerFire, &log, &id, NULL));
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, scheduler.addRule("* * * * *", CRON_CALC_OPT_DEFAULT, NULL, NULL, &id, NULL));
+        const char* err_location = NULL;
+        CHECK_EQ_INT(CRON_CALC_ERROR_NUMBER_EXPECTED,
+            scheduler.addRule("* * * * ?", CRON_CALC_OPT_DEFAULT, onSchedulerFire, &log, &id, &err_location));
+        CHECK_TRUE(err_location != NULL);
+
+        /* run loop catches up with system time, then waits */
+        CronCalcScheduler running(time(NULL) - 10);
+        SchedulerLog run_log = { &running, std::vector<std::pair<size_t, time_t> >(), size_t(-1), 0 };
+        CHECK_EQ_INT(CRON_CALC_INVALID_TIME, running.nextFiring());
+        CHECK_EQ_INT(0, running.run(onSchedulerWait, &run_log));
+        CHECK_EQ_INT(CRON_CALC_OK, running.addRule("* * * * * *", CRON_CALC_OPT_WITH_SECONDS, onSchedulerFire, &run_log, NULL, NULL));
+        CHECK_TRUE(running.run(onSchedulerWait, &run_log) >= 10);
+        CHECK_TRUE(run_log.waits > 0);
+    }
+
+    /* Worker pool */
+    {
+        PoolLog pool_log;
+        pool_log.runs = 0;
+        pool_log.idSum = 0;
+        pool_log.hold = false;
+        {
+            CronCalcPool pool(3, 3, CronCalcPool::BLOCK);
+            CHECK_EQ_INT(3, pool.workers());
+            for (size_t i = 0; i < 1000; i++)
+            {
+                CHECK_TRUE(pool.submit(onPoolRun, i, time(NULL), &pool_log));
+            }
+            pool.drain();
+            CHECK_EQ_INT(1000, pool_log.runs.load());
+            CHECK_EQ_INT(999 * 1000 / 2, pool_log.idSum.load());
+
+            const CronCalcPool::Metrics metrics = pool.metrics();
+            CHECK_EQ_INT(0, metrics.depth);
+            CHECK_TRUE(metrics.maxDepth > 0 && metrics.maxDepth <= 3 * 4);
+            CHECK_EQ_INT(1000, metrics.submitted);
+            CHECK_EQ_INT(1000, metrics.executed);
+            CHECK_EQ_INT(0, metrics.rejected);
+            uint64_t bucketed = 0;
+            for (size_t i = 0; i < CronCalcPool::LAG_BUCKETS; i++) bucketed += metrics.lagBuckets[i];
+            CHECK_EQ_INT(1000, bucketed);
+
+            /* lag is measured from scheduled instant */
+            pool.submit(onPoolRun, 0, time(NULL) - 2, &pool_log);
+            pool.drain();
+            CHECK_TRUE(pool.metrics().lagMaxUs >= 2000000);
+            CHECK_TRUE(pool.metrics().lagBuckets[11] + pool.metrics().lagBuckets[12] > 0);
+        }
+
+        /* backpressure by rejection, worker is busy with the first task */
+        {
+            CronCalcPool pool(1, 2, CronCalcPool::REJECT);
+            pool_log.runs = 0;
+            pool_log.hold = true;
+            size_t submitted = 0;
+            while (submitted < 10 && pool.submit(onPoolRun, submitted, time(NULL), &pool_log))
+            {
+                submitted++;
+            }
+            CHECK_TRUE(submitted >= 2 && submitted <= 3);
+            CHECK_EQ_INT(1, pool.metrics().rejected);
+            CHECK_TRUE(pool.depth(0) >= 1);
+            pool_log.hold = false;
+            pool.drain();
+            CHECK_EQ_INT(submitted, pool_log.runs.load());
+            CHECK_EQ_INT(0, pool.depth(0));
+        }
+
+        /* backpressure by blocking, submit() is woken when worker takes a task */
+        {
+            CronCalcPool pool(1, 1, CronCalcPool::BLOCK);
+            pool_log.runs = 0;
+            pool_log.hold = true;
+            std::thread submitter([&pool, &pool_log]()
+            {
+                for (size_t i = 0; i < 3; i++) pool.submit(onPoolRun, i, time(NULL), &pool_log);
+            });
+            while (pool.metrics().blocked == 0)
+            {
+                std::this_thread::yield();
+            }
+            CHECK_EQ_INT(0, pool_log.runs.load());
+            pool_log.hold = false;
+            submitter.join();
+            pool.drain();
+            CHECK_EQ_INT(3, pool_log.runs.load());
+            CHECK_EQ_INT(3, pool.metrics().submitted);
+        }
+
+        /* fired rules of scheduler run in pool, the pool runs remaining tasks when destroyed */
+        pool_log.runs = 0;
+        size_t fired = 0;
+        {
+            CronCalcPool pool(2, 16, CronCalcPool::BLOCK);
+            CronCalcPoolCallback job = { &pool, onPoolRun, &pool_log };
+            CronCalcScheduler scheduler(TS("2020-01-01_00:00:00"));
+            for (int i = 0; i < 100; i++)
+            {
+                CHECK_EQ_INT(CRON_CALC_OK, scheduler.addRule(
+                    i % 2 ? "0 0 * * *" : "*/30 * * * *", CRON_CALC_OPT_DEFAULT, CronCalcPool::dispatch, &job, NULL, NULL));
+            }
+            fired = scheduler.advance(TS("2020-01-03_00:00:00"));
+        }
+        CHECK_EQ_INT(50 * 2 + 50 * 2 * 24 * 2, fired);
+        CHECK_EQ_INT(fired, pool_log.runs.load());
+    }
+
+    /* Parsing cache */
+    {
+        CronCalcCache cache(20);
+        CHECK_EQ_INT(32, cache.metrics().capacity);
+
+        /* results equal to parser's ones, for valid and invalid expressions */
+        const char* const exprs[] = { "0 0 * * *", "*/5 * * * MON-FRI", "0 0 31 FEB *", "* * * * ?" };
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+            {
+                /* a copy, so that error location is checked to be relative to given string */
+                const std::string copy(exprs[i]);
+                const char* cached_location = NULL;
+                const char* parsed_location = NULL;
+                /* output object is overwritten on errors too, as parser does */
+                memset(&cc, 0xA5, sizeof cc);
+                memset(&cc2, 0x5A, sizeof cc2);
+                CHECK_EQ_INT(cron_calc_parse(&cc2, copy.c_str(), CRON_CALC_OPT_DEFAULT, &parsed_location),
+                             cache.parse(&cc, copy.c_str(), CRON_CALC_OPT_DEFAULT, &cached_location));
+                CHECK_TRUE(cached_location == parsed_location);
+                CHECK_TRUE(cron_calc_is_same(&cc, &cc2));
+                CHECK_EQ_INT(cc2.kernel, cc.kernel);
+            }
+        }
+        CHECK_EQ_INT(4, cache.metrics().size);
+        CHECK_EQ_INT(4, cache.metrics().misses);
+        CHECK_EQ_INT(4, cache.metrics().hits);
+
+        /* options are part of the key */
+        CHECK_EQ_INT(CRON_CALC_ERROR_EXPR_SHORT, cache.parse(&cc, "0 0 * * *", CRON_CALC_OPT_WITH_SECONDS, NULL));
+        CHECK_EQ_INT(5, cache.metrics().misses);
+        CHECK_EQ_INT(CRON_CALC_ERROR_ARGUMENT, cache.parse(&cc, NULL, CRON_CALC_OPT_DEFAULT, NULL));
+
+        /* memory is bounded, hot entries survive eviction */
+        char expr[32];
+        for (int i = 1; i <= 200; i++)
+        {
+            snprintf(expr, sizeof(expr), "%d %d * * *", i % 60, i / 60);
+            CHECK_EQ_INT(CRON_CALC_OK, cache.parse(&cc, expr, CRON_CALC_OPT_DEFAULT, NULL));
+            CHECK_EQ_INT(CRON_CALC_OK, cache.parse(&cc, "0 0 * * *", CRON_CALC_OPT_DEFAULT, NULL));
+        }
+        CronCalcCache::Metrics metrics = cache.metrics();
+        CHECK_EQ_INT(32, metrics.size);
+        CHECK_TRUE(metrics.evictions >= 200 - 32);
+        CHECK_EQ_INT(5 + 200, metrics.misses);
+        CHECK_EQ_INT(4 + 200, metrics.hits);
+
+        cache.clear();
+        CHECK_EQ_INT(0, cache.metrics().size);
+
+        /* CronCalc parses through the cache, concurrently from several threads */
+        CronCalcCache shared(1024);
+        std::vector<std::thread> threads;
+        std::atomic<size_t> failed(0);
+        const time_t from = TS("2020-01-01_00:30:00");
+        const time_t expected = TS("2020-01-01_01:00:00");
+        for (int t = 0; t < 4; t++)
+        {
+            threads.push_back(std::thread([&shared, &failed, from, expected]()
+            {
+                CronCalc cron;
+                cron.setParser(CronCalcCache::parser, &shared);
+                for (int i = 0; i < 1000; i++)
+                {
+                    char expr[32];
+                    snprintf(expr, sizeof(expr), "0 %d * * *", i % 24);
+                    if (cron.addRule(expr) != CRON_CALC_OK) failed++;
+                }
+                if (cron.next(from) != expected) failed++;
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+        CHECK_EQ_INT(0, failed.load());
+        CHECK_EQ_INT(24, shared.metrics().size);
+        CHECK_EQ_INT(4 * 1000, shared.metrics().hits + shared.metrics().misses);
+        CHECK_TRUE(shared.metrics().hits >= 4 * 1000 - 4 * 24);
+
+        CronCalc cron;
+        cron.setParser(CronCalcCache::parser, &cache);
+        err_location = NULL;
+        CHECK_EQ_INT(CRON_CALC_ERROR_NUMBER_RANGE, cron.addRule("0 24 * * *", CRON_CALC_OPT_DEFAULT, &err_location));
+        CHECK_TRUE(err_location != NULL);
+        cron.setParser(NULL, NULL);
+        CHECK_EQ_INT(CRON_CALC_OK, cron.addRule("0 23 * * *"));
+        CHECK_EQ_INT(1, cron.size());
+    }
+
+#ifdef CRON_CALC_WITH_STATS
+    /* Search stats */
+    {
+        cron_calc_stats last, total, generic;
+        cron_calc cc_leap, cc_generic;
+        CHECK_EQ_INT(CRON_CALC_OK, cron_calc_parse(&cc_leap, "0 0 29 2 *", CRON_CALC_OPT_DEFAULT, NULL));
+        cc_generic = cc_leap;
+        cc_generic.kernel = 0;
+
+        cron_calc_stats_reset();
+        CHECK_EQ_TIME(cron_calc_next(&cc_leap, TS("2021-03-01_00:00:00")), TS("2024-02-29_00:00:00"));
+        cron_calc_stats_get(&last, &total);
+        CHECK_EQ_INT(1, last.calls);
+        CHECK_EQ_INT(4, last.years_scanned);
+        CHECK_EQ_INT(3, last.level_iterations[0]); /* 2023 is skipped by its type */
+        CHECK_EQ_INT(6, last.max_depth);
+        CHECK_TRUE(last.week_day_calls > 0);
+        CHECK_EQ_INT(2, last.time_conversions); /* localtime_r() and mktime() */
+        CHECK_EQ_INT(0, memcmp(&last, &total, sizeof last));
+
+        /* kernel and generic search try the same values */
+        CHECK_EQ_TIME(cron_calc_next(&cc_generic, TS("2021-03-01_00:00:00")), TS("2024-02-29_00:00:00"));
+        cron_calc_stats_get(&generic, &total);
+        CHECK_EQ_INT(2, total.calls);
+        CHECK_EQ_INT(last.years_scanned, generic.years_scanned);
+        CHECK_EQ_INT(last.max_depth, generic.max_depth);
+        for (int level = 0; level < CRON_CALC_STATS_LEVELS; level++)
+        {
+            CHECK_EQ_INT(last.level_iterations[level], generic.level_iterations[level]);
+        }
+
+        /* UTC search does not call libc */
+        CHECK_EQ_TIME(cron_calc_next_utc(&cc_leap, TSU("2021-03-01_00:00:00")), TSU("2024-02-29_00:00:00"));
+        cron_calc_stats_get(&last, &total);
+        CHECK_EQ_INT(0, last.time_conversions);
+        CHECK_EQ_INT(4, total.time_conversions);
+        CHECK_EQ_INT(3, total.calls);
+        CHECK_EQ_INT(12, total.years_scanned);
+
+        /* counters are per thread */
+        std::thread([&cc_leap]() { cron_calc_next(&cc_leap, TS("2021-03-01_00:00:00")); }).join();
+        cron_calc_stats_get(NULL, &total);
+        CHECK_EQ_INT(3, total.calls);
+
+        cron_calc_stats_reset();
+        cron_calc_stats_get(&last, &total);
+        CHECK_EQ_INT(0, last.calls);
+        CHECK_EQ_INT(0, total.calls);
+    }
+#endif
+
     printf("Failures: %d\n", gNumErrors);
     return gNumErrors;
 }